@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/quaternion.hpp>
+
+#include "Animation.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+
+//------------------------------------------------------------------------------
+
+void SkeletalAnimation::Init(std::vector<int> joint_parents,
+                             std::vector<glm::mat4> inverse_bind_pose,
+                             const IQMPose *joint_poses, const Uint16 *frames,
+                             int frame_count, int frame_channels,
+                             std::vector<AnimationClip> animation_clips)
+{
+    parents = std::move(joint_parents);
+    inverse_bind = std::move(inverse_bind_pose);
+    poses.assign(joint_poses, joint_poses + parents.size());
+    frame_data.assign(frames, frames + size_t(frame_count) * frame_channels);
+    clips = std::move(animation_clips);
+    num_frames = frame_count;
+    num_frame_channels = frame_channels;
+}
+
+//------------------------------------------------------------------------------
+
+int SkeletalAnimation::FindClip(const std::string &name) const
+{
+    for (size_t i = 0; i < clips.size(); i++) {
+        if (clips[i].name == name) {
+            return static_cast<int>(i);
+        }
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+void SkeletalAnimation::DecodeFrame(int frame, JointPose *pose) const
+{
+    if (pose->GetNumJoints() != GetNumJoints()) {
+        pose->Resize(GetNumJoints());
+    }
+
+    const Uint16 *framedata =
+        &frame_data[size_t(frame) * num_frame_channels];
+
+    for (int j = 0; j < GetNumJoints(); j++) {
+        const IQMPose &p = poses[j];
+        glm::quat rotate;
+        glm::vec3 translate, scale;
+
+        translate.x = p.channeloffset[0];
+        if (p.mask & 0x01)
+            translate.x += *framedata++ * p.channelscale[0];
+        translate.y = p.channeloffset[1];
+        if (p.mask & 0x02)
+            translate.y += *framedata++ * p.channelscale[1];
+        translate.z = p.channeloffset[2];
+        if (p.mask & 0x04)
+            translate.z += *framedata++ * p.channelscale[2];
+
+        rotate.x = p.channeloffset[3];
+        if (p.mask & 0x08)
+            rotate.x += *framedata++ * p.channelscale[3];
+        rotate.y = p.channeloffset[4];
+        if (p.mask & 0x10)
+            rotate.y += *framedata++ * p.channelscale[4];
+        rotate.z = p.channeloffset[5];
+        if (p.mask & 0x20)
+            rotate.z += *framedata++ * p.channelscale[5];
+        rotate.w = p.channeloffset[6];
+        if (p.mask & 0x40)
+            rotate.w += *framedata++ * p.channelscale[6];
+
+        scale.x = p.channeloffset[7];
+        if (p.mask & 0x80)
+            scale.x += *framedata++ * p.channelscale[7];
+        scale.y = p.channeloffset[8];
+        if (p.mask & 0x100)
+            scale.y += *framedata++ * p.channelscale[8];
+        scale.z = p.channeloffset[9];
+        if (p.mask & 0x200)
+            scale.z += *framedata++ * p.channelscale[9];
+
+        pose->Set(j, translate, rotate, scale);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void Animator::SetAnimation(const SkeletalAnimation *skeletal_animation)
+{
+    animation = skeletal_animation;
+    current = Track();
+    previous = Track();
+    layers.clear();
+
+    // The identity palette is the bind pose, until the first Update.
+    int num_joints = animation ? animation->GetNumJoints() : 0;
+    pose.Resize(num_joints);
+    sample.Resize(num_joints);
+    world.assign(num_joints, glm::mat4(1.0f));
+    palette.assign(num_joints, glm::mat4(1.0f));
+}
+
+//------------------------------------------------------------------------------
+
+void Animator::Play(int clip, float fade_seconds, bool loop)
+{
+    if (!animation || clip < 0 || clip >= animation->GetNumClips()) {
+        return;
+    }
+
+    // Swapping keeps both tracks' frame buffers, and their decoded frames
+    // stay valid since they are numbered across all clips.
+    if (fade_seconds > 0.0f && current.clip >= 0) {
+        std::swap(previous, current);
+        fade_duration = fade_seconds;
+        fade_elapsed = 0.0f;
+    } else {
+        previous.clip = -1;
+    }
+
+    current.clip = clip;
+    current.time = 0.0f;
+    current.loop = loop;
+}
+
+//------------------------------------------------------------------------------
+
+void Animator::SetAdditiveLayer(int layer, int clip, float weight)
+{
+    if (!animation || layer < 0 || clip >= animation->GetNumClips()) {
+        return;
+    }
+    if (layer >= static_cast<int>(layers.size())) {
+        layers.resize(layer + 1);
+    }
+
+    Track &track = layers[layer];
+    if (clip >= 0 && clip != track.clip) {
+        track.time = 0.0f;
+        animation->DecodeFrame(animation->GetClip(clip).first_frame,
+                               &track.reference);
+    }
+    track.clip = clip;
+    track.weight = weight;
+}
+
+//------------------------------------------------------------------------------
+
+void Animator::Sample(Track *track, JointPose *out)
+{
+    const AnimationClip &clip = animation->GetClip(track->clip);
+    float duration = clip.num_frames / clip.framerate;
+    int last_frame = clip.num_frames - 1;
+
+    if (track->loop) {
+        track->time = std::fmod(track->time, duration);
+    } else {
+        track->time = std::min(track->time, duration);
+    }
+
+    float position = std::min(track->time * clip.framerate, float(last_frame));
+    int frame0 = static_cast<int>(position);
+    int frame1 = frame0 + 1;
+    if (frame1 > last_frame) {
+        frame1 = track->loop ? 0 : last_frame;
+    }
+    frame0 += clip.first_frame;
+    frame1 += clip.first_frame;
+
+    // Playback mostly moves forward, so the later of the last two frames
+    // is often the earlier one now and only one needs decoding.
+    if (track->decoded[1] == frame0 && track->decoded[0] != frame0) {
+        std::swap(track->frames[0], track->frames[1]);
+        std::swap(track->decoded[0], track->decoded[1]);
+    }
+    if (track->decoded[0] != frame0) {
+        animation->DecodeFrame(frame0, &track->frames[0]);
+        track->decoded[0] = frame0;
+    }
+    if (track->decoded[1] != frame1) {
+        animation->DecodeFrame(frame1, &track->frames[1]);
+        track->decoded[1] = frame1;
+    }
+
+    BlendPoses(track->frames[0], track->frames[1],
+               position - static_cast<int>(position), out);
+}
+
+//------------------------------------------------------------------------------
+
+void Animator::Update(float seconds)
+{
+    SP_PROFILE_ZONE("Animator::Update");
+
+    if (!animation || current.clip < 0) {
+        return;
+    }
+
+    current.time += seconds;
+    Sample(&current, &pose);
+
+    if (previous.clip >= 0) {
+        previous.time += seconds;
+        fade_elapsed += seconds;
+
+        if (fade_elapsed >= fade_duration) {
+            previous.clip = -1;
+        } else {
+            Sample(&previous, &sample);
+            BlendPoses(sample, pose, fade_elapsed / fade_duration, &pose);
+        }
+    }
+
+    for (Track &layer : layers) {
+        if (layer.clip < 0 || layer.weight == 0.0f) {
+            continue;
+        }
+        layer.time += seconds;
+        Sample(&layer, &sample);
+        AddPose(pose, sample, layer.reference, layer.weight, &pose);
+    }
+
+    BuildSkinningPalette(pose, animation->GetParents(),
+                         animation->GetInverseBindPose(), world.data(),
+                         palette.data());
+}
+
+} // namespace sp
@@ -0,0 +1,128 @@
+#ifndef _SP_ANIMATION_H_
+#define _SP_ANIMATION_H_
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "IQM.hpp"
+#include "Pose.hpp"
+
+namespace sp {
+
+struct AnimationClip {
+    std::string name;
+    int first_frame;
+    int num_frames;
+    float framerate;
+};
+
+// Skeleton and clips of one model, shared by every Animator that plays it.
+// Frames stay quantized the way IQM stores them: each frame holds
+// num_frame_channels values, one per bit set in the pose masks, which scale
+// and offset the pose's channels.
+class SkeletalAnimation
+{
+public:
+    SkeletalAnimation() : num_frames(0), num_frame_channels(0) {}
+
+    // The arrays must already be validated: parents come before children
+    // and every clip and frame lies within frames.
+    void Init(std::vector<int> joint_parents,
+              std::vector<glm::mat4> inverse_bind_pose, const IQMPose *poses,
+              const Uint16 *frames, int num_frames, int num_frame_channels,
+              std::vector<AnimationClip> clips);
+
+    int GetNumJoints() const { return static_cast<int>(parents.size()); }
+    int GetNumClips() const { return static_cast<int>(clips.size()); }
+    const AnimationClip &GetClip(int clip) const { return clips[clip]; }
+    // -1 when there is no clip called name.
+    int FindClip(const std::string &name) const;
+
+    const int *GetParents() const { return parents.data(); }
+    const glm::mat4 *GetInverseBindPose() const
+    {
+        return inverse_bind.data();
+    }
+
+    // Joint transforms of one frame, relative to their parents.
+    void DecodeFrame(int frame, JointPose *pose) const;
+
+private:
+    std::vector<int> parents;
+    std::vector<glm::mat4> inverse_bind;
+    std::vector<IQMPose> poses;
+    std::vector<Uint16> frame_data;
+    std::vector<AnimationClip> clips;
+    int num_frames;
+    int num_frame_channels;
+};
+
+// Playback state of one character: a base clip, crossfading from the one
+// played before it, with additive layers on top. Update evaluates all of
+// them into one pose and builds the skinning palette in a single pass. The
+// pose buffers are kept between updates, so playback doesn't allocate once
+// every clip and layer has been used.
+class Animator
+{
+public:
+    Animator() : animation(nullptr), fade_duration(0.0f), fade_elapsed(0.0f)
+    {
+    }
+
+    // Stops everything. animation must outlive the animator.
+    void SetAnimation(const SkeletalAnimation *animation);
+
+    // Starts clip from its beginning, crossfading from the current clip
+    // over fade_seconds. A clip that doesn't loop holds its last frame.
+    void Play(int clip, float fade_seconds = 0.0f, bool loop = true);
+    int GetClip() const { return current.clip; }
+
+    // Adds the difference between clip and its first frame, scaled by
+    // weight, on top of the base clips. Layers apply in index order; a clip
+    // of -1 turns a layer off.
+    void SetAdditiveLayer(int layer, int clip, float weight);
+
+    void Update(float seconds);
+
+    // Empty until the first Update.
+    const std::vector<glm::mat4> &GetPalette() const { return palette; }
+
+private:
+    struct Track {
+        Track()
+            : clip(-1), time(0.0f), weight(1.0f), loop(true), decoded{-1, -1}
+        {
+        }
+
+        int clip;
+        float time;
+        float weight;
+        bool loop;
+        // The two frames last sampled, and for layers the clip's first
+        // frame the additive difference is taken against.
+        JointPose frames[2];
+        JointPose reference;
+        int decoded[2];
+    };
+
+    void Sample(Track *track, JointPose *pose);
+
+    const SkeletalAnimation *animation;
+    Track current;
+    Track previous;
+    float fade_duration;
+    float fade_elapsed;
+    std::vector<Track> layers;
+
+    JointPose pose;
+    JointPose sample;
+    std::vector<glm::mat4> world;
+    std::vector<glm::mat4> palette;
+};
+
+} // namespace sp
+
+#endif
@@ -1,213 +1,822 @@
+#include <algorithm>
 #include <string>
-#include <iostream>
+#include <cstring>
 #include <cassert>
+#include <iterator>
 
 #include <SDL2/SDL_opengl.h>
 #include <SDL2/SDL_image.h>
 
 #include "Asset.hpp"
+#include "CookCache.hpp"
+#include "FileSystem.hpp"
+#include "JobSystem.hpp"
 #include "Logger.hpp"
-
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-#define RMASK 0xff000000
-#define GMASK 0x00ff0000
-#define BMASK 0x0000ff00
-#define AMASK 0x000000ff
-#else
-#define RMASK 0x000000ff
-#define GMASK 0x0000ff00
-#define BMASK 0x00ff0000
-#define AMASK 0xff000000
-#endif
+#include "Profiler.hpp"
 
 namespace sp
 {
 
+// Bump whenever the cooked texture layout changes, see CookCache.hpp.
+static const Uint32 kTextureCookVersion = 1;
+
 static TextureCache texture_cache;
+static JobSystem *texture_jobs = nullptr;
 
 //------------------------------------------------------------------------------
 
 TextureCache::~TextureCache()
 {
-    for (auto it = cache.begin(); it != cache.end(); it++) {
-        glDeleteTextures(1, &it->second);
+    for (auto it = entries.begin(); it != entries.end(); it++) {
+        glDeleteTextures(1, &it->first);
+    }
+    entries.clear();
+    ids.clear();
+    lru.clear();
+
+    for (auto &upload : uploads) {
+        for (SDL_Surface *surface : upload.surfaces) {
+            SDL_FreeSurface(surface);
+        }
     }
-    cache.clear();
+    uploads.clear();
 }
 
-GLuint MakeTextureFromSurface(const std::string &name, SDL_Surface *surface,
-                              GLenum target)
+//------------------------------------------------------------------------------
+
+GLuint TextureCache::Acquire(const std::string &name)
 {
-    TextureCache::TextureMap::const_iterator search =
-        texture_cache.cache.find(name);
+    auto search = ids.find(name);
+    if (search == ids.end()) {
+        stats.misses++;
+        return 0;
+    }
+
+    stats.hits++;
 
-    if (search != texture_cache.cache.end()) {
-        return search->second;
+    Entry &entry = entries[search->second];
+    if (entry.refs++ == 0) {
+        lru.erase(entry.lru_position);
     }
 
-    assert(surface != nullptr);
+    return search->second;
+}
 
-    GLuint id;
+//------------------------------------------------------------------------------
 
-    glGenTextures(1, &id);
-    glBindTexture(target, id);
+void TextureCache::Insert(const std::string &name, GLuint id, GLenum target,
+                          size_t bytes, bool uploading)
+{
+    ids[name] = id;
+    entries[id] = {name, target, bytes, 1, uploading, lru.end()};
+    resident_bytes += bytes;
 
-    GLenum format;
-    GLint internal_format = GL_RGB8;
+    EvictToBudget();
+}
+
+//------------------------------------------------------------------------------
+
+void TextureCache::FinishUpload(GLuint id, size_t bytes)
+{
+    auto search = entries.find(id);
+    if (search == entries.end()) {
+        return;
+    }
+
+    Entry &entry = search->second;
+    if (bytes) {
+        resident_bytes = resident_bytes - entry.bytes + bytes;
+        entry.bytes = bytes;
+    }
+    entry.uploading = false;
+
+    EvictToBudget();
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<TextureReload> TextureCache::BeginReload(const std::string &file)
+{
+    std::vector<TextureReload> reloads;
+    std::string path = vfs::NormalizePath(file);
+
+    for (auto &it : entries) {
+        Entry &entry = it.second;
+        if (entry.uploading) {
+            continue;
+        }
+
+        // Cube maps from separate faces are named after all six.
+        TextureReload reload = {it.first, entry.target, {}};
+        bool uses_file = false;
+        size_t start = 0;
+        while (start < entry.name.size()) {
+            size_t end = entry.name.find(';', start);
+            if (end == std::string::npos) {
+                end = entry.name.size();
+            }
+            reload.files.push_back(entry.name.substr(start, end - start));
+            uses_file = uses_file ||
+                        vfs::NormalizePath(reload.files.back()) == path;
+            start = end + 1;
+        }
+
+        if (uses_file) {
+            entry.uploading = true;
+            reloads.push_back(std::move(reload));
+        }
+    }
+
+    return reloads;
+}
+
+//------------------------------------------------------------------------------
+
+void TextureCache::Release(GLuint id)
+{
+    auto search = entries.find(id);
+    if (search == entries.end() || search->second.refs == 0) {
+        log::ErrorLog("TextureCache::Release: texture %u isn't referenced\n",
+                      id);
+        return;
+    }
+
+    Entry &entry = search->second;
+    if (--entry.refs == 0) {
+        entry.lru_position = lru.insert(lru.end(), id);
+        EvictToBudget();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void TextureCache::SetBudget(size_t bytes)
+{
+    budget_bytes = bytes;
+    EvictToBudget();
+}
+
+//------------------------------------------------------------------------------
+
+void TextureCache::EvictToBudget()
+{
+    auto it = lru.begin();
+    while (resident_bytes > budget_bytes && it != lru.end()) {
+        GLuint id = *it;
+        Entry &entry = entries[id];
+
+        // The upload would land in a recycled texture name.
+        if (entry.uploading) {
+            ++it;
+            continue;
+        }
+
+        glDeleteTextures(1, &id);
+        resident_bytes -= entry.bytes;
+        stats.evictions++;
+
+        ids.erase(entry.name);
+        entries.erase(id);
+        it = lru.erase(it);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+TextureStats TextureCache::GetStats() const
+{
+    TextureStats result = stats;
+    result.resident_bytes = resident_bytes;
+    result.budget_bytes = budget_bytes;
+    result.num_textures = static_cast<int>(entries.size());
+    result.num_unreferenced = static_cast<int>(lru.size());
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+static void SetTextureParameters(GLenum target)
+{
+    switch (target) {
+    case GL_TEXTURE_2D:
+        // Until the mips are uploaded only the base level exists.
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER,
+                        GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+        break;
+
+    case GL_TEXTURE_CUBE_MAP:
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        break;
+
+    default:
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Drivers pad RGB8 texels to four bytes as well.
+static const size_t kBytesPerTexel = 4;
+
+//------------------------------------------------------------------------------
+
+static bool GetSurfaceFormat(const SDL_Surface *surface, GLenum *format,
+                             GLint *internal_format)
+{
+    *internal_format = GL_RGB8;
     switch (surface->format->BytesPerPixel) {
     case 1:
-        format = (surface->format->Rmask == 0x000000ff) ? GL_RGB : GL_BGR;
+        *format = (surface->format->Rmask == 0x000000ff) ? GL_RGB : GL_BGR;
         break;
     case 4:
-        format = (surface->format->Rmask == 0x000000ff) ? GL_RGBA : GL_BGRA;
-        internal_format = GL_RGBA8;
+        *format = (surface->format->Rmask == 0x000000ff) ? GL_RGBA : GL_BGRA;
+        *internal_format = GL_RGBA8;
         break;
     case 3:
-        format = (surface->format->Rmask == 0x000000ff) ? GL_RGB : GL_BGR;
+        *format = (surface->format->Rmask == 0x000000ff) ? GL_RGB : GL_BGR;
         break;
     default:
         sp::log::ErrorLog("Invalid format for surface: %d\n",
                           surface->format->BytesPerPixel);
-        assert(false);
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// Points the unpack state at the rows of surface. SDL_image may pack them
+// tightly, pad them to four bytes or, for cropped surfaces, leave them
+// wider than the image.
+static bool SetUnpackRows(const SDL_Surface *surface)
+{
+    int bytes_per_pixel = surface->format->BytesPerPixel;
+    if (surface->pitch % bytes_per_pixel == 0) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, surface->pitch / bytes_per_pixel);
+        return true;
+    }
+
+    // Padding that isn't a whole pixel has to come from the alignment.
+    int row_bytes = surface->w * bytes_per_pixel;
+    for (int alignment = 8; alignment > 1; alignment /= 2) {
+        if ((row_bytes + alignment - 1) / alignment * alignment ==
+            surface->pitch) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, surface->w);
+            return true;
+        }
+    }
+
+    log::ErrorLog("Can't upload surface rows of %d bytes with a pitch of %d\n",
+                  row_bytes, surface->pitch);
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+static void ResetUnpackRows()
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+}
+
+//------------------------------------------------------------------------------
+
+// Face positions in a cross, in face sized cells, indexed from
+// GL_TEXTURE_CUBE_MAP_POSITIVE_X. The vertical cross stores -Z upside down.
+struct CrossLayout {
+    int cells[6][2];
+    int rotated_face;
+};
+
+static const CrossLayout kHorizontalCross = {
+    {{2, 1}, {0, 1}, {1, 0}, {1, 2}, {1, 1}, {3, 1}}, -1};
+static const CrossLayout kVerticalCross = {
+    {{2, 1}, {0, 1}, {1, 0}, {1, 2}, {1, 1}, {1, 3}}, 5};
+
+//------------------------------------------------------------------------------
+
+// Uploads the six faces of a cross shaped image straight out of the surface
+// by pointing the unpack state at each face.
+static size_t UploadCubeCross(const SDL_Surface *surface)
+{
+    GLenum format;
+    GLint internal_format;
+    if (!GetSurfaceFormat(surface, &format, &internal_format)) {
+        return 0;
+    }
+
+    const CrossLayout *layout;
+    int face_size;
+    if (surface->w * 3 == surface->h * 4) {
+        layout = &kHorizontalCross;
+        face_size = surface->w / 4;
+    } else if (surface->w * 4 == surface->h * 3) {
+        layout = &kVerticalCross;
+        face_size = surface->w / 3;
+    } else {
+        log::ErrorLog("Cube map cross must be 4:3 or 3:4, got %dx%d\n",
+                      surface->w, surface->h);
+        return 0;
+    }
+
+    int bytes_per_pixel = surface->format->BytesPerPixel;
+    std::vector<Uint8> rotated;
+
+    if (!SetUnpackRows(surface)) {
+        return 0;
+    }
+    for (int face = 0; face < 6; face++) {
+        int x = layout->cells[face][0] * face_size;
+        int y = layout->cells[face][1] * face_size;
+        GLenum face_target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+
+        if (face != layout->rotated_face) {
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+            glTexImage2D(face_target, 0, internal_format, face_size,
+                         face_size, 0, format, GL_UNSIGNED_BYTE,
+                         surface->pixels);
+            continue;
+        }
+
+        // Unpack state can't flip, this face goes through a tightly packed
+        // copy.
+        int rotated_pitch = face_size * bytes_per_pixel;
+        rotated.resize(rotated_pitch * face_size);
+
+        const Uint8 *pixels = static_cast<const Uint8 *>(surface->pixels);
+        for (int row = 0; row < face_size; row++) {
+            const Uint8 *src = pixels + (y + face_size - 1 - row) *
+                                            surface->pitch +
+                               (x + face_size - 1) * bytes_per_pixel;
+            Uint8 *dst = &rotated[row * rotated_pitch];
+            for (int col = 0; col < face_size; col++) {
+                memcpy(dst, src, bytes_per_pixel);
+                dst += bytes_per_pixel;
+                src -= bytes_per_pixel;
+            }
+        }
+
+        ResetUnpackRows();
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(face_target, 0, internal_format, face_size, face_size, 0,
+                     format, GL_UNSIGNED_BYTE, rotated.data());
+        SetUnpackRows(surface);
+    }
+
+    ResetUnpackRows();
+
+    return 6 * face_size * face_size * kBytesPerTexel;
+}
+
+//------------------------------------------------------------------------------
+
+// Faces come from separate images, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order.
+static size_t UploadCubeFaces(SDL_Surface *const faces[6])
+{
+    size_t bytes = 0;
+
+    for (int face = 0; face < 6; face++) {
+        const SDL_Surface *surface = faces[face];
+        GLenum format;
+        GLint internal_format;
+
+        if (surface->w != surface->h) {
+            log::ErrorLog("Cube map face %d isn't square: %dx%d\n", face,
+                          surface->w, surface->h);
+            continue;
+        }
+
+        if (!GetSurfaceFormat(surface, &format, &internal_format) ||
+            !SetUnpackRows(surface)) {
+            continue;
+        }
+
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0,
+                     internal_format, surface->w, surface->h, 0, format,
+                     GL_UNSIGNED_BYTE, surface->pixels);
+        bytes += surface->w * surface->h * kBytesPerTexel;
     }
+    ResetUnpackRows();
+
+    return bytes;
+}
+
+//------------------------------------------------------------------------------
 
-    int bpp = surface->format->BitsPerPixel;
-    // TODO: Remove hard coded values
-    int img_w = 512;
-    int img_h = 512;
+// Uploads the image of surface into the texture bound to target and returns
+// the size it takes on the GPU. Cube maps are read from a horizontal or
+// vertical cross. Sampler state is left alone so it survives replacing a
+// placeholder.
+static size_t UploadSurface(SDL_Surface *surface, GLenum target)
+{
+    if (target == GL_TEXTURE_CUBE_MAP) {
+        return UploadCubeCross(surface);
+    }
+
+    GLenum format;
+    GLint internal_format;
+    if (!GetSurfaceFormat(surface, &format, &internal_format) ||
+        !SetUnpackRows(surface)) {
+        return 0;
+    }
 
+    size_t bytes = 0;
     switch (target) {
     case GL_TEXTURE_1D:
         glTexImage1D(GL_TEXTURE_1D, 0, internal_format, surface->w, 0, format,
                      GL_UNSIGNED_BYTE, surface->pixels);
+        bytes = surface->w * kBytesPerTexel;
         break;
 
     case GL_TEXTURE_2D:
-        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
         glTexImage2D(target, 0, internal_format, surface->w, surface->h, 0,
                      format, GL_UNSIGNED_BYTE, surface->pixels);
-
+        bytes = surface->w * surface->h * kBytesPerTexel;
         break;
+    }
+    ResetUnpackRows();
 
-    case GL_TEXTURE_CUBE_MAP:
-        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    return bytes;
+}
 
-        {
-            SDL_Surface *sub_surface = SDL_CreateRGBSurface(
-                0, img_w, img_h, bpp, RMASK, GMASK, BMASK, AMASK);
-            SDL_Rect source_rect = {512, 512, 512, 512};
-            if (SDL_BlitSurface(surface, &source_rect, sub_surface, nullptr) !=
-                0) {
-                std::cerr << SDL_GetError() << std::endl;
-            }
+//------------------------------------------------------------------------------
 
-            assert(sub_surface != nullptr);
+// Builds the mip chain of a 2D texture. The box filter works on RGBA8, other
+// formats are converted first; the converted surface is returned and has to
+// be uploaded and freed instead of the original.
+static SDL_Surface *PrepareMips(SDL_Surface *surface,
+                                std::vector<MipLevel> *mips)
+{
+    SDL_Surface *converted = nullptr;
+    if (surface->format->format != SDL_PIXELFORMAT_RGBA32) {
+        converted =
+            SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+        if (!converted) {
+            log::ErrorLog("Can't convert surface for mipmapping: %s\n",
+                          SDL_GetError());
+            return nullptr;
+        }
+        surface = converted;
+    }
 
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RGBA8, img_w,
-                         img_h, 0, format, GL_UNSIGNED_BYTE,
-                         sub_surface->pixels);
+    GenerateMipChain(static_cast<const Uint8 *>(surface->pixels), surface->w,
+                     surface->h, surface->pitch, MAX_TEXTURE_MIPS, mips);
 
-            SDL_FreeSurface(sub_surface);
-        }
+    return converted;
+}
 
-        {
-            SDL_Surface *sub_surface = SDL_CreateRGBSurface(
-                0, img_w, img_h, bpp, RMASK, GMASK, BMASK, AMASK);
-            SDL_Rect source_rect = {0, 513, 512, 512};
-            if (SDL_BlitSurface(surface, &source_rect, sub_surface, nullptr) !=
-                0) {
-                std::cerr << SDL_GetError() << std::endl;
-            }
+//------------------------------------------------------------------------------
 
-            assert(sub_surface != nullptr);
+// Uploads the levels below the base image of the bound 2D texture and returns
+// their size.
+static size_t UploadMips(const std::vector<MipLevel> &mips)
+{
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < mips.size(); i++) {
+        const MipLevel &mip = mips[i];
+        glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i + 1), GL_RGBA8,
+                     mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     mip.pixels.data());
+        bytes += mip.pixels.size();
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    static_cast<GLint>(mips.size()));
 
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RGBA8, img_w,
-                         img_h, 0, format, GL_UNSIGNED_BYTE,
-                         sub_surface->pixels);
+    return bytes;
+}
 
-            SDL_FreeSurface(sub_surface);
-        }
+//------------------------------------------------------------------------------
 
-        {
-            SDL_Surface *sub_surface = SDL_CreateRGBSurface(
-                0, img_w, img_h, bpp, RMASK, GMASK, BMASK, AMASK);
-            SDL_Rect source_rect = {512, 0, 512, 512};
-            if (SDL_BlitSurface(surface, &source_rect, sub_surface, nullptr) !=
-                0) {
-                std::cerr << SDL_GetError() << std::endl;
-            }
+// SDL_image only detects TGA by its extension, so the type is passed along.
+static SDL_Surface *DecodeSurface(const vfs::File &file,
+                                  const std::string &image_file)
+{
+    size_t dot = image_file.rfind('.');
+    std::string type =
+        dot == std::string::npos ? "" : image_file.substr(dot + 1);
+    SDL_RWops *rw = SDL_RWFromConstMem(file.GetData(),
+                                       static_cast<int>(file.GetSize()));
 
-            assert(sub_surface != nullptr);
+    return IMG_LoadTyped_RW(rw, 1, type.c_str());
+}
 
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_RGBA8, img_w,
-                         img_h, 0, format, GL_UNSIGNED_BYTE,
-                         sub_surface->pixels);
+//------------------------------------------------------------------------------
 
-            SDL_FreeSurface(sub_surface);
+// Decodes an image through the virtual file system.
+static SDL_Surface *LoadSurface(const std::string &image_file)
+{
+    vfs::File file;
+    if (!vfs::ReadFile(image_file, &file)) {
+        SDL_SetError("Couldn't open %s", image_file.c_str());
+        return nullptr;
+    }
+
+    return DecodeSurface(file, image_file);
+}
+
+//------------------------------------------------------------------------------
+
+// A cooked 2D texture is its RGBA8 mip chain, ready for UploadImage.
+static bool LoadCookedTexture(Uint64 key, TextureImage *image)
+{
+    vfs::File blob;
+    if (!cook::Load(key, &blob)) {
+        return false;
+    }
+
+    cook::Reader reader(blob);
+    Uint32 num_levels = 0;
+    bool valid = reader.Read(&num_levels) && num_levels > 0 &&
+                 num_levels <= MAX_TEXTURE_MIPS;
+
+    image->internal_format = GL_RGBA8;
+    image->levels.clear();
+    for (Uint32 i = 0; valid && i < num_levels; i++) {
+        TextureLevel level;
+        const Uint8 *pixels;
+        valid = reader.Read(&level.width) && reader.Read(&level.height) &&
+                reader.ReadArray(&pixels, &level.size) && level.width > 0 &&
+                level.height > 0 &&
+                level.size == size_t(level.width) * level.height * 4;
+        if (valid) {
+            level.offset = pixels - blob.GetData();
+            image->levels.push_back(level);
         }
+    }
 
-        {
-            SDL_Surface *sub_surface = SDL_CreateRGBSurface(
-                0, img_w, img_h, bpp, RMASK, GMASK, BMASK, AMASK);
-            SDL_Rect source_rect = {2 * 512, 513, 512, 512};
-            if (SDL_BlitSurface(surface, &source_rect, sub_surface, nullptr) !=
-                0) {
-                std::cerr << SDL_GetError() << std::endl;
-            }
+    if (!valid) {
+        log::ErrorLog("Ignoring cooked texture with a bad layout\n");
+        image->levels.clear();
+        return false;
+    }
+    image->file = std::move(blob);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
 
-            assert(sub_surface != nullptr);
+static void StoreCookedTexture(Uint64 key, const SDL_Surface *surface,
+                               const std::vector<MipLevel> &mips)
+{
+    cook::Writer writer;
+    writer.Write<Uint32>(static_cast<Uint32>(mips.size() + 1));
+
+    // The base level without the surface's row padding.
+    std::vector<Uint8> base(surface->w * surface->h * 4);
+    for (int y = 0; y < surface->h; y++) {
+        memcpy(&base[y * surface->w * 4],
+               static_cast<const Uint8 *>(surface->pixels) +
+                   y * surface->pitch,
+               surface->w * 4);
+    }
+    writer.Write<int>(surface->w);
+    writer.Write<int>(surface->h);
+    writer.WriteArray(base.data(), base.size());
+
+    for (const MipLevel &mip : mips) {
+        writer.Write<int>(mip.width);
+        writer.Write<int>(mip.height);
+        writer.WriteArray(mip.pixels.data(), mip.pixels.size());
+    }
 
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGBA8, img_w,
-                         img_h, 0, format, GL_UNSIGNED_BYTE,
-                         sub_surface->pixels);
+    cook::Store(key, writer);
+}
+
+//------------------------------------------------------------------------------
 
-            SDL_FreeSurface(sub_surface);
+// Loads a DDS or KTX file, decompressing it when the driver lacks the format.
+static bool LoadTextureImage(const std::string &image_file, TextureImage *image)
+{
+    if (!LoadCompressedImage(image_file, image)) {
+        return false;
+    }
+
+    if (!IsBlockFormatSupported(image->internal_format)) {
+        TextureImage decompressed;
+        DecompressImage(*image, &decompressed);
+        std::swap(*image, decompressed);
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// Uploads every level of image into the bound 2D texture and returns their
+// size.
+static size_t UploadImage(const TextureImage &image)
+{
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < image.levels.size(); i++) {
+        const TextureLevel &level = image.levels[i];
+        if (image.IsCompressed()) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i),
+                                   image.internal_format, level.width,
+                                   level.height, 0,
+                                   static_cast<GLsizei>(level.size),
+                                   image.GetLevel(i));
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), GL_RGBA8,
+                         level.width, level.height, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, image.GetLevel(i));
         }
+        bytes += level.size;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    static_cast<GLint>(image.levels.size()) - 1);
 
-        {
-            SDL_Surface *sub_surface = SDL_CreateRGBSurface(
-                0, img_w, img_h, bpp, RMASK, GMASK, BMASK, AMASK);
-            SDL_Rect source_rect = {512, 2 * 512, 512, 512};
-            if (SDL_BlitSurface(surface, &source_rect, sub_surface, nullptr) !=
-                0) {
-                std::cerr << SDL_GetError() << std::endl;
-            }
+    return bytes;
+}
+
+//------------------------------------------------------------------------------
+
+GLuint MakeTextureFromSurface(const std::string &name, SDL_Surface *surface,
+                              GLenum target)
+{
+    GLuint id = texture_cache.Acquire(name);
+    if (id) {
+        return id;
+    }
+
+    assert(surface != nullptr);
+
+    glGenTextures(1, &id);
+    glBindTexture(target, id);
+
+    SetTextureParameters(target);
+
+    size_t bytes;
+    if (target == GL_TEXTURE_2D) {
+        std::vector<MipLevel> mips;
+        SDL_Surface *converted = PrepareMips(surface, &mips);
+
+        bytes = UploadSurface(converted ? converted : surface, target);
+        bytes += UploadMips(mips);
+        SDL_FreeSurface(converted);
+    } else {
+        bytes = UploadSurface(surface, target);
+    }
+
+    glBindTexture(target, 0);
+    texture_cache.Insert(name, id, target, bytes, false);
+
+    return id;
+}
 
-            assert(sub_surface != nullptr);
+//------------------------------------------------------------------------------
 
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RGBA8, img_w,
-                         img_h, 0, format, GL_UNSIGNED_BYTE,
-                         sub_surface->pixels);
+GLuint MakeTexture(const std::string &image_file, GLenum target)
+{
+    if (target == GL_TEXTURE_2D && IsCompressedImageFile(image_file)) {
+        GLuint id = texture_cache.Acquire(image_file);
+        if (id) {
+            return id;
+        }
 
-            SDL_FreeSurface(sub_surface);
+        TextureImage image;
+        if (!LoadTextureImage(image_file, &image)) {
+            return 0;
         }
 
-        {
-            SDL_Surface *sub_surface = SDL_CreateRGBSurface(
-                0, img_w, img_h, bpp, RMASK, GMASK, BMASK, AMASK);
-            SDL_Rect source_rect = {3 * 512, 513, 512, 512};
-            if (SDL_BlitSurface(surface, &source_rect, sub_surface, nullptr) !=
-                0) {
-                std::cerr << SDL_GetError() << std::endl;
-            }
+        glGenTextures(1, &id);
+        glBindTexture(target, id);
+        SetTextureParameters(target);
+        size_t bytes = UploadImage(image);
+        glBindTexture(target, 0);
+
+        texture_cache.Insert(image_file, id, target, bytes, false);
+        return id;
+    }
+
+    SDL_Surface *surface = LoadSurface(image_file);
+    GLuint id = MakeTextureFromSurface(image_file, surface, target);
+    SDL_FreeSurface(surface);
+
+    return id;
+}
+
+//------------------------------------------------------------------------------
+
+void SetTextureJobSystem(JobSystem *jobs) { texture_jobs = jobs; }
+
+//------------------------------------------------------------------------------
+
+// Decodes a 2D image and builds its mip chain, or maps both from the cook
+// cache when the image was decoded before.
+static void DecodeTexture2D(PendingUpload &upload)
+{
+    vfs::File file;
+    if (!vfs::ReadFile(upload.name, &file)) {
+        log::ErrorLog("Failed to load texture %s\n", upload.name.c_str());
+        upload.surfaces.push_back(nullptr);
+        return;
+    }
 
-            assert(sub_surface != nullptr);
+    Uint64 cook_key = cook::MakeKey(file, "texture", kTextureCookVersion);
+    if (LoadCookedTexture(cook_key, &upload.image)) {
+        return;
+    }
+
+    SDL_Surface *surface = DecodeSurface(file, upload.name);
+    if (!surface) {
+        log::ErrorLog("Failed to load texture %s: %s\n", upload.name.c_str(),
+                      IMG_GetError());
+        upload.surfaces.push_back(nullptr);
+        return;
+    }
+
+    SDL_Surface *converted = PrepareMips(surface, &upload.mips);
+    if (converted) {
+        SDL_FreeSurface(surface);
+        surface = converted;
+    }
+    upload.surfaces.push_back(surface);
+
+    // Mips are only built from RGBA8, see PrepareMips.
+    if (surface->format->format == SDL_PIXELFORMAT_RGBA32) {
+        StoreCookedTexture(cook_key, surface, upload.mips);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void DecodeTexture(const std::vector<std::string> &image_files,
+                          GLuint id, GLenum target)
+{
+    SP_PROFILE_ZONE("DecodeTexture");
 
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGBA8, img_w,
-                         img_h, 0, format, GL_UNSIGNED_BYTE,
-                         sub_surface->pixels);
+    PendingUpload upload = {image_files.front(), id, target, {}, {}, {}};
 
-            SDL_FreeSurface(sub_surface);
+    if (target == GL_TEXTURE_2D && IsCompressedImageFile(upload.name)) {
+        if (!LoadTextureImage(upload.name, &upload.image)) {
+            upload.surfaces.push_back(nullptr);
         }
+    } else if (target == GL_TEXTURE_2D) {
+        DecodeTexture2D(upload);
+    } else {
+        for (const std::string &image_file : image_files) {
+            SDL_Surface *surface = LoadSurface(image_file);
+            if (!surface) {
+                log::ErrorLog("Failed to load texture %s: %s\n",
+                              image_file.c_str(), IMG_GetError());
+            }
+            upload.surfaces.push_back(surface);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(texture_cache.upload_mutex);
+    texture_cache.uploads.push_back(std::move(upload));
+}
+
+//------------------------------------------------------------------------------
+
+static GLuint RequestImages(const std::string &name,
+                            const std::vector<std::string> &image_files,
+                            GLenum target)
+{
+    GLuint id = texture_cache.Acquire(name);
+    if (id) {
+        return id;
+    }
+
+    glGenTextures(1, &id);
+    glBindTexture(target, id);
+
+    SetTextureParameters(target);
+
+    const GLubyte placeholder[4] = {128, 128, 128, 255};
+    size_t bytes = 0;
+    switch (target) {
+    case GL_TEXTURE_2D:
+        glTexImage2D(target, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     placeholder);
+        bytes = sizeof(placeholder);
+        break;
 
+    case GL_TEXTURE_CUBE_MAP:
+        for (int face = 0; face < 6; face++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA8, 1,
+                         1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        }
+        bytes = 6 * sizeof(placeholder);
         break;
 
     default:
@@ -215,20 +824,155 @@ GLuint MakeTextureFromSurface(const std::string &name, SDL_Surface *surface,
     }
 
     glBindTexture(target, 0);
-    texture_cache.cache.insert({name, id});
+    texture_cache.Insert(name, id, target, bytes, true);
+
+    {
+        std::lock_guard<std::mutex> lock(texture_cache.upload_mutex);
+        texture_cache.num_pending++;
+    }
+
+    if (texture_jobs && texture_jobs->GetNumWorkers() > 0) {
+        texture_jobs->Submit([image_files, id, target]() {
+            DecodeTexture(image_files, id, target);
+        });
+    } else {
+        DecodeTexture(image_files, id, target);
+    }
 
     return id;
 }
 
 //------------------------------------------------------------------------------
 
-GLuint MakeTexture(const std::string &image_file, GLenum target)
+int ReloadTexture(const std::string &image_file)
 {
-    SDL_Surface *surface = IMG_Load(image_file.c_str());
-    GLuint id = MakeTextureFromSurface(image_file, surface, target);
-    SDL_FreeSurface(surface);
+    std::vector<TextureReload> reloads = texture_cache.BeginReload(image_file);
 
-    return id;
+    for (TextureReload &reload : reloads) {
+        {
+            std::lock_guard<std::mutex> lock(texture_cache.upload_mutex);
+            texture_cache.num_pending++;
+        }
+
+        if (texture_jobs && texture_jobs->GetNumWorkers() > 0) {
+            texture_jobs->Submit([reload]() {
+                DecodeTexture(reload.files, reload.id, reload.target);
+            });
+        } else {
+            DecodeTexture(reload.files, reload.id, reload.target);
+        }
+    }
+
+    return static_cast<int>(reloads.size());
 }
 
+//------------------------------------------------------------------------------
+
+GLuint RequestTexture(const std::string &image_file, GLenum target)
+{
+    return RequestImages(image_file, {image_file}, target);
+}
+
+//------------------------------------------------------------------------------
+
+GLuint RequestCubeMap(const std::vector<std::string> &face_files)
+{
+    if (face_files.size() != 6) {
+        log::ErrorLog("RequestCubeMap: need 6 faces, got %zu\n",
+                      face_files.size());
+        return 0;
+    }
+
+    // Cached under all six names so the same faces share a texture.
+    std::string name;
+    for (const std::string &face_file : face_files) {
+        name += face_file + ";";
+    }
+
+    return RequestImages(name, face_files, GL_TEXTURE_CUBE_MAP);
+}
+
+//------------------------------------------------------------------------------
+
+void PumpTextureUploads(float budget_ms)
+{
+    SP_PROFILE_ZONE("PumpTextureUploads");
+
+    std::vector<PendingUpload> uploads;
+    {
+        std::lock_guard<std::mutex> lock(texture_cache.upload_mutex);
+        if (texture_cache.uploads.empty()) {
+            return;
+        }
+        uploads.swap(texture_cache.uploads);
+    }
+
+    Uint64 deadline = SDL_GetPerformanceCounter() +
+                      static_cast<Uint64>(budget_ms / 1000.0f *
+                                          SDL_GetPerformanceFrequency());
+
+    size_t num_uploaded = 0;
+    while (num_uploaded < uploads.size()) {
+        if (num_uploaded > 0 && SDL_GetPerformanceCounter() >= deadline) {
+            break;
+        }
+
+        PendingUpload &upload = uploads[num_uploaded++];
+
+        // A failed decode keeps its placeholder.
+        bool decoded =
+            std::find(upload.surfaces.begin(), upload.surfaces.end(),
+                      nullptr) == upload.surfaces.end();
+        size_t bytes = 0;
+
+        if (decoded) {
+            glBindTexture(upload.target, upload.id);
+            if (!upload.image.levels.empty()) {
+                bytes = UploadImage(upload.image);
+            } else if (upload.surfaces.size() == 6) {
+                bytes = UploadCubeFaces(upload.surfaces.data());
+            } else {
+                bytes = UploadSurface(upload.surfaces[0], upload.target);
+                if (upload.target == GL_TEXTURE_2D) {
+                    bytes += UploadMips(upload.mips);
+                }
+            }
+            glBindTexture(upload.target, 0);
+        }
+
+        for (SDL_Surface *surface : upload.surfaces) {
+            SDL_FreeSurface(surface);
+        }
+        texture_cache.FinishUpload(upload.id, bytes);
+    }
+
+    // Whatever didn't fit goes first next frame.
+    std::lock_guard<std::mutex> lock(texture_cache.upload_mutex);
+    texture_cache.num_pending -= static_cast<int>(num_uploaded);
+    texture_cache.uploads.insert(
+        texture_cache.uploads.begin(),
+        std::make_move_iterator(uploads.begin() + num_uploaded),
+        std::make_move_iterator(uploads.end()));
+}
+
+//------------------------------------------------------------------------------
+
+int GetPendingTextureCount()
+{
+    std::lock_guard<std::mutex> lock(texture_cache.upload_mutex);
+    return texture_cache.num_pending;
+}
+
+//------------------------------------------------------------------------------
+
+void ReleaseTexture(GLuint id) { texture_cache.Release(id); }
+
+//------------------------------------------------------------------------------
+
+void SetTextureBudget(size_t bytes) { texture_cache.SetBudget(bytes); }
+
+//------------------------------------------------------------------------------
+
+TextureStats GetTextureStats() { return texture_cache.GetStats(); }
+
 } // namespace sp
@@ -1,24 +1,153 @@
 #ifndef _SP_ASSET_H_
 #define _SP_ASSET_H_
 
+#include <list>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 #include <SDL2/SDL.h>
 
+#include "Mipmap.hpp"
+#include "TextureCompress.hpp"
+
 #define MAX_TEXTURE_MIPS 14
+// The largest texture whose full mip chain fits in MAX_TEXTURE_MIPS levels.
+#define MAX_TEXTURE_SIZE (1 << (MAX_TEXTURE_MIPS - 1))
 
 namespace sp
 {
 
-struct TextureCache {
+class JobSystem;
+
+// Images decoded on a worker, waiting for the GL thread to upload them.
+// Cube maps from separate files have six surfaces, null if decoding failed.
+// 2D textures come with the mip levels below the surface; DDS and KTX files
+// and cooked textures with their whole chain in image instead of a surface.
+struct PendingUpload {
+    std::string name;
+    GLuint id;
+    GLenum target;
+    std::vector<SDL_Surface *> surfaces;
+    std::vector<MipLevel> mips;
+    TextureImage image;
+};
+
+// A cached texture to decode again, see ReloadTexture.
+struct TextureReload {
+    GLuint id;
+    GLenum target;
+    std::vector<std::string> files;
+};
+
+struct TextureStats {
+    Uint64 hits;
+    Uint64 misses;
+    Uint64 evictions;
+    size_t resident_bytes;
+    size_t budget_bytes;
+    int num_textures;
+    int num_unreferenced;
+};
+
+// Textures by file name. Every Acquire or Insert holds a reference until the
+// matching Release; once the resident size exceeds the budget the textures
+// nobody references are deleted, least recently released first. GL thread
+// only, except for the upload queue.
+class TextureCache
+{
+public:
+    static const size_t kDefaultBudget = 256 * 1024 * 1024;
+
+    TextureCache()
+        : num_pending(0), budget_bytes(kDefaultBudget), resident_bytes(0),
+          stats{0, 0, 0, 0, 0, 0, 0}
+    {
+    }
     ~TextureCache();
 
-    typedef std::unordered_map<std::string, GLuint> TextureMap;
-    TextureMap cache;
+    // Returns the cached texture and takes a reference, 0 if there is none.
+    GLuint Acquire(const std::string &name);
+    // Adds a texture with a single reference. Uploading textures are never
+    // evicted until FinishUpload reports their real size, 0 keeps the size
+    // they were inserted with.
+    void Insert(const std::string &name, GLuint id, GLenum target,
+                size_t bytes, bool uploading);
+    void FinishUpload(GLuint id, size_t bytes);
+    void Release(GLuint id);
+
+    // Textures made from file, flagged as uploading until FinishUpload.
+    // Textures still waiting for their first upload are left alone.
+    std::vector<TextureReload> BeginReload(const std::string &file);
+
+    void SetBudget(size_t bytes);
+    TextureStats GetStats() const;
+
+    std::mutex upload_mutex;
+    std::vector<PendingUpload> uploads;
+    int num_pending;
+
+private:
+    struct Entry {
+        std::string name;
+        GLenum target;
+        size_t bytes;
+        int refs;
+        bool uploading;
+        std::list<GLuint>::iterator lru_position;
+    };
+
+    void EvictToBudget();
+
+    std::unordered_map<std::string, GLuint> ids;
+    std::unordered_map<GLuint, Entry> entries;
+    // Unreferenced textures, least recently released first.
+    std::list<GLuint> lru;
+
+    size_t budget_bytes;
+    size_t resident_bytes;
+    TextureStats stats;
 };
 
+// Both return a texture holding a reference, see ReleaseTexture. 2D textures
+// get a full mip chain and trilinear filtering. DDS and KTX files are
+// uploaded block compressed, or decompressed first if the driver can't.
 GLuint MakeTexture(const std::string &image_file, GLenum target);
 GLuint MakeTextureFromSurface(const std::string &name, SDL_Surface *surface,
                               GLenum target);
+
+// Jobs RequestTexture decodes images on. Without one images are decoded on
+// the calling thread, but still uploaded by PumpTextureUploads.
+void SetTextureJobSystem(JobSystem *jobs);
+
+// Returns a texture name right away and decodes image_file in the
+// background. Until PumpTextureUploads uploads the image the texture holds
+// a 1x1 placeholder, sampler state set on it is kept. GL thread only.
+// GL_TEXTURE_CUBE_MAP images are a horizontal (4:3) or vertical (3:4) cross.
+GLuint RequestTexture(const std::string &image_file, GLenum target);
+
+// Cube map from six square images, ordered +X, -X, +Y, -Y, +Z, -Z.
+GLuint RequestCubeMap(const std::vector<std::string> &face_files);
+
+// Decodes the cached textures made from image_file again and replaces their
+// contents once PumpTextureUploads gets to them, keeping their names and
+// sampler state. The old image is shown until then. Returns the number of
+// textures reloaded. GL thread only.
+int ReloadTexture(const std::string &image_file);
+
+// Uploads decoded images until budget_ms is used up, at least one per call.
+// Call once per frame on the GL thread.
+void PumpTextureUploads(float budget_ms);
+
+// Requested textures that still show their placeholder.
+int GetPendingTextureCount();
+
+// Drops a reference taken by MakeTexture or RequestTexture. The texture
+// stays cached until it gets evicted.
+void ReleaseTexture(GLuint id);
+
+void SetTextureBudget(size_t bytes);
+TextureStats GetTextureStats();
 }
 
 #endif
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cstring>
+
+#include "Compression.hpp"
+
+namespace sp
+{
+
+static const int kHashBits = 14;
+static const size_t kMinMatch = 4;
+// The format requires the last five bytes to be literals and the last match
+// to start at least twelve bytes before the end.
+static const size_t kLastLiterals = 5;
+static const size_t kMatchFindLimit = 12;
+static const size_t kMaxOffset = 65535;
+
+//------------------------------------------------------------------------------
+
+static inline Uint32 Read32(const Uint8 *p)
+{
+    Uint32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+//------------------------------------------------------------------------------
+
+static inline Uint32 Hash(Uint32 value)
+{
+    return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+//------------------------------------------------------------------------------
+
+size_t LZCompressBound(size_t size) { return size + size / 255 + 16; }
+
+//------------------------------------------------------------------------------
+
+// Writes the 255 continuation bytes of a length that overflowed its nibble.
+static Uint8 *WriteLength(Uint8 *out, size_t length)
+{
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = static_cast<Uint8>(length);
+
+    return out;
+}
+
+//------------------------------------------------------------------------------
+
+static Uint8 *WriteSequence(Uint8 *out, const Uint8 *literals,
+                            size_t num_literals, size_t offset,
+                            size_t match_length)
+{
+    Uint8 *token = out++;
+    *token = static_cast<Uint8>(std::min<size_t>(num_literals, 15) << 4);
+    if (num_literals >= 15) {
+        out = WriteLength(out, num_literals - 15);
+    }
+
+    if (num_literals > 0) {
+        memcpy(out, literals, num_literals);
+        out += num_literals;
+    }
+
+    if (match_length == 0) {
+        return out;
+    }
+
+    *out++ = offset & 0xff;
+    *out++ = (offset >> 8) & 0xff;
+
+    size_t length = match_length - kMinMatch;
+    *token |= static_cast<Uint8>(std::min<size_t>(length, 15));
+    if (length >= 15) {
+        out = WriteLength(out, length - 15);
+    }
+
+    return out;
+}
+
+//------------------------------------------------------------------------------
+
+size_t LZCompress(const Uint8 *src, size_t size, Uint8 *dst,
+                  size_t dst_capacity)
+{
+    if (dst_capacity < LZCompressBound(size)) {
+        return 0;
+    }
+
+    // Positions are stored off by one so zero means empty.
+    static thread_local Uint32 table[1 << kHashBits];
+    memset(table, 0, sizeof(table));
+
+    Uint8 *out = dst;
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    if (size > kMatchFindLimit) {
+        size_t match_limit = size - kLastLiterals;
+
+        while (pos < size - kMatchFindLimit) {
+            Uint32 value = Read32(src + pos);
+            Uint32 &slot = table[Hash(value)];
+            size_t candidate = slot;
+            slot = static_cast<Uint32>(pos + 1);
+
+            if (candidate == 0 || pos - (candidate - 1) > kMaxOffset ||
+                Read32(src + candidate - 1) != value) {
+                pos++;
+                continue;
+            }
+
+            size_t match = candidate - 1;
+            size_t length = kMinMatch;
+            while (pos + length < match_limit &&
+                   src[match + length] == src[pos + length]) {
+                length++;
+            }
+
+            out = WriteSequence(out, src + anchor, pos - anchor, pos - match,
+                                length);
+            pos += length;
+            anchor = pos;
+        }
+    }
+
+    out = WriteSequence(out, src + anchor, size - anchor, 0, 0);
+
+    return out - dst;
+}
+
+//------------------------------------------------------------------------------
+
+static bool ReadLength(const Uint8 *&in, const Uint8 *end, size_t *length)
+{
+    Uint8 byte;
+    do {
+        if (in >= end) {
+            return false;
+        }
+        byte = *in++;
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool LZDecompress(const Uint8 *src, size_t size, Uint8 *dst, size_t dst_size)
+{
+    const Uint8 *in = src;
+    const Uint8 *in_end = src + size;
+    Uint8 *out = dst;
+    Uint8 *out_end = dst + dst_size;
+
+    while (in < in_end) {
+        Uint8 token = *in++;
+
+        size_t num_literals = token >> 4;
+        if (num_literals == 15 && !ReadLength(in, in_end, &num_literals)) {
+            return false;
+        }
+
+        if (num_literals > size_t(in_end - in) ||
+            num_literals > size_t(out_end - out)) {
+            return false;
+        }
+        memcpy(out, in, num_literals);
+        in += num_literals;
+        out += num_literals;
+
+        // The last sequence has no match.
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+
+        size_t length = token & 15;
+        if (length == 15 && !ReadLength(in, in_end, &length)) {
+            return false;
+        }
+        length += kMinMatch;
+
+        if (offset == 0 || offset > size_t(out - dst) ||
+            length > size_t(out_end - out)) {
+            return false;
+        }
+
+        // Matches may overlap their own output, copy bytewise.
+        const Uint8 *match = out - offset;
+        for (size_t i = 0; i < length; i++) {
+            out[i] = match[i];
+        }
+        out += length;
+    }
+
+    return out == out_end;
+}
+
+} // namespace sp
@@ -0,0 +1,26 @@
+#ifndef _SP_COMPRESSION_H_
+#define _SP_COMPRESSION_H_
+
+#include <SDL2/SDL.h>
+#include <stddef.h>
+
+namespace sp {
+
+// Byte oriented LZ compression in the LZ4 block format: a greedy matcher on
+// a hash of the next four bytes, no entropy coding. Decompression runs at
+// memory speed, which is the point for asset loading.
+
+// Largest compressed size for size input bytes.
+size_t LZCompressBound(size_t size);
+
+// Returns the compressed size, 0 if dst_capacity is too small.
+size_t LZCompress(const Uint8 *src, size_t size, Uint8 *dst,
+                  size_t dst_capacity);
+
+// dst_size must be the exact uncompressed size. Malformed input is rejected
+// without reading or writing out of bounds.
+bool LZDecompress(const Uint8 *src, size_t size, Uint8 *dst, size_t dst_size);
+
+} // namespace sp
+
+#endif
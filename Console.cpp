@@ -93,6 +93,10 @@ const std::string Console::GetText() const { return console_text; }
 
 //=============================================================================
 
+void Console::Print(const std::string &line) { command_history.push_back(line); }
+
+//=============================================================================
+
 void Console::HandleEvent(const SDL_Event &sdl_event)
 {
     SDL_Keymod key_mod = SDL_GetModState();
@@ -43,6 +43,9 @@ public:
     void SetText(const std::string &text);
     const std::string GetText() const;
 
+    // Appends a line of output below the commands in the history.
+    void Print(const std::string &line);
+
 private:
     GUIFrame frame;
     GUIFrame text_box;
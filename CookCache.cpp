@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "CookCache.hpp"
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp
+{
+namespace cook
+{
+
+static const char kCookMagic[4] = {'S', 'P', 'C', 'K'};
+static const Uint32 kCookFormat = 1;
+
+// 32 bytes, which keeps the payload 16 byte aligned in the mapping.
+struct BlobHeader {
+    char magic[4];
+    Uint32 format;
+    Uint64 key;
+    Uint64 payload_size;
+    Uint64 reserved;
+};
+
+static_assert(sizeof(BlobHeader) == 32, "BlobHeader must match the file");
+
+static std::string cook_directory = "cache";
+
+//------------------------------------------------------------------------------
+
+static inline Uint64 Rotate(Uint64 value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+//------------------------------------------------------------------------------
+
+static inline Uint64 Mix(Uint64 value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+
+    return value;
+}
+
+//------------------------------------------------------------------------------
+
+// Eight bytes per step in the style of MurmurHash3, fast enough to hash
+// every source file on startup.
+Uint64 Hash(const void *data, size_t size, Uint64 seed)
+{
+    const Uint64 k1 = 0x87c37b91114253d5ull;
+    const Uint64 k2 = 0x4cf5ad432745937full;
+
+    const Uint8 *bytes = static_cast<const Uint8 *>(data);
+    Uint64 hash = seed ^ (size * k1);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        Uint64 word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash ^= Rotate(word * k1, 31) * k2;
+        hash = Rotate(hash, 27) * 5 + 0x52dce729;
+    }
+
+    Uint64 tail = 0;
+    for (size_t shift = 0; i < size; i++, shift += 8) {
+        tail |= Uint64(bytes[i]) << shift;
+    }
+    hash ^= Rotate(tail * k1, 31) * k2;
+
+    return Mix(hash);
+}
+
+//------------------------------------------------------------------------------
+
+Uint64 MakeKey(const vfs::File &source, const char *loader, Uint32 version)
+{
+    Uint64 hash = Hash(source.GetData(), source.GetSize(), version);
+    return Hash(loader, strlen(loader), hash);
+}
+
+//------------------------------------------------------------------------------
+
+void SetDirectory(const std::string &directory) { cook_directory = directory; }
+
+//------------------------------------------------------------------------------
+
+static std::string GetBlobPath(Uint64 key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+
+    return cook_directory + name;
+}
+
+//------------------------------------------------------------------------------
+
+void Writer::WriteBytes(const void *bytes, size_t size)
+{
+    const Uint8 *begin = static_cast<const Uint8 *>(bytes);
+    data.insert(data.end(), begin, begin + size);
+}
+
+//------------------------------------------------------------------------------
+
+void Writer::Align() { data.resize((data.size() + 15) & ~size_t(15)); }
+
+//------------------------------------------------------------------------------
+
+Reader::Reader(const vfs::File &blob)
+    : data(blob.GetData()), size(blob.GetSize()),
+      offset(sizeof(BlobHeader)), is_valid(size >= sizeof(BlobHeader))
+{
+}
+
+//------------------------------------------------------------------------------
+
+const void *Reader::ReadBytes(size_t element_size, size_t count,
+                              size_t alignment)
+{
+    size_t start = (offset + alignment - 1) & ~(alignment - 1);
+    if (!is_valid || start > size ||
+        (element_size && count > (size - start) / element_size)) {
+        is_valid = false;
+        return nullptr;
+    }
+
+    offset = start + element_size * count;
+    return data + start;
+}
+
+//------------------------------------------------------------------------------
+
+bool Reader::ReadString(std::string *value)
+{
+    const char *chars;
+    size_t length;
+    if (!ReadArray(&chars, &length)) {
+        return false;
+    }
+    value->assign(chars, length);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool Load(Uint64 key, vfs::File *blob)
+{
+    if (cook_directory.empty() || !vfs::MapFile(GetBlobPath(key), blob)) {
+        return false;
+    }
+
+    BlobHeader header;
+    if (blob->GetSize() < sizeof(header)) {
+        *blob = vfs::File();
+        return false;
+    }
+    memcpy(&header, blob->GetData(), sizeof(header));
+
+    if (memcmp(header.magic, kCookMagic, sizeof(kCookMagic)) != 0 ||
+        header.format != kCookFormat || header.key != key ||
+        header.payload_size != blob->GetSize() - sizeof(header)) {
+        log::ErrorLog("Ignoring corrupt cooked asset %s\n",
+                      GetBlobPath(key).c_str());
+        *blob = vfs::File();
+        return false;
+    }
+
+    // Prune goes by modification time, atime is often not kept.
+    boost::system::error_code error;
+    fs::last_write_time(GetBlobPath(key), std::time(nullptr), error);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool Store(Uint64 key, const Writer &writer)
+{
+    if (cook_directory.empty()) {
+        return false;
+    }
+
+    SP_PROFILE_ZONE("CookStore");
+
+    boost::system::error_code error;
+    fs::create_directories(cook_directory, error);
+
+    // Written aside and renamed over, so readers never map half a blob.
+    static std::atomic<unsigned> num_stored(0);
+    std::string path = GetBlobPath(key);
+    std::string temp_path = path + ".tmp" + std::to_string(num_stored++);
+
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (!file) {
+        log::ErrorLog("Can't write cooked asset %s\n", temp_path.c_str());
+        return false;
+    }
+
+    const std::vector<Uint8> &payload = writer.GetData();
+    BlobHeader header = {};
+    memcpy(header.magic, kCookMagic, sizeof(kCookMagic));
+    header.format = kCookFormat;
+    header.key = key;
+    header.payload_size = payload.size();
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (payload.empty() ||
+                    fwrite(payload.data(), payload.size(), 1, file) == 1);
+    written = fclose(file) == 0 && written;
+
+    if (written) {
+        fs::rename(temp_path, path, error);
+        written = !error;
+    }
+    if (!written) {
+        log::ErrorLog("Can't write cooked asset %s\n", path.c_str());
+        fs::remove(temp_path, error);
+    }
+
+    return written;
+}
+
+//------------------------------------------------------------------------------
+
+void Prune(Uint64 max_bytes)
+{
+    if (cook_directory.empty()) {
+        return;
+    }
+
+    struct Blob {
+        std::time_t last_used;
+        Uint64 size;
+        fs::path path;
+    };
+    std::vector<Blob> blobs;
+    Uint64 total_bytes = 0;
+
+    boost::system::error_code error, file_error;
+    for (fs::directory_iterator entry(cook_directory, error), end;
+         !error && entry != end; entry.increment(error)) {
+        const fs::path &path = entry->path();
+        if (path.filename().string().find(".tmp") != std::string::npos) {
+            fs::remove(path, file_error);
+            continue;
+        }
+        if (path.extension() != ".bin") {
+            continue;
+        }
+
+        Blob blob;
+        blob.last_used = fs::last_write_time(path, file_error);
+        blob.size = fs::file_size(path, file_error);
+        blob.path = path;
+        if (!file_error) {
+            blobs.push_back(blob);
+            total_bytes += blob.size;
+        }
+    }
+
+    if (total_bytes <= max_bytes) {
+        return;
+    }
+
+    std::sort(blobs.begin(), blobs.end(), [](const Blob &a, const Blob &b) {
+        return a.last_used < b.last_used;
+    });
+
+    int num_removed = 0;
+    for (const Blob &blob : blobs) {
+        if (total_bytes <= max_bytes) {
+            break;
+        }
+        if (fs::remove(blob.path, file_error)) {
+            total_bytes -= blob.size;
+            num_removed++;
+        }
+    }
+
+    log::InfoLog("Pruned %d cooked assets, %.1f MB left in %s\n",
+                 num_removed, total_bytes / (1024.0 * 1024.0),
+                 cook_directory.c_str());
+}
+
+} // namespace cook
+} // namespace sp
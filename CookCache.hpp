@@ -0,0 +1,120 @@
+#ifndef _SP_COOK_CACHE_H_
+#define _SP_COOK_CACHE_H_
+
+#include <SDL2/SDL.h>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "FileSystem.hpp"
+
+namespace sp {
+namespace cook {
+
+// Cooked assets are the runtime ready form of a source file, stored under a
+// key hashed from the source contents, the loader name and the loader's
+// version. Bump the version whenever a loader's output changes; stale blobs
+// are simply never looked up again.
+
+Uint64 Hash(const void *data, size_t size, Uint64 seed = 0);
+Uint64 MakeKey(const vfs::File &source, const char *loader, Uint32 version);
+
+// Blobs live in directory, "cache" by default. An empty directory turns the
+// cache off. Set it before loading anything.
+void SetDirectory(const std::string &directory);
+
+// Arrays are 16 byte aligned in the blob, so a reader can point straight
+// into the mapping instead of copying.
+class Writer
+{
+public:
+    template <typename T> void Write(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "cooked data must be trivially copyable");
+        WriteBytes(&value, sizeof(T));
+    }
+
+    template <typename T> void WriteArray(const T *values, size_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "cooked data must be trivially copyable");
+        Write<Uint64>(count);
+        Align();
+        WriteBytes(values, count * sizeof(T));
+    }
+
+    void WriteString(const std::string &value)
+    {
+        WriteArray(value.data(), value.size());
+    }
+
+    const std::vector<Uint8> &GetData() const { return data; }
+
+private:
+    void WriteBytes(const void *bytes, size_t size);
+    void Align();
+
+    std::vector<Uint8> data;
+};
+
+// Reads a blob written by Writer, in the same order. Every read fails once
+// one ran past the end.
+class Reader
+{
+public:
+    explicit Reader(const vfs::File &blob);
+
+    template <typename T> bool Read(T *value)
+    {
+        const void *bytes = ReadBytes(sizeof(T), 1);
+        if (bytes) {
+            memcpy(value, bytes, sizeof(T));
+        }
+        return bytes != nullptr;
+    }
+
+    template <typename T> bool ReadArray(const T **values, size_t *count)
+    {
+        Uint64 num_values;
+        if (!Read(&num_values)) {
+            return false;
+        }
+        *count = static_cast<size_t>(num_values);
+        *values = static_cast<const T *>(ReadBytes(sizeof(T), *count, 16));
+        return *values != nullptr;
+    }
+
+    bool ReadString(std::string *value);
+
+    // Offset of the next read from the start of the blob.
+    size_t GetOffset() const { return offset; }
+    bool IsValid() const { return is_valid; }
+
+private:
+    const void *ReadBytes(size_t size, size_t count, size_t alignment = 1);
+
+    const Uint8 *data;
+    size_t size;
+    size_t offset;
+    bool is_valid;
+};
+
+// Maps the blob stored under key. Fails when the cache is off, the blob is
+// missing or it is corrupt. A hit marks the blob as recently used for Prune.
+bool Load(Uint64 key, vfs::File *blob);
+
+// Stores a blob under key. Safe to call from any thread; a concurrent Load
+// sees either the old blob or the complete new one.
+bool Store(Uint64 key, const Writer &writer);
+
+// Every edit cooks a new blob, so the cache only grows. Deletes the least
+// recently used blobs until at most max_bytes remain, along with temporary
+// files left by a Store that never finished. Call before anything loads.
+void Prune(Uint64 max_bytes);
+
+} // namespace cook
+} // namespace sp
+
+#endif
@@ -0,0 +1,122 @@
+#include <thread>
+
+#include "CoroutineTask.hpp"
+
+namespace sp
+{
+
+//------------------------------------------------------------------------------
+
+TaskRoutine::TaskRoutine(TaskRoutine &&other) noexcept : handle(other.handle)
+{
+    other.handle = nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+TaskRoutine &TaskRoutine::operator=(TaskRoutine &&other) noexcept
+{
+    if (this != &other) {
+        Destroy();
+        handle = other.handle;
+        other.handle = nullptr;
+    }
+
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+
+TaskRoutine::~TaskRoutine() { Destroy(); }
+
+//------------------------------------------------------------------------------
+
+void TaskRoutine::Destroy()
+{
+    if (!handle) {
+        return;
+    }
+
+    // A job still running against the frame would write into freed memory.
+    const WaitCondition &condition = handle.promise().condition;
+    if (condition.kind == WaitCondition::kJob) {
+        while (!condition.counter->IsDone()) {
+            std::this_thread::yield();
+        }
+    }
+
+    handle.destroy();
+    handle = nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+bool TaskRoutine::IsReady() const
+{
+    if (!handle || handle.done()) {
+        return false;
+    }
+
+    const WaitCondition &condition = handle.promise().condition;
+    switch (condition.kind) {
+    case WaitCondition::kJob:
+        return condition.counter->IsDone();
+    case WaitCondition::kFence:
+        return WaitForFence(condition.fence).await_ready();
+    case WaitCondition::kNone:
+    case WaitCondition::kNextFrame:
+    default:
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void TaskRoutine::Resume()
+{
+    handle.promise().condition = {WaitCondition::kNone, nullptr, nullptr};
+    handle.resume();
+}
+
+//------------------------------------------------------------------------------
+
+bool WaitForFence::await_ready() const noexcept
+{
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED ||
+           result == GL_WAIT_FAILED;
+}
+
+//------------------------------------------------------------------------------
+
+CoroutineTask::CoroutineTask(int type, unsigned int order)
+    : Task(type, order), frame_delta(0)
+{
+    SetFlags(GetFlags() | kTaskMainThread);
+}
+
+//------------------------------------------------------------------------------
+
+CoroutineTask::~CoroutineTask() {}
+
+//------------------------------------------------------------------------------
+
+void CoroutineTask::OnUpdate(const Uint32 deltaMs)
+{
+    Task::OnUpdate(deltaMs);
+    frame_delta = deltaMs;
+
+    if (!routine.IsValid()) {
+        routine = Run();
+    }
+
+    if (routine.IsReady()) {
+        routine.Resume();
+    }
+
+    if (routine.IsDone()) {
+        Kill();
+    }
+}
+
+} // namespace sp
@@ -0,0 +1,162 @@
+#ifndef _SP_COROUTINE_TASK_H_
+#define _SP_COROUTINE_TASK_H_
+
+#include <GL/glew.h>
+#include <coroutine>
+#include <exception>
+
+#include "JobSystem.hpp"
+#include "Task.hpp"
+
+namespace sp {
+
+// Return type of a CoroutineTask body. Owns the coroutine frame and
+// remembers what the body is currently waiting on.
+class TaskRoutine
+{
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    struct WaitCondition {
+        enum Kind { kNone, kNextFrame, kJob, kFence };
+
+        Kind kind;
+        const JobCounter *counter;
+        GLsync fence;
+    };
+
+    struct promise_type {
+        WaitCondition condition{WaitCondition::kNone, nullptr, nullptr};
+
+        TaskRoutine get_return_object()
+        {
+            return TaskRoutine(Handle::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    TaskRoutine() : handle(nullptr) {}
+    explicit TaskRoutine(Handle routine_handle) : handle(routine_handle) {}
+    TaskRoutine(const TaskRoutine &) = delete;
+    TaskRoutine &operator=(const TaskRoutine &) = delete;
+    TaskRoutine(TaskRoutine &&other) noexcept;
+    TaskRoutine &operator=(TaskRoutine &&other) noexcept;
+    ~TaskRoutine();
+
+    bool IsValid() const { return static_cast<bool>(handle); }
+    bool IsDone() const { return handle && handle.done(); }
+
+    // True once whatever the routine waits on has happened.
+    bool IsReady() const;
+    void Resume();
+
+private:
+    void Destroy();
+
+    Handle handle;
+};
+
+//-----------------------------------------------------------------------------
+// Awaitables
+
+// Suspends until the next time the task is updated.
+struct NextFrame {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(TaskRoutine::Handle handle) const noexcept
+    {
+        handle.promise().condition = {TaskRoutine::WaitCondition::kNextFrame,
+                                      nullptr, nullptr};
+    }
+    void await_resume() const noexcept {}
+};
+
+// Suspends until every job submitted against counter has finished.
+struct WaitForJob {
+    explicit WaitForJob(const JobCounter &job_counter) : counter(&job_counter)
+    {
+    }
+
+    bool await_ready() const noexcept { return counter->IsDone(); }
+    void await_suspend(TaskRoutine::Handle handle) const noexcept
+    {
+        handle.promise().condition = {TaskRoutine::WaitCondition::kJob,
+                                      counter, nullptr};
+    }
+    void await_resume() const noexcept {}
+
+    const JobCounter *counter;
+};
+
+// Suspends until the GPU has signaled fence. The fence stays owned by the
+// caller.
+struct WaitForFence {
+    explicit WaitForFence(GLsync sync) : fence(sync) {}
+
+    bool await_ready() const noexcept;
+    void await_suspend(TaskRoutine::Handle handle) const noexcept
+    {
+        handle.promise().condition = {TaskRoutine::WaitCondition::kFence,
+                                      nullptr, fence};
+    }
+    void await_resume() const noexcept {}
+
+    GLsync fence;
+};
+
+// Runs job on a worker thread and suspends until it is done. Anything the
+// job references must live in the coroutine frame or outlive the task.
+class RunOnWorker
+{
+public:
+    RunOnWorker(JobSystem &job_system, JobFunction job_function)
+        : jobs(job_system), job(std::move(job_function))
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(TaskRoutine::Handle handle)
+    {
+        jobs.Submit(std::move(job), &counter);
+        handle.promise().condition = {TaskRoutine::WaitCondition::kJob,
+                                      &counter, nullptr};
+    }
+    void await_resume() const noexcept {}
+
+private:
+    JobSystem &jobs;
+    JobFunction job;
+    JobCounter counter;
+};
+
+//-----------------------------------------------------------------------------
+
+// A task whose Run body spans several frames. Run is started on the first
+// update; every co_await hands control back to the TaskManager and the body
+// resumes on a later update once the awaited condition holds. The task kills
+// itself when Run returns. Coroutine tasks are always updated on the main
+// thread, so the body may touch GL between awaits.
+class CoroutineTask : public Task
+{
+public:
+    CoroutineTask(int type, unsigned int order = kPriorityNormal);
+    ~CoroutineTask();
+
+    void OnUpdate(const Uint32 deltaMs) override;
+
+protected:
+    virtual TaskRoutine Run() = 0;
+
+    Uint32 GetFrameDelta() const { return frame_delta; }
+
+private:
+    TaskRoutine routine;
+    Uint32 frame_delta;
+};
+
+} // namespace sp
+
+#endif
@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "Compression.hpp"
+#include "FileSystem.hpp"
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp
+{
+namespace vfs
+{
+
+// Pak layout, little endian: header, entry data (16 byte aligned), then the
+// table of contents at toc_offset: num_entries PakEntry sorted by name,
+// followed by the names. An entry is LZ compressed when stored_size differs
+// from size.
+static const char kPakMagic[4] = {'S', 'P', 'A', 'K'};
+static const Uint32 kPakVersion = 1;
+static const size_t kPakAlignment = 16;
+
+struct PakHeader {
+    char magic[4];
+    Uint32 version;
+    Uint32 num_entries;
+    Uint32 names_size;
+    Uint64 toc_offset;
+};
+
+struct PakEntry {
+    Uint64 offset;
+    Uint64 stored_size;
+    Uint64 size;
+    Uint32 name_offset;
+    Uint32 name_length;
+};
+
+static_assert(sizeof(PakHeader) == 24, "PakHeader must match the file");
+static_assert(sizeof(PakEntry) == 32, "PakEntry must match the file");
+
+class Archive
+{
+public:
+    ~Archive();
+
+    bool Open(const std::string &pak_path);
+    const PakEntry *Find(const std::string &name) const;
+    bool Read(const PakEntry &entry, const std::string &name,
+              const Uint8 **data, std::vector<Uint8> *storage) const;
+
+    std::string path;
+
+private:
+    std::string_view GetName(const PakEntry &entry) const
+    {
+        return std::string_view(names + entry.name_offset, entry.name_length);
+    }
+
+    const Uint8 *contents = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    std::vector<Uint8> storage;
+#endif
+    const PakEntry *entries = nullptr;
+    Uint32 num_entries = 0;
+    const char *names = nullptr;
+};
+
+static std::vector<std::unique_ptr<Archive>> archives;
+
+//------------------------------------------------------------------------------
+
+std::string NormalizePath(const std::string &path)
+{
+    std::vector<std::string_view> parts;
+    std::string_view rest(path);
+
+    while (!rest.empty()) {
+        size_t end = rest.find_first_of("/\\");
+        std::string_view part = rest.substr(0, end);
+        rest = end == std::string_view::npos ? "" : rest.substr(end + 1);
+
+        if (part.empty() || part == ".") {
+            continue;
+        }
+        if (part == ".." && !parts.empty() && parts.back() != "..") {
+            parts.pop_back();
+        } else {
+            parts.push_back(part);
+        }
+    }
+
+    std::string normalized;
+    if (!path.empty() && path[0] == '/') {
+        normalized = "/";
+    }
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (i > 0) {
+            normalized += '/';
+        }
+        normalized += parts[i];
+    }
+
+    return normalized;
+}
+
+//------------------------------------------------------------------------------
+
+static bool ReadLooseFile(const std::string &path, std::vector<Uint8> *contents)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    bool read = size >= 0;
+    if (read) {
+        contents->resize(size);
+        read = fread(contents->data(), 1, size, file) == size_t(size);
+    }
+    fclose(file);
+
+    return read;
+}
+
+//------------------------------------------------------------------------------
+
+Archive::~Archive()
+{
+#ifndef _WIN32
+    if (contents) {
+        munmap(const_cast<Uint8 *>(contents), size);
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+bool Archive::Open(const std::string &pak_path)
+{
+    path = pak_path;
+
+#ifdef _WIN32
+    if (!ReadLooseFile(pak_path, &storage)) {
+        return false;
+    }
+    contents = storage.data();
+    size = storage.size();
+#else
+    int fd = open(pak_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping =
+        mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        log::ErrorLog("Can't map %s\n", pak_path.c_str());
+        return false;
+    }
+    contents = static_cast<const Uint8 *>(mapping);
+    size = info.st_size;
+#endif
+
+    PakHeader header;
+    if (size < sizeof(header)) {
+        log::ErrorLog("%s is not a pak file\n", pak_path.c_str());
+        return false;
+    }
+    memcpy(&header, contents, sizeof(header));
+
+    if (memcmp(header.magic, kPakMagic, sizeof(kPakMagic)) != 0 ||
+        header.version != kPakVersion) {
+        log::ErrorLog("%s is not a version %u pak file\n", pak_path.c_str(),
+                      kPakVersion);
+        return false;
+    }
+
+    Uint64 toc_size =
+        Uint64(header.num_entries) * sizeof(PakEntry) + header.names_size;
+    if (header.toc_offset % alignof(PakEntry) != 0 ||
+        header.toc_offset > size || toc_size > size - header.toc_offset) {
+        log::ErrorLog("%s has a corrupt table of contents\n",
+                      pak_path.c_str());
+        return false;
+    }
+
+    entries = reinterpret_cast<const PakEntry *>(contents + header.toc_offset);
+    num_entries = header.num_entries;
+    names = reinterpret_cast<const char *>(entries + num_entries);
+
+    // Validate once so lookups and reads can trust the table.
+    for (Uint32 i = 0; i < num_entries; i++) {
+        const PakEntry &entry = entries[i];
+        bool valid = entry.offset <= header.toc_offset &&
+                     entry.stored_size <= header.toc_offset - entry.offset &&
+                     entry.stored_size <= entry.size &&
+                     entry.name_offset <= header.names_size &&
+                     entry.name_length <=
+                         header.names_size - entry.name_offset;
+        if (valid && i > 0) {
+            valid = GetName(entries[i - 1]) < GetName(entry);
+        }
+        if (!valid) {
+            log::ErrorLog("%s has a corrupt entry %u\n", pak_path.c_str(), i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+const PakEntry *Archive::Find(const std::string &name) const
+{
+    const PakEntry *end = entries + num_entries;
+    const PakEntry *entry = std::lower_bound(
+        entries, end, std::string_view(name),
+        [this](const PakEntry &a, std::string_view b) {
+            return GetName(a) < b;
+        });
+
+    if (entry == end || GetName(*entry) != name) {
+        return nullptr;
+    }
+
+    return entry;
+}
+
+//------------------------------------------------------------------------------
+
+bool Archive::Read(const PakEntry &entry, const std::string &name,
+                   const Uint8 **data, std::vector<Uint8> *storage) const
+{
+    const Uint8 *stored = contents + entry.offset;
+
+    if (entry.stored_size == entry.size) {
+        *data = stored;
+        return true;
+    }
+
+    SP_PROFILE_ZONE("LZDecompress");
+
+    storage->resize(entry.size);
+    if (!LZDecompress(stored, entry.stored_size, storage->data(),
+                      entry.size)) {
+        log::ErrorLog("%s: corrupt data for %s\n", path.c_str(),
+                      name.c_str());
+        storage->clear();
+        return false;
+    }
+    *data = storage->data();
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool Mount(const std::string &pak_path)
+{
+    std::unique_ptr<Archive> archive(new Archive);
+    if (!archive->Open(pak_path)) {
+        return false;
+    }
+
+    log::InfoLog("Mounted %s\n", pak_path.c_str());
+    archives.push_back(std::move(archive));
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void UnmountAll() { archives.clear(); }
+
+//------------------------------------------------------------------------------
+
+bool ReadFile(const std::string &path, File *file)
+{
+    *file = File();
+
+    if (!archives.empty()) {
+        std::string name = NormalizePath(path);
+
+        for (auto it = archives.rbegin(); it != archives.rend(); ++it) {
+            const PakEntry *entry = (*it)->Find(name);
+            if (!entry) {
+                continue;
+            }
+            if (!(*it)->Read(*entry, name, &file->data, &file->storage)) {
+                return false;
+            }
+            file->size = entry->size;
+            file->is_open = true;
+            return true;
+        }
+    }
+
+    if (!ReadLooseFile(path, &file->storage)) {
+        return false;
+    }
+    file->data = file->storage.data();
+    file->size = file->storage.size();
+    file->is_open = true;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool MapFile(const std::string &path, File *file)
+{
+    *file = File();
+
+#ifdef _WIN32
+    if (!ReadLooseFile(path, &file->storage)) {
+        return false;
+    }
+    file->data = file->storage.data();
+    file->size = file->storage.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = info.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    file->mapping.reset(mapping, [size](const void *address) {
+        munmap(const_cast<void *>(address), size);
+    });
+    file->data = static_cast<const Uint8 *>(mapping);
+    file->size = size;
+#endif
+    file->is_open = true;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static bool IsArchived(const std::string &path)
+{
+    if (archives.empty()) {
+        return false;
+    }
+
+    std::string name = NormalizePath(path);
+    for (const auto &archive : archives) {
+        if (archive->Find(name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+bool Exists(const std::string &path)
+{
+    if (IsArchived(path)) {
+        return true;
+    }
+
+    boost::system::error_code error;
+    return fs::is_regular_file(path, error);
+}
+
+//------------------------------------------------------------------------------
+
+bool OpenMapped(const std::string &path, File *file)
+{
+    if (IsArchived(path)) {
+        return ReadFile(path, file);
+    }
+
+    return MapFile(path, file);
+}
+
+//------------------------------------------------------------------------------
+
+MemoryStream::Buffer::Buffer(const File &file)
+{
+    char *begin = const_cast<char *>(
+        reinterpret_cast<const char *>(file.GetData()));
+    setg(begin, begin, begin + file.GetSize());
+}
+
+//------------------------------------------------------------------------------
+
+MemoryStream::MemoryStream(const File &file)
+    : std::istream(nullptr), buffer(file)
+{
+    rdbuf(&buffer);
+}
+
+//------------------------------------------------------------------------------
+
+static bool WritePadding(FILE *file, Uint64 *offset)
+{
+    static const Uint8 zeros[kPakAlignment] = {};
+    size_t padding = (kPakAlignment - *offset % kPakAlignment) % kPakAlignment;
+    *offset += padding;
+
+    return fwrite(zeros, 1, padding, file) == padding;
+}
+
+//------------------------------------------------------------------------------
+
+bool BuildPak(const std::string &pak_path,
+              const std::vector<std::string> &roots)
+{
+    std::vector<std::string> paths;
+    for (const std::string &root : roots) {
+        boost::system::error_code error;
+        fs::recursive_directory_iterator it(root, error), end;
+        if (error) {
+            log::ErrorLog("Can't read directory %s\n", root.c_str());
+            return false;
+        }
+        for (; it != end; ++it) {
+            if (fs::is_regular_file(it->status())) {
+                paths.push_back(NormalizePath(it->path().generic_string()));
+            }
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    FILE *file = fopen(pak_path.c_str(), "wb");
+    if (!file) {
+        log::ErrorLog("Can't open %s for writing\n", pak_path.c_str());
+        return false;
+    }
+
+    PakHeader header = {};
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    Uint64 offset = sizeof(header);
+
+    std::vector<PakEntry> entries;
+    std::string names;
+    std::vector<Uint8> contents;
+    std::vector<Uint8> compressed;
+    size_t total_size = 0;
+    size_t total_stored = 0;
+
+    for (const std::string &path : paths) {
+        if (!written) {
+            break;
+        }
+        if (!ReadLooseFile(path, &contents)) {
+            log::ErrorLog("Can't read %s\n", path.c_str());
+            written = false;
+            break;
+        }
+
+        compressed.resize(LZCompressBound(contents.size()));
+        size_t compressed_size = LZCompress(contents.data(), contents.size(),
+                                            compressed.data(),
+                                            compressed.size());
+
+        const std::vector<Uint8> *stored = &contents;
+        size_t stored_size = contents.size();
+        if (compressed_size < contents.size() - contents.size() / 8) {
+            stored = &compressed;
+            stored_size = compressed_size;
+        }
+
+        written = WritePadding(file, &offset) &&
+                  (stored_size == 0 || fwrite(stored->data(), 1, stored_size,
+                                              file) == stored_size);
+
+        PakEntry entry;
+        entry.offset = offset;
+        entry.stored_size = stored_size;
+        entry.size = contents.size();
+        entry.name_offset = static_cast<Uint32>(names.size());
+        entry.name_length = static_cast<Uint32>(path.size());
+        entries.push_back(entry);
+
+        names += path;
+        offset += stored_size;
+        total_size += contents.size();
+        total_stored += stored_size;
+    }
+
+    written = written && WritePadding(file, &offset);
+
+    memcpy(header.magic, kPakMagic, sizeof(kPakMagic));
+    header.version = kPakVersion;
+    header.num_entries = static_cast<Uint32>(entries.size());
+    header.names_size = static_cast<Uint32>(names.size());
+    header.toc_offset = offset;
+
+    written = written &&
+              fwrite(entries.data(), sizeof(PakEntry), entries.size(), file) ==
+                  entries.size() &&
+              fwrite(names.data(), 1, names.size(), file) == names.size() &&
+              fseek(file, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, file) == 1;
+    written = fclose(file) == 0 && written;
+
+    if (!written) {
+        log::ErrorLog("Error writing %s\n", pak_path.c_str());
+        remove(pak_path.c_str());
+        return false;
+    }
+
+    log::InfoLog("Wrote %s: %zu files, %zu bytes stored as %zu\n",
+                 pak_path.c_str(), entries.size(), total_size, total_stored);
+
+    return true;
+}
+
+} // namespace vfs
+} // namespace sp
@@ -0,0 +1,88 @@
+#ifndef _SP_FILE_SYSTEM_H_
+#define _SP_FILE_SYSTEM_H_
+
+#include <SDL2/SDL.h>
+#include <istream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace sp {
+namespace vfs {
+
+// Contents of one file. Stored pak entries point straight into the mapped
+// archive, MapFile keeps its own mapping; compressed entries and loose files
+// own their bytes. Move only, the data pointer stays valid across moves.
+class File
+{
+public:
+    File() : data(nullptr), size(0), is_open(false) {}
+    File(File &&) = default;
+    File &operator=(File &&) = default;
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+
+    bool IsOpen() const { return is_open; }
+    const Uint8 *GetData() const { return data; }
+    size_t GetSize() const { return size; }
+    std::string ToString() const
+    {
+        return std::string(reinterpret_cast<const char *>(data), size);
+    }
+
+private:
+    friend bool ReadFile(const std::string &path, File *file);
+    friend bool MapFile(const std::string &path, File *file);
+
+    const Uint8 *data;
+    size_t size;
+    bool is_open;
+    std::vector<Uint8> storage;
+    std::shared_ptr<const void> mapping;
+};
+
+// Read only istream over a File for the text parsers. The file must outlive
+// the stream.
+class MemoryStream : public std::istream
+{
+public:
+    explicit MemoryStream(const File &file);
+
+private:
+    struct Buffer : public std::streambuf {
+        Buffer(const File &file);
+    };
+
+    Buffer buffer;
+};
+
+// Archives mounted later are searched first, loose files last. Mounting is
+// not synchronized with reads, so mount before the job system starts.
+bool Mount(const std::string &pak_path);
+void UnmountAll();
+
+// Paths are relative to the working directory, with '/' separators. "." and
+// ".." components are resolved before lookup, see NormalizePath.
+std::string NormalizePath(const std::string &path);
+bool ReadFile(const std::string &path, File *file);
+bool Exists(const std::string &path);
+
+// Maps a loose file read only, bypassing the mounted archives. For large
+// files written by the engine itself, like cooked assets.
+bool MapFile(const std::string &path, File *file);
+
+// Like ReadFile, except that a loose file is mapped instead of read. Stored
+// pak entries are never copied either way, so large binary assets opened
+// this way only cost the pages the loader actually touches.
+bool OpenMapped(const std::string &path, File *file);
+
+// Packs every regular file under each root into pak_path. Entries are LZ
+// compressed when that saves at least an eighth of their size.
+bool BuildPak(const std::string &pak_path,
+              const std::vector<std::string> &roots);
+
+} // namespace vfs
+} // namespace sp
+
+#endif
@@ -0,0 +1,144 @@
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "FileSystem.hpp"
+#include "FileWatcher.hpp"
+#include "Logger.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp
+{
+
+//------------------------------------------------------------------------------
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+bool FileWatcher::Init()
+{
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        log::ErrorLog("FileWatcher: inotify_init1 failed\n");
+        return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+bool FileWatcher::WatchDirectory(const std::string &path)
+{
+#ifdef __linux__
+    int wd = inotify_add_watch(fd, path.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        log::ErrorLog("FileWatcher: can't watch %s\n", path.c_str());
+        return false;
+    }
+    directories[wd] = vfs::NormalizePath(path);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+bool FileWatcher::WatchTree(const std::string &root)
+{
+    if (fd < 0 || !WatchDirectory(root)) {
+        return false;
+    }
+
+    boost::system::error_code error;
+    fs::recursive_directory_iterator it(root, error), end;
+    for (; !error && it != end; it.increment(error)) {
+        if (fs::is_directory(it->status())) {
+            WatchDirectory(it->path().string());
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void FileWatcher::Poll(std::vector<std::string> *changed)
+{
+    changed->clear();
+
+#ifdef __linux__
+    if (fd < 0) {
+        return;
+    }
+
+    alignas(struct inotify_event) char buffer[4096];
+    for (;;) {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+
+        for (char *p = buffer; p < buffer + length;) {
+            const struct inotify_event *event =
+                reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                log::ErrorLog("FileWatcher: event queue overflowed, some "
+                              "changes were missed\n");
+                continue;
+            }
+
+            auto search = directories.find(event->wd);
+            if (search == directories.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                directories.erase(search);
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+
+            std::string path = search->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    WatchTree(path);
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                changed->push_back(path);
+            }
+        }
+    }
+
+    // Editors tend to write a file more than once per save.
+    std::sort(changed->begin(), changed->end());
+    changed->erase(std::unique(changed->begin(), changed->end()),
+                   changed->end());
+#endif
+}
+
+} // namespace sp
@@ -0,0 +1,41 @@
+#ifndef _SP_FILE_WATCHER_H_
+#define _SP_FILE_WATCHER_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sp {
+
+// Reports files changed on disk, for hot reloading assets. Uses inotify on
+// Linux; elsewhere Init fails and nothing is ever reported.
+class FileWatcher
+{
+public:
+    FileWatcher() : fd(-1) {}
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+    ~FileWatcher();
+
+    bool Init();
+
+    // Watches root and every directory below it, including ones created
+    // later. Editors often save by renaming a temporary file over the old
+    // one, so directories are watched rather than files.
+    bool WatchTree(const std::string &root);
+
+    // Fills changed with the files written or moved into a watched directory
+    // since the last call, each once, as normalized paths below their root.
+    // Never blocks.
+    void Poll(std::vector<std::string> *changed);
+
+private:
+    bool WatchDirectory(const std::string &path);
+
+    int fd;
+    std::unordered_map<int, std::string> directories;
+};
+
+} // namespace sp
+
+#endif
@@ -15,6 +15,10 @@
 namespace sp
 {
 
+// Hashed at compile time, like the per-draw names in Simple.cpp.
+static constexpr UniformKey kUniModel = "uni_model";
+static constexpr UniformKey kUniColor = "uni_color";
+
 GlyphAtlas::GlyphAtlas() : width(0), height(0) { buffer.Init(); }
 
 void GlyphAtlas::LoadFace(FT_Face face, int face_height)
@@ -173,17 +177,21 @@ bool TextDefinition::Init(float width, float height)
         return false;
     }
 
-    if (FT_New_Face(ft, "assets/fonts/FreeMonoBold.ttf", 0, &face)) {
+    if (!vfs::ReadFile("assets/fonts/FreeMonoBold.ttf", &font_file) ||
+        FT_New_Memory_Face(ft, font_file.GetData(), font_file.GetSize(), 0,
+                           &face)) {
         std::cerr << "Could not open font\n";
         return false;
     }
 
     glm::mat4 model;
-    backend::SetUniform(text_program, sp::kMatrix4fv, "uni_model",
+    backend::Bind(text_program);
+    backend::SetUniform(text_program, sp::kMatrix4fv, kUniModel,
                         glm::value_ptr(model));
     glm::vec4 white(1.0f, 1.0f, 1.0f, 1.0f);
-    backend::SetUniform(text_program, sp::k4fv, "uni_color",
+    backend::SetUniform(text_program, sp::k4fv, kUniColor,
                         glm::value_ptr(white));
+    glUseProgram(0);
 
     atlas_48.LoadFace(face, 48);
     atlas_24.LoadFace(face, 24);
@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include "FileSystem.hpp"
 #include "Shader.hpp"
 #include "VertexBuffer.hpp"
 #include "config/ftheader.h"
@@ -62,6 +63,8 @@ private:
 
     FT_Library ft;
     FT_Face face;
+    // FreeType reads the face from memory for as long as it is open.
+    vfs::File font_file;
 
     // TODO: Do proper scaling globally?
     // Should be a more elegant way to deal with scaling images in the window
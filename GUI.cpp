@@ -10,6 +10,10 @@
 #include "Geometry.hpp"
 #include "VertexBuffer.hpp"
 
+// Hashed at compile time, SetSize runs whenever a frame moves.
+static constexpr sp::UniformKey kModelMatrix = "model_matrix";
+static constexpr sp::UniformKey kUniColor = "uni_color";
+
 GUIFrame::GUIFrame(float x, float y, float sx, float sy, float width,
                    float height)
 {
@@ -58,7 +62,8 @@ void GUIFrame::Draw()
 void GUIFrame::SetColor(const glm::vec4 &new_color)
 {
     color = new_color;
-    sp::backend::SetUniform(program, sp::k4fv, "uni_color",
+    sp::backend::Bind(program);
+    sp::backend::SetUniform(program, sp::k4fv, kUniColor,
                             glm::value_ptr(color));
 }
 
@@ -73,7 +78,8 @@ void GUIFrame::SetSize(float width, float height)
         model, glm::vec3(-1.0f / scale_x + width + x, 1.0f / scale_y - y, 0));
     model = glm::scale(model, glm::vec3(width, height, 0));
 
-    sp::backend::SetUniform(program, sp::kMatrix4fv, "model_matrix",
+    sp::backend::Bind(program);
+    sp::backend::SetUniform(program, sp::kMatrix4fv, kModelMatrix,
                             glm::value_ptr(model));
 }
 
@@ -2,8 +2,8 @@
 #include <string>
 #include <fstream>
 #include <cstdio>
-#include <cassert>
 #include <vector>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <SDL2/SDL_endian.h>
@@ -20,7 +20,12 @@
 #include "Util.hpp"
 #include "IQMModel.hpp"
 #include "Asset.hpp"
+#include "CookCache.hpp"
+#include "FileSystem.hpp"
 #include "Logger.hpp"
+#include "MeshOptimize.hpp"
+#include "MeshSimplify.hpp"
+#include "Profiler.hpp"
 #include "Shader.hpp"
 
 namespace fs = boost::filesystem;
@@ -28,6 +33,13 @@ namespace fs = boost::filesystem;
 namespace sp
 {
 
+// For clips that don't say how fast they play.
+static const float kDefaultFramerate = 24.0f;
+
+// Bump whenever the cooked mesh layout or the optimizer's output changes,
+// see CookCache.hpp.
+static const Uint32 kIQMCookVersion = 3;
+
 //------------------------------------------------------------------------------
 
 static glm::mat4 MakeBoneMat(glm::quat rot, glm::vec3 trans, glm::vec3 scale)
@@ -45,10 +57,13 @@ static glm::mat4 MakeBoneMat(glm::quat rot, glm::vec3 trans, glm::vec3 scale)
 
 IQMModel::~IQMModel()
 {
-    v_buffer.DeleteBuffers();
-    if (buffer) {
-        delete buffer;
+    for (GLuint texture : textures) {
+        if (texture) {
+            ReleaseTexture(texture);
+        }
     }
+
+    v_buffer.DeleteBuffers();
 }
 
 //------------------------------------------------------------------------------
@@ -83,16 +98,218 @@ static void InitIQMHeader(IQMHeader *header)
     header->ofs_comment = SDL_SwapLE32(header->ofs_comment);
     header->num_extensions = SDL_SwapLE32(header->num_extensions);
     header->ofs_extensions = SDL_SwapLE32(header->ofs_extensions);
+}
+
+//------------------------------------------------------------------------------
+
+// True when count elements fit in the file at offset. The offset must also
+// suit the element type, since the loader reads the mapping in place.
+static bool InFile(const IQMHeader &header, Uint32 offset, Uint64 count,
+                   size_t element_size, size_t alignment)
+{
+    if (count == 0) {
+        return true;
+    }
+
+    return offset % alignment == 0 && offset <= header.filesize &&
+           count <= (header.filesize - offset) / element_size;
+}
+
+//------------------------------------------------------------------------------
+
+static size_t GetFormatSize(Uint32 format)
+{
+    switch (format) {
+    case IQM_BYTE:
+    case IQM_UBYTE:
+        return 1;
+    case IQM_SHORT:
+    case IQM_USHORT:
+    case IQM_HALF:
+        return 2;
+    case IQM_INT:
+    case IQM_UINT:
+    case IQM_FLOAT:
+        return 4;
+    case IQM_DOUBLE:
+        return 8;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool IsVertexArrayInFile(const IQMHeader &header,
+                                const IQMVertexarray &array)
+{
+    size_t format_size = GetFormatSize(array.format);
+
+    return format_size && array.size >= 1 && array.size <= 4 &&
+           InFile(header, array.offset,
+                  Uint64(header.num_vertexes) * array.size, format_size,
+                  format_size);
+}
+
+//------------------------------------------------------------------------------
+
+static bool AreTablesInFile(const IQMHeader &header)
+{
+    return InFile(header, header.ofs_text, header.num_text, 1, 1) &&
+           InFile(header, header.ofs_meshes, header.num_meshes,
+                  sizeof(IQMMesh), 4) &&
+           InFile(header, header.ofs_vertexarrays, header.num_vertexarrays,
+                  sizeof(IQMVertexarray), 4) &&
+           InFile(header, header.ofs_triangles, header.num_triangles,
+                  sizeof(IQMTriangle), 4) &&
+           InFile(header, header.ofs_joints, header.num_joints,
+                  sizeof(IQMJoint), 4) &&
+           InFile(header, header.ofs_poses, header.num_poses,
+                  sizeof(IQMPose), 4) &&
+           InFile(header, header.ofs_anims, header.num_anims,
+                  sizeof(IQMAnim), 4) &&
+           InFile(header, header.ofs_frames,
+                  Uint64(header.num_frames) * header.num_framechannels,
+                  sizeof(ushort), 2);
+}
+
+//------------------------------------------------------------------------------
+
+// Big endian hosts only, on a copy of the file. Vertex arrays that don't fit
+// are left alone for the validation to reject.
+static void SwapIQM(Uint8 *data, const IQMHeader &header)
+{
+    lilswap((uint *)&data[header.ofs_vertexarrays],
+            header.num_vertexarrays * sizeof(IQMVertexarray) / sizeof(uint));
+    lilswap((uint *)&data[header.ofs_triangles],
+            header.num_triangles * sizeof(IQMTriangle) / sizeof(uint));
+    lilswap((uint *)&data[header.ofs_meshes],
+            header.num_meshes * sizeof(IQMMesh) / sizeof(uint));
+    lilswap((uint *)&data[header.ofs_joints],
+            header.num_joints * sizeof(IQMJoint) / sizeof(uint));
+    lilswap((uint *)&data[header.ofs_poses],
+            header.num_poses * sizeof(IQMPose) / sizeof(uint));
+    lilswap((uint *)&data[header.ofs_anims],
+            header.num_anims * sizeof(IQMAnim) / sizeof(uint));
+    lilswap((ushort *)&data[header.ofs_frames],
+            header.num_frames * header.num_framechannels);
+
+    const IQMVertexarray *arrays =
+        (const IQMVertexarray *)&data[header.ofs_vertexarrays];
+    for (Uint32 i = 0; i < header.num_vertexarrays; i++) {
+        const IQMVertexarray &array = arrays[i];
+        if (!IsVertexArrayInFile(header, array)) {
+            continue;
+        }
+
+        int count = header.num_vertexes * array.size;
+        switch (GetFormatSize(array.format)) {
+        case 2:
+            lilswap((ushort *)&data[array.offset], count);
+            break;
+        case 4:
+            lilswap((uint *)&data[array.offset], count);
+            break;
+        case 8:
+            lilswap((ullong *)&data[array.offset], count);
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Checks every index the loader and the GL will follow, so a broken file
+// fails to load instead of reading past the mapping.
+static bool IsValidIQM(const Uint8 *data, const IQMHeader &header)
+{
+    const char *text = (const char *)&data[header.ofs_text];
+    if (header.num_text && text[header.num_text - 1] != '\0') {
+        return false;
+    }
+
+    const IQMVertexarray *arrays =
+        (const IQMVertexarray *)&data[header.ofs_vertexarrays];
+    for (Uint32 i = 0; i < header.num_vertexarrays; i++) {
+        if (!IsVertexArrayInFile(header, arrays[i])) {
+            return false;
+        }
+    }
+
+    const IQMMesh *meshes = (const IQMMesh *)&data[header.ofs_meshes];
+    for (Uint32 i = 0; i < header.num_meshes; i++) {
+        const IQMMesh &mesh = meshes[i];
+        if (mesh.name >= header.num_text ||
+            mesh.material >= header.num_text ||
+            Uint64(mesh.first_vertex) + mesh.num_vertexes >
+                header.num_vertexes ||
+            Uint64(mesh.first_triangle) + mesh.num_triangles >
+                header.num_triangles) {
+            return false;
+        }
+    }
+
+    const IQMTriangle *tris = (const IQMTriangle *)&data[header.ofs_triangles];
+    for (Uint32 i = 0; i < header.num_triangles; i++) {
+        for (unsigned int vertex : tris[i].vertex) {
+            if (vertex >= header.num_vertexes) {
+                return false;
+            }
+        }
+    }
+
+    // Parents come first, both Animate and the base frame rely on it.
+    const IQMJoint *joints = (const IQMJoint *)&data[header.ofs_joints];
+    for (Uint32 i = 0; i < header.num_joints; i++) {
+        if (joints[i].parent < -1 || joints[i].parent >= int(i)) {
+            return false;
+        }
+    }
+
+    if (header.num_anims == 0) {
+        return true;
+    }
+    if (header.num_poses != header.num_joints) {
+        return false;
+    }
 
-    assert(header->version == IQM_VERSION);
-    assert(header->filesize < (16 << 20));
+    const IQMAnim *anims = (const IQMAnim *)&data[header.ofs_anims];
+    for (Uint32 i = 0; i < header.num_anims; i++) {
+        if (anims[i].name >= header.num_text ||
+            Uint64(anims[i].first_frame) + anims[i].num_frames >
+                header.num_frames) {
+            return false;
+        }
+    }
+
+    // Each frame reads one channel per set mask bit, which has to add up
+    // to num_framechannels or the frame data runs out.
+    const IQMPose *poses = (const IQMPose *)&data[header.ofs_poses];
+    Uint32 num_channels = 0;
+    for (Uint32 i = 0; i < header.num_poses; i++) {
+        if (poses[i].parent < -1 || poses[i].parent >= int(i)) {
+            return false;
+        }
+        for (int channel = 0; channel < 10; channel++) {
+            num_channels += (poses[i].mask >> channel) & 1;
+        }
+    }
+
+    return num_channels == header.num_framechannels;
 }
 
 //------------------------------------------------------------------------------
 
 bool IQMModel::LoadModel(const char *filename)
 {
-    if (!fs::exists(filename)) {
+    return LoadFile(filename) && Upload();
+}
+
+//------------------------------------------------------------------------------
+
+bool IQMModel::LoadFile(const char *filename)
+{
+    if (!vfs::OpenMapped(filename, &file)) {
         log::ErrorLog("IQMModel::LoadModel: Failed to load file %s\n",
                       filename);
         return false;
@@ -100,108 +317,70 @@ bool IQMModel::LoadModel(const char *filename)
 
     IQMHeader header;
 
-    std::FILE *file = std::fopen(filename, "rb");
-
-    if (std::fread(&header, sizeof(header), 1, file) != 1 ||
-        memcmp(header.magic, IQM_MAGIC, sizeof(header.magic))) {
+    if (file.GetSize() < sizeof(header) ||
+        memcmp(file.GetData(), IQM_MAGIC, sizeof(header.magic))) {
         log::ErrorLog("Error loading file header for %s", filename);
+        file = vfs::File();
         return false;
     }
 
+    memcpy(&header, file.GetData(), sizeof(header));
     InitIQMHeader(&header);
 
-    num_tris = header.num_triangles;
-    num_meshes = header.num_meshes;
-    num_joints = header.num_joints;
-
-    buffer = new unsigned char[header.filesize];
-    size_t n = std::fread(buffer + sizeof(header),
-                          header.filesize - sizeof(header), 1, file);
-    if (n != 1) {
+    if (header.version != IQM_VERSION || header.filesize < sizeof(header) ||
+        header.filesize > file.GetSize() || !AreTablesInFile(header)) {
         log::ErrorLog("Error loading file buffer for %s", filename);
+        file = vfs::File();
         return false;
     }
 
-    std::fclose(file);
-
-    lilswap((uint *)&buffer[header.ofs_vertexarrays],
-            header.num_vertexarrays * sizeof(IQMVertexarray) / sizeof(uint));
-    lilswap((uint *)&buffer[header.ofs_triangles],
-            header.num_triangles * sizeof(IQMTriangle) / sizeof(uint));
-    lilswap((uint *)&buffer[header.ofs_meshes],
-            header.num_meshes * sizeof(IQMMesh) / sizeof(uint));
-    lilswap((uint *)&buffer[header.ofs_joints],
-            header.num_joints * sizeof(IQMJoint) / sizeof(uint));
-
-    float *inposition = NULL;
-    float *innormal = NULL;
-    float *intangent = NULL;
-    float *intexcoord = NULL;
-    uchar *inblendindex = NULL;
-    uchar *inblendweight = NULL;
+    // Little endian hosts read the mapping in place, without copying.
+    const Uint8 *data = file.GetData();
+    if (!islittleendian()) {
+        swapped.assign(data, data + header.filesize);
+        SwapIQM(swapped.data(), header);
+        data = swapped.data();
+    }
 
-    const char *str = header.ofs_text ? (char *)&buffer[header.ofs_text] : "";
+    if (!IsValidIQM(data, header) || !ReadVertexArrays(data, header)) {
+        log::ErrorLog("%s is not a valid IQM model\n", filename);
+        file = vfs::File();
+        std::vector<Uint8>().swap(swapped);
+        return false;
+    }
 
-    IQMVertexarray *vertices= (IQMVertexarray *)&buffer[header.ofs_vertexarrays];
+    num_tris = header.num_triangles;
+    num_meshes = header.num_meshes;
 
-    for (int i = 0; i < (int)header.num_vertexarrays; i++) {
-        IQMVertexarray &vert = vertices[i];
-        switch (vert.type) {
-        case IQM_POSITION:
-            if (vert.format != IQM_FLOAT || vert.size != 3) {
-                return false;
-            }
-            inposition = (float *)&buffer[vert.offset];
-            lilswap(inposition, 3 * header.num_vertexes);
-            break;
-        case IQM_NORMAL:
-            if (vert.format != IQM_FLOAT || vert.size != 3) {
-                return false;
-            }
-            innormal = (float *)&buffer[vert.offset];
-            lilswap(innormal, 3 * header.num_vertexes);
-            break;
-        case IQM_TANGENT:
-            if (vert.format != IQM_FLOAT || vert.size != 4) {
-                return false;
-            }
-            intangent = (float *)&buffer[vert.offset];
-            lilswap(intangent, 4 * header.num_vertexes);
-            break;
-        case IQM_TEXCOORD:
-            if (vert.format != IQM_FLOAT || vert.size != 2) {
-                return false;
-            }
-            intexcoord = (float *)&buffer[vert.offset];
-            lilswap(intexcoord, 2 * header.num_vertexes);
-            break;
-        case IQM_BLENDINDEXES:
-            if (vert.format != IQM_UBYTE || vert.size != 4) {
-                return false;
-            }
-            inblendindex = (uchar *)&buffer[vert.offset];
-            lilswap(inblendindex, 2 * header.num_vertexes);
-            break;
-        case IQM_BLENDWEIGHTS:
-            if (vert.format != IQM_UBYTE || vert.size != 4) {
-                return false;
-            }
-            inblendweight = (uchar *)&buffer[vert.offset];
-            lilswap(inblendweight, 2 * header.num_vertexes);
-            break;
+    const char *str = header.ofs_text ? (char *)&data[header.ofs_text] : "";
+    const IQMMesh *in_meshes = (const IQMMesh *)&data[header.ofs_meshes];
+    const IQMJoint *joints = (const IQMJoint *)&data[header.ofs_joints];
+
+    meshes.assign(in_meshes, in_meshes + num_meshes);
+
+    // Optimizing, simplifying and packing the meshes is the slow part of a
+    // load, so the buffers it produces are cooked per vertex format.
+    Uint64 cook_key = cook::MakeKey(file, "iqm", kIQMCookVersion);
+    cook_key = cook::Hash(&vertex_format, sizeof(vertex_format), cook_key);
+    if (!LoadCookedMeshes(cook_key, header.num_vertexes)) {
+        OptimizeMeshes((const IQMTriangle *)&data[header.ofs_triangles],
+                       header.num_vertexes, str);
+        if (vertex_format != kVertexFloat) {
+            PackVertices(header.num_vertexes);
+        } else {
+            ReorderVertices(header.num_vertexes);
         }
+        PackIndices(header.num_vertexes);
+        StoreCookedMeshes(cook_key);
     }
 
-    meshes = (IQMMesh *)&buffer[header.ofs_meshes];
-    joints = (IQMJoint *)&buffer[header.ofs_joints];
-    tris = (IQMTriangle *)&buffer[header.ofs_triangles];
-
-    baseframe.resize(header.num_joints);
-    inversebaseframe.resize(header.num_joints);
-    textures.resize(header.num_meshes);
+    std::vector<glm::mat4> baseframe(header.num_joints);
+    std::vector<glm::mat4> inversebaseframe(header.num_joints);
+    std::vector<int> joint_parents(header.num_joints);
+    texture_paths.resize(header.num_meshes);
 
     for (int i = 0; i < (int)header.num_joints; i++) {
-        IQMJoint &j = joints[i];
+        const IQMJoint &j = joints[i];
 
         glm::quat rot_q =
             glm::quat(j.rotate[3], j.rotate[0], j.rotate[1], j.rotate[2]);
@@ -211,6 +390,7 @@ bool IQMModel::LoadModel(const char *filename)
 
         baseframe[i] = MakeBoneMat(rot_q, trans, scale);
         inversebaseframe[i] = glm::inverse(baseframe[i]);
+        joint_parents[i] = j.parent;
 
         if (j.parent >= 0) {
             baseframe[i] = baseframe[j.parent] * baseframe[i];
@@ -223,7 +403,7 @@ bool IQMModel::LoadModel(const char *filename)
     fs::path parent_path = file_path.parent_path();
 
     for (int i = 0; i < (int)header.num_meshes; i++) {
-        IQMMesh &mesh = meshes[i];
+        const IQMMesh &mesh = meshes[i];
         fs::path mat_path(&str[mesh.material]);
         fs::path texture_path = parent_path / mat_path;
 
@@ -234,124 +414,475 @@ bool IQMModel::LoadModel(const char *filename)
         }
 
         log::InfoLog("Loaded mesh: %s\n", &str[mesh.name]);
+        texture_paths[i] = texture_path.string();
+    }
 
-        if (!fs::is_regular_file(texture_path)) {
-            log::ErrorLog("%s: There is no material for mesh %s called %s\n",
-                          filename, &str[mesh.name],
-                          texture_path.string().c_str());
-            textures[i] = 0;
-        } else {
-            textures[i] = MakeTexture(texture_path.string(), GL_TEXTURE_2D);
-            if (!textures[i]) {
-                log::ErrorLog("%s: Failed to load texture %s\n", filename,
-                              texture_path.string().c_str());
+    CheckTextures(filename);
+
+    if (header.num_anims == 0) {
+        return true;
+    }
+
+    const IQMAnim *anims = (const IQMAnim *)&data[header.ofs_anims];
+    std::vector<AnimationClip> clips;
+
+    for (int i = 0; i < (int)header.num_anims; i++) {
+        const IQMAnim &a = anims[i];
+        log::InfoLog("%s: loaded anim: %s\n", filename, &str[a.name]);
+
+        if (a.num_frames > 0) {
+            clips.push_back({&str[a.name], int(a.first_frame),
+                             int(a.num_frames),
+                             a.framerate > 0.0f ? a.framerate
+                                                : kDefaultFramerate});
+        }
+    }
+
+    animation.Init(std::move(joint_parents), std::move(inversebaseframe),
+                   (const IQMPose *)&data[header.ofs_poses],
+                   (const Uint16 *)&data[header.ofs_frames], header.num_frames,
+                   header.num_framechannels, std::move(clips));
+    animator.SetAnimation(&animation);
+    animator.Play(0);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// The shader locations and formats SetVertAttribPointers uses for Vertex.
+struct IQMAttribFormat {
+    Uint32 type;
+    GLuint index;
+    Uint32 format;
+    Uint32 size;
+    GLenum gl_type;
+    GLboolean normalized;
+};
+
+static const IQMAttribFormat kIQMAttribFormats[] = {
+    {IQM_POSITION, 0, IQM_FLOAT, 3, GL_FLOAT, GL_FALSE},
+    {IQM_NORMAL, 1, IQM_FLOAT, 3, GL_FLOAT, GL_FALSE},
+    {IQM_TEXCOORD, 2, IQM_FLOAT, 2, GL_FLOAT, GL_FALSE},
+    {IQM_TANGENT, 3, IQM_FLOAT, 4, GL_FLOAT, GL_FALSE},
+    {IQM_BLENDINDEXES, 4, IQM_UBYTE, 4, GL_UNSIGNED_BYTE, GL_FALSE},
+    {IQM_BLENDWEIGHTS, 5, IQM_UBYTE, 4, GL_UNSIGNED_BYTE, GL_TRUE},
+};
+
+//------------------------------------------------------------------------------
+
+// IQM stores each attribute as its own array, which the GL can source as is.
+// When the arrays the shaders use sit close together in the file, that span
+// of the file becomes the vertex buffer; otherwise they are packed into
+// staging first.
+bool IQMModel::ReadVertexArrays(const Uint8 *data, const IQMHeader &header)
+{
+    const IQMVertexarray *arrays =
+        (const IQMVertexarray *)&data[header.ofs_vertexarrays];
+    std::vector<const IQMVertexarray *> used;
+    size_t begin = header.filesize;
+    size_t end = 0;
+    size_t used_size = 0;
+
+    vertex_attribs.clear();
+    for (Uint32 i = 0; i < header.num_vertexarrays; i++) {
+        const IQMVertexarray &array = arrays[i];
+
+        for (const IQMAttribFormat &format : kIQMAttribFormats) {
+            if (array.type != format.type) {
+                continue;
             }
+            if (array.format != format.format || array.size != format.size) {
+                return false;
+            }
+
+            size_t size = header.num_vertexes * array.size *
+                          GetFormatSize(array.format);
+            vertex_attribs.push_back({format.index, GLint(format.size),
+                                      format.gl_type, format.normalized, 0});
+            used.push_back(&array);
+            begin = std::min(begin, size_t(array.offset));
+            end = std::max(end, array.offset + size);
+            used_size += size;
         }
     }
 
-    if (header.num_anims > 0) {
-        if ((int)header.num_poses != (int)header.num_joints) {
-            return false;
+    if (used.empty() || header.num_vertexes == 0) {
+        return false;
+    }
+
+    if (end - begin <= used_size + used_size / 4) {
+        vertex_data = data + begin;
+        vertex_data_size = end - begin;
+        for (size_t i = 0; i < used.size(); i++) {
+            vertex_attribs[i].offset = used[i]->offset - begin;
+        }
+        return true;
+    }
+
+    staging.clear();
+    for (size_t i = 0; i < used.size(); i++) {
+        const Uint8 *array = data + used[i]->offset;
+        size_t size = header.num_vertexes * used[i]->size *
+                      GetFormatSize(used[i]->format);
+
+        staging.resize((staging.size() + 3) & ~size_t(3));
+        vertex_attribs[i].offset = staging.size();
+        staging.insert(staging.end(), array, array + size);
+    }
+    vertex_data = staging.data();
+    vertex_data_size = staging.size();
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// Everything but the position, which packed and quantized vertices store
+// differently. arrays holds the source array of each attribute location,
+// null when the file lacks it.
+template <typename T>
+static void PackAttributes(const Uint8 *const *arrays, size_t i, T *vertex)
+{
+    const float *normal = (const float *)arrays[1];
+    const float *texcoord = (const float *)arrays[2];
+    const float *tangent = (const float *)arrays[3];
+
+    memset(static_cast<void *>(vertex), 0, sizeof(T));
+    if (normal) {
+        vertex->normal = PackSnorm1010102(normal[i * 3], normal[i * 3 + 1],
+                                          normal[i * 3 + 2]);
+    }
+    if (texcoord) {
+        vertex->texcoord[0] = PackHalf(texcoord[i * 2]);
+        vertex->texcoord[1] = PackHalf(texcoord[i * 2 + 1]);
+    }
+    if (tangent) {
+        vertex->tangent =
+            PackSnorm1010102(tangent[i * 4], tangent[i * 4 + 1],
+                             tangent[i * 4 + 2], tangent[i * 4 + 3]);
+    }
+    if (arrays[4]) {
+        memcpy(vertex->blendindex, arrays[4] + i * 4, 4);
+    }
+    if (arrays[5]) {
+        memcpy(vertex->blendweight, arrays[5] + i * 4, 4);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Interleaves the file's arrays into vertex_format in vertex_order,
+// replacing vertex_data.
+void IQMModel::PackVertices(size_t num_vertices)
+{
+    const Uint8 *arrays[6] = {};
+    for (const VertexAttrib &attrib : vertex_attribs) {
+        arrays[attrib.index] = vertex_data + attrib.offset;
+    }
+    const float *position = (const float *)arrays[0];
+
+    if (vertex_format == kVertexQuantized && position) {
+        glm::vec3 low(position[0], position[1], position[2]);
+        glm::vec3 high = low;
+        for (size_t i = 0; i < num_vertices; i++) {
+            glm::vec3 p(position[i * 3], position[i * 3 + 1],
+                        position[i * 3 + 2]);
+            low = glm::min(low, p);
+            high = glm::max(high, p);
         }
+        position_bias = low;
+        position_scale = high - low;
+    }
 
-        lilswap((uint *)&buffer[header.ofs_poses],
-                header.num_poses * sizeof(IQMPose) / sizeof(uint));
-        lilswap((uint *)&buffer[header.ofs_anims],
-                header.num_anims * sizeof(IQMAnim) / sizeof(uint));
-        lilswap((ushort *)&buffer[header.ofs_frames],
-                header.num_frames * header.num_framechannels);
-
-        IQMAnim *anims = (IQMAnim *)&buffer[header.ofs_anims];
-        IQMPose *poses = (IQMPose *)&buffer[header.ofs_poses];
-        ushort *framedata = (ushort *)&buffer[header.ofs_frames];
-
-        num_frames = header.num_frames;
-        frames.resize(header.num_frames * header.num_poses);
-
-        skeletons.resize(1);
-        skeletons[current_skeleton_id].frames.resize(num_joints);
-
-        for (int i = 0; i < (int)header.num_frames; i++) {
-            for (int j = 0; j < (int)header.num_poses; j++) {
-                IQMPose &p = poses[j];
-                glm::quat rotate;
-                glm::vec3 translate, scale;
-
-                translate.x = p.channeloffset[0];
-                if (p.mask & 0x01)
-                    translate.x += *framedata++ * p.channelscale[0];
-                translate.y = p.channeloffset[1];
-                if (p.mask & 0x02)
-                    translate.y += *framedata++ * p.channelscale[1];
-                translate.z = p.channeloffset[2];
-                if (p.mask & 0x04)
-                    translate.z += *framedata++ * p.channelscale[2];
-
-                rotate.x = p.channeloffset[3];
-                if (p.mask & 0x08)
-                    rotate.x += *framedata++ * p.channelscale[3];
-                rotate.y = p.channeloffset[4];
-                if (p.mask & 0x10)
-                    rotate.y += *framedata++ * p.channelscale[4];
-                rotate.z = p.channeloffset[5];
-                if (p.mask & 0x20)
-                    rotate.z += *framedata++ * p.channelscale[5];
-                rotate.w = p.channeloffset[6];
-                if (p.mask & 0x40)
-                    rotate.w += *framedata++ * p.channelscale[6];
-
-                scale.x = p.channeloffset[7];
-                if (p.mask & 0x80)
-                    scale.x += *framedata++ * p.channelscale[7];
-                scale.y = p.channeloffset[8];
-                if (p.mask & 0x100)
-                    scale.y += *framedata++ * p.channelscale[8];
-                scale.z = p.channeloffset[9];
-                if (p.mask & 0x200)
-                    scale.z += *framedata++ * p.channelscale[9];
-
-                glm::mat4 m = MakeBoneMat(rotate, translate, scale);
-
-                if (p.parent >= 0) {
-                    frames[i * header.num_poses + j] =
-                        baseframe[p.parent] * m * inversebaseframe[j];
-                } else {
-                    frames[i * header.num_poses + j] = m * inversebaseframe[j];
-                }
+    std::vector<Uint8> packed(num_vertices * GetVertexSize(vertex_format));
+
+    for (size_t j = 0; j < num_vertices; j++) {
+        size_t i = vertex_order[j];
+        if (vertex_format == kVertexPacked) {
+            PackedVertex vertex;
+            PackAttributes(arrays, i, &vertex);
+            if (position) {
+                memcpy(vertex.position, &position[i * 3],
+                       sizeof(vertex.position));
+            }
+            memcpy(&packed[j * sizeof(vertex)], &vertex, sizeof(vertex));
+        } else {
+            QuantizedVertex vertex;
+            PackAttributes(arrays, i, &vertex);
+            for (int c = 0; position && c < 3; c++) {
+                vertex.position[c] =
+                    PackUnorm16(position[i * 3 + c], position_scale[c],
+                                position_bias[c]);
             }
+            memcpy(&packed[j * sizeof(vertex)], &vertex, sizeof(vertex));
         }
+    }
+
+    staging.swap(packed);
+    vertex_data = staging.data();
+    vertex_data_size = staging.size();
+}
 
-        for (int i = 0; i < (int)header.num_anims; i++) {
-            IQMAnim &a = anims[i];
-            log::InfoLog("%s: loaded anim: %s\n", filename, &str[a.name]);
+//------------------------------------------------------------------------------
+
+// Copies the file's arrays in vertex_order, replacing vertex_data.
+void IQMModel::ReorderVertices(size_t num_vertices)
+{
+    std::vector<Uint8> reordered;
+    for (VertexAttrib &attrib : vertex_attribs) {
+        size_t element_size =
+            attrib.size *
+            (attrib.type == GL_FLOAT ? sizeof(GLfloat) : sizeof(GLubyte));
+        const Uint8 *array = vertex_data + attrib.offset;
+
+        reordered.resize((reordered.size() + 3) & ~size_t(3));
+        attrib.offset = reordered.size();
+        reordered.resize(attrib.offset + num_vertices * element_size);
+
+        Uint8 *out = &reordered[attrib.offset];
+        for (size_t j = 0; j < num_vertices; j++) {
+            memcpy(out + j * element_size,
+                   array + vertex_order[j] * element_size, element_size);
+        }
+    }
+
+    staging.swap(reordered);
+    vertex_data = staging.data();
+    vertex_data_size = staging.size();
+}
+
+//------------------------------------------------------------------------------
+
+// Orders each mesh's triangles for the post-transform cache and then for
+// overdraw, builds its LODs, and numbers the vertices in the order the
+// result reads them. This runs with LoadFile on a worker, so it costs no
+// frame time.
+void IQMModel::OptimizeMeshes(const IQMTriangle *tris, size_t num_vertices,
+                              const char *names)
+{
+    SP_PROFILE_ZONE("OptimizeMeshes");
+
+    indices.resize(size_t(num_tris) * 3);
+    for (int i = 0; i < num_tris; i++) {
+        for (int j = 0; j < 3; j++) {
+            indices[i * 3 + j] = tris[i].vertex[j];
         }
     }
 
-    assert(header.num_vertexes);
-    Vertex *verts = new Vertex[header.num_vertexes];
-    memset(verts, 0, header.num_vertexes * sizeof(Vertex));
+    const float *positions = nullptr;
+    const Uint8 *blend_indices = nullptr;
+    const Uint8 *blend_weights = nullptr;
+    for (const VertexAttrib &attrib : vertex_attribs) {
+        if (attrib.index == 0) {
+            positions = (const float *)(vertex_data + attrib.offset);
+        } else if (attrib.index == 4) {
+            blend_indices = vertex_data + attrib.offset;
+        } else if (attrib.index == 5) {
+            blend_weights = vertex_data + attrib.offset;
+        }
+    }
 
-    for (int i = 0; i < (int)header.num_vertexes; i++) {
-        Vertex &v = verts[i];
+    // LODs keep each vertex with the joint that moves it most, so that
+    // they still bend where the full mesh does.
+    std::vector<Uint32> joints;
+    if (blend_indices && blend_weights) {
+        joints.resize(num_vertices);
+        for (size_t v = 0; v < num_vertices; v++) {
+            const Uint8 *weights = &blend_weights[v * 4];
+            size_t strongest = std::max_element(weights, weights + 4) - weights;
+            joints[v] = blend_indices[v * 4 + strongest];
+        }
+    }
 
-        if (inposition) {
-            memcpy(v.position, &inposition[i * 3], sizeof(v.position));
+    std::vector<Uint32> optimized;
+    lod_chains.resize(num_meshes);
+    for (int i = 0; i < num_meshes; i++) {
+        const IQMMesh &mesh = meshes[i];
+        Uint32 *mesh_indices = &indices[mesh.first_triangle * 3];
+        size_t num_indices = size_t(mesh.num_triangles) * 3;
+
+        VertexCacheStats before =
+            AnalyzeVertexCache(mesh_indices, num_indices, num_vertices);
+
+        optimized.resize(num_indices);
+        OptimizeVertexCache(optimized.data(), mesh_indices, num_indices,
+                            num_vertices);
+        if (positions) {
+            // IQM's front faces wind clockwise.
+            OptimizeOverdraw(mesh_indices, optimized.data(), num_indices,
+                             positions, 3, num_vertices, true);
+        } else {
+            std::copy(optimized.begin(), optimized.end(), mesh_indices);
         }
-        if (innormal) {
-            memcpy(v.normal, &innormal[i * 3], sizeof(v.normal));
+
+        VertexCacheStats after =
+            AnalyzeVertexCache(mesh_indices, num_indices, num_vertices);
+
+        // The LODs go after every mesh's full detail triangles.
+        MeshLodChain &chain = lod_chains[i];
+        chain.num_lods = 1;
+        chain.lods[0] = {mesh.first_triangle * 3, Uint32(num_indices), 0.0f};
+        if (positions) {
+            BuildLodChain(chain.lods[0].first_index, chain.lods[0].num_indices,
+                          positions, 3, num_vertices,
+                          joints.empty() ? nullptr : joints.data(), &indices,
+                          &chain);
         }
-        if (intangent) {
-            memcpy(v.tangent, &intangent[i * 4], sizeof(v.tangent));
+
+        log::InfoLog("Mesh %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, "
+                     "%d LODs down to %u triangles\n",
+                     &names[mesh.name], before.acmr, after.acmr, before.atvr,
+                     after.atvr, chain.num_lods,
+                     chain.lods[chain.num_lods - 1].num_indices / 3);
+    }
+
+    OptimizeVertexFetch(indices.data(), indices.size(), num_vertices,
+                        &vertex_order);
+
+    // Meshes that had vertex ranges of their own still do, renumbered.
+    for (IQMMesh &mesh : meshes) {
+        if (mesh.num_triangles == 0) {
+            continue;
         }
-        if (intexcoord) {
-            memcpy(v.texcoord, &intexcoord[i * 2], sizeof(v.texcoord));
+        const Uint32 *mesh_indices = &indices[mesh.first_triangle * 3];
+        const Uint32 *end = mesh_indices + mesh.num_triangles * 3;
+        Uint32 low = *std::min_element(mesh_indices, end);
+        Uint32 high = *std::max_element(mesh_indices, end);
+        mesh.first_vertex = low;
+        mesh.num_vertexes = high - low + 1;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// A cooked model is the output of OptimizeMeshes and the vertex packing:
+// the renumbered meshes, their LODs and the final vertex and index buffers,
+// which Upload reads straight from the blob.
+bool IQMModel::LoadCookedMeshes(Uint64 key, size_t num_vertices)
+{
+    vfs::File blob;
+    if (!cook::Load(key, &blob)) {
+        return false;
+    }
+
+    cook::Reader reader(blob);
+    const IQMMesh *cooked_meshes;
+    const MeshLodChain *chains;
+    const VertexAttrib *attribs;
+    const Uint8 *cooked_indices;
+    const Uint8 *cooked_vertices;
+    size_t num_cooked_meshes, num_chains, num_attribs, num_index_bytes,
+        num_vertex_bytes;
+    glm::vec3 scale, bias;
+    Uint32 type = 0;
+
+    bool valid =
+        reader.ReadArray(&cooked_meshes, &num_cooked_meshes) &&
+        reader.ReadArray(&chains, &num_chains) &&
+        reader.ReadArray(&attribs, &num_attribs) && reader.Read(&scale) &&
+        reader.Read(&bias) && reader.Read(&type) &&
+        reader.ReadArray(&cooked_indices, &num_index_bytes) &&
+        reader.ReadArray(&cooked_vertices, &num_vertex_bytes) &&
+        num_cooked_meshes == size_t(num_meshes) &&
+        num_chains == size_t(num_meshes) &&
+        type == GetIndexType(num_vertices) &&
+        num_index_bytes % GetIndexSize(type) == 0;
+
+    // Only the draw ranges are checked, the blob is trusted otherwise.
+    size_t num_cooked_indices = valid ? num_index_bytes / GetIndexSize(type)
+                                      : 0;
+    for (size_t i = 0; valid && i < num_chains; i++) {
+        const MeshLodChain &chain = chains[i];
+        valid = chain.num_lods >= 1 && chain.num_lods <= kMaxMeshLods;
+        for (int j = 0; valid && j < chain.num_lods; j++) {
+            valid = Uint64(chain.lods[j].first_index) +
+                        chain.lods[j].num_indices <=
+                    num_cooked_indices;
         }
-        if (inblendindex) {
-            memcpy(v.blendindex, &inblendindex[i * 4], sizeof(v.blendindex));
+    }
+
+    if (!valid) {
+        log::ErrorLog("Ignoring cooked IQM meshes with a bad layout\n");
+        return false;
+    }
+
+    meshes.assign(cooked_meshes, cooked_meshes + num_cooked_meshes);
+    lod_chains.assign(chains, chains + num_chains);
+    vertex_attribs.assign(attribs, attribs + num_attribs);
+    position_scale = scale;
+    position_bias = bias;
+    index_type = type;
+    index_data = cooked_indices;
+    index_data_size = num_index_bytes;
+    vertex_data = cooked_vertices;
+    vertex_data_size = num_vertex_bytes;
+    cooked = std::move(blob);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void IQMModel::StoreCookedMeshes(Uint64 key) const
+{
+    cook::Writer writer;
+    writer.WriteArray(meshes.data(), meshes.size());
+    writer.WriteArray(lod_chains.data(), lod_chains.size());
+    writer.WriteArray(vertex_attribs.data(), vertex_attribs.size());
+    writer.Write(position_scale);
+    writer.Write(position_bias);
+    writer.Write<Uint32>(index_type);
+    writer.WriteArray(static_cast<const Uint8 *>(index_data),
+                      index_data_size);
+    writer.WriteArray(vertex_data, vertex_data_size);
+
+    cook::Store(key, writer);
+}
+
+//------------------------------------------------------------------------------
+
+void IQMModel::PackIndices(size_t num_vertices)
+{
+    index_type = GetIndexType(num_vertices);
+    index_data_size = indices.size() * GetIndexSize(index_type);
+
+    if (index_type == GL_UNSIGNED_INT) {
+        index_data = indices.data();
+        return;
+    }
+
+    short_indices.assign(indices.begin(), indices.end());
+    index_data = short_indices.data();
+}
+
+//------------------------------------------------------------------------------
+
+// Materials may come and go without the model changing, so they're looked
+// up on every load.
+void IQMModel::CheckTextures(const char *filename)
+{
+    for (int i = 0; i < num_meshes; i++) {
+        if (!texture_paths[i].empty() && !vfs::Exists(texture_paths[i])) {
+            log::ErrorLog("%s: There is no material for mesh %d called %s\n",
+                          filename, i, texture_paths[i].c_str());
+            texture_paths[i].clear();
         }
-        if (inblendweight) {
-            memcpy(v.blendweight, &inblendweight[i * 4], sizeof(v.blendweight));
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool IQMModel::Upload()
+{
+    textures.resize(num_meshes);
+    for (int i = 0; i < num_meshes; i++) {
+        if (texture_paths[i].empty()) {
+            textures[i] = 0;
+            continue;
         }
+
+        textures[i] = RequestTexture(texture_paths[i], GL_TEXTURE_2D);
     }
 
     // Abstract out ogl buffer calls?
@@ -363,59 +894,58 @@ bool IQMModel::LoadModel(const char *filename)
     glGenBuffers(1, &v_buffer.vbo);
 
     glBindBuffer(GL_ARRAY_BUFFER, v_buffer.vbo);
-    glBufferData(GL_ARRAY_BUFFER, header.num_vertexes * sizeof(Vertex), verts,
+    glBufferData(GL_ARRAY_BUFFER, vertex_data_size, vertex_data,
                  GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, v_buffer.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 header.num_triangles * sizeof(IQMTriangle), tris,
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_data_size, index_data,
                  GL_STATIC_DRAW);
 
-    backend::SetVertAttribPointers();
+    // Attributes the file lacks stay disabled and read as (0, 0, 0, 1).
+    if (vertex_format == kVertexFloat) {
+        for (const VertexAttrib &attrib : vertex_attribs) {
+            glVertexAttribPointer(attrib.index, attrib.size, attrib.type,
+                                  attrib.normalized, 0,
+                                  (GLvoid *)attrib.offset);
+            glEnableVertexAttribArray(attrib.index);
+        }
+    } else {
+        backend::SetVertAttribPointers(vertex_format);
+    }
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    delete[] verts;
+    // The GL copy is all that is needed from here on.
+    file = vfs::File();
+    cooked = vfs::File();
+    std::vector<Uint8>().swap(swapped);
+    std::vector<Uint8>().swap(staging);
+    std::vector<GLushort>().swap(short_indices);
+    std::vector<Uint32>().swap(indices);
+    std::vector<Uint32>().swap(vertex_order);
+    index_data = nullptr;
+    index_data_size = 0;
+    vertex_data = nullptr;
+    vertex_data_size = 0;
+
+    is_loaded = true;
     return true;
 }
 
 //------------------------------------------------------------------------------
 
-void IQMModel::Animate(float current_time)
+void IQMModel::Animate(float seconds)
 {
-    if (!num_frames) {
-        return;
-    }
-
-    int frame1 = (int)floor(current_time);
-    int frame2 = frame1 + 1;
-
-    float frame_offset = current_time - frame1;
-
-    frame1 %= num_frames;
-    frame2 %= num_frames;
-
-    glm::mat4 *mat0 = &frames[frame1 * num_joints];
-    glm::mat4 *mat1 = &frames[frame2 * num_joints];
-
-    for (int i = 0; i < num_joints; i++) {
-        glm::mat4 mat =
-            (1.0f - frame_offset) * mat0[i] + frame_offset * mat1[i];
-
-        if (joints[i].parent >= 0) {
-            skeletons[0].frames[i] =
-                skeletons[0].frames[joints[i].parent] * mat;
-        } else {
-            skeletons[0].frames[i] = mat;
-        }
+    if (is_loaded) {
+        animator.Update(seconds);
     }
 }
 
 //------------------------------------------------------------------------------
 
-void IQMModel::Render()
+void IQMModel::Render(float pixels_per_unit)
 {
     glBindVertexArray(v_buffer.vao);
     glBindBuffer(GL_ARRAY_BUFFER, v_buffer.vbo);
@@ -423,10 +953,11 @@ void IQMModel::Render()
     glActiveTexture(GL_TEXTURE0);
 
     for (int i = 0; i < num_meshes; i++) {
-        IQMMesh &m = meshes[i];
+        const MeshLod &lod = SelectLod(lod_chains[i], pixels_per_unit);
         glBindTexture(GL_TEXTURE_2D, textures[i]);
-        glDrawElements(GL_TRIANGLES, 3 * m.num_triangles, GL_UNSIGNED_INT,
-                       (GLvoid *)(m.first_triangle * sizeof(IQMTriangle)));
+        glDrawElements(
+            GL_TRIANGLES, lod.num_indices, index_type,
+            (GLvoid *)(size_t(lod.first_index) * GetIndexSize(index_type)));
         glBindTexture(GL_TEXTURE_2D, 0);
     }
 
@@ -437,6 +968,9 @@ void IQMModel::Render()
 
 //------------------------------------------------------------------------------
 
-std::vector<glm::mat4> &IQMModel::GetBones() { return skeletons[0].frames; }
+const std::vector<glm::mat4> &IQMModel::GetBones() const
+{
+    return animator.GetPalette();
+}
 
 } // namespace sp
@@ -1,7 +1,14 @@
 #ifndef _SP_IQM_MODEL_H_
 #define _SP_IQM_MODEL_H_
 
+#include <string>
+#include <vector>
+
+#include "Animation.hpp"
+#include "FileSystem.hpp"
+#include "MeshSimplify.hpp"
 #include "VertexBuffer.hpp"
+#include "Shader.hpp"
 #include "IQM.hpp"
 
 namespace sp
@@ -11,10 +18,6 @@ struct MeshTri {
     unsigned int vertex[3];
 };
 
-struct Skeleton {
-    std::vector<glm::mat4> frames;
-};
-
 struct Mesh {
     GLuint texture_id;
     std::vector<MeshTri> vertices;
@@ -24,37 +27,102 @@ class IQMModel
 {
 public:
     IQMModel()
-        : meshes(nullptr), joints(nullptr), tris(nullptr), buffer(nullptr),
-          current_skeleton_id(0), num_tris(0), num_joints(0), num_meshes(0),
-          num_frames(0)
+        : position_scale(1.0f), position_bias(0.0f), index_data(nullptr),
+          index_data_size(0), vertex_data(nullptr), vertex_data_size(0),
+          vertex_format(kVertexPacked), index_type(GL_UNSIGNED_INT),
+          num_tris(0), num_meshes(0), is_loaded(false)
     {
     }
     ~IQMModel();
 
     bool LoadModel(const char *filename);
-    void Animate(float current_time);
-    void Render();
-    std::vector<glm::mat4> &GetBones();
+
+    // LoadModel in two halves: LoadFile only touches the CPU side and may run
+    // on a worker thread, Upload creates the GL objects on the GL thread.
+    bool LoadFile(const char *filename);
+    bool Upload();
+    bool IsLoaded() const { return is_loaded; }
+
+    // Set before LoadFile, kVertexPacked by default. kVertexFloat uploads
+    // the file's vertex arrays as they are.
+    void SetVertexFormat(VertexFormat format) { vertex_format = format; }
+
+    // Draw with these as the position_scale and position_bias uniforms;
+    // they only differ from identity for kVertexQuantized.
+    const glm::vec3 &GetPositionScale() const { return position_scale; }
+    const glm::vec3 &GetPositionBias() const { return position_bias; }
+
+    // Advances the animator by seconds. It plays the first clip on a loop
+    // until told otherwise.
+    void Animate(float seconds);
+    // Draws each mesh's coarsest LOD whose error stays under a pixel when
+    // one model unit covers pixels_per_unit pixels; see
+    // Renderer::GetPixelsPerUnit. The default draws full detail.
+    void Render(float pixels_per_unit = FLT_MAX);
+    const std::vector<glm::mat4> &GetBones() const;
+
+    // Other characters can share the model's animation with animators of
+    // their own.
+    const SkeletalAnimation &GetAnimation() const { return animation; }
+    Animator &GetAnimator() { return animator; }
 
     VertexBuffer v_buffer;
 
 private:
-    std::vector<glm::mat4x4> baseframe;
-    std::vector<glm::mat4x4> inversebaseframe;
-    std::vector<glm::mat4x4> frames;
-    std::vector<Skeleton> skeletons;
+    // One IQM vertex array, bound to a shader attribute location.
+    struct VertexAttrib {
+        GLuint index;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        size_t offset;
+    };
+
+    bool ReadVertexArrays(const Uint8 *data, const IQMHeader &header);
+    void OptimizeMeshes(const IQMTriangle *tris, size_t num_vertices,
+                        const char *names);
+    void PackVertices(size_t num_vertices);
+    void ReorderVertices(size_t num_vertices);
+    void PackIndices(size_t num_vertices);
+    bool LoadCookedMeshes(Uint64 key, size_t num_vertices);
+    void StoreCookedMeshes(Uint64 key) const;
+    void CheckTextures(const char *filename);
+
     std::vector<GLuint> textures;
+    std::vector<std::string> texture_paths;
+
+    std::vector<IQMMesh> meshes;
+    std::vector<MeshLodChain> lod_chains;
+    std::vector<VertexAttrib> vertex_attribs;
+
+    SkeletalAnimation animation;
+    Animator animator;
+
+    glm::vec3 position_scale;
+    glm::vec3 position_bias;
 
-    IQMMesh *meshes;
-    IQMJoint *joints;
-    IQMTriangle *tris;
-    unsigned char *buffer;
+    // Only needed until Upload. vertex_data points into the mapped file, or
+    // into swapped and staging when it can't be used as is; index_data into
+    // indices or short_indices. Both point into cooked when the meshes came
+    // from the cook cache. vertex_order maps the optimized vertex numbering
+    // back to the file's.
+    vfs::File file;
+    vfs::File cooked;
+    std::vector<Uint8> swapped;
+    std::vector<Uint8> staging;
+    std::vector<Uint32> indices;
+    std::vector<GLushort> short_indices;
+    std::vector<Uint32> vertex_order;
+    const void *index_data;
+    size_t index_data_size;
+    const Uint8 *vertex_data;
+    size_t vertex_data_size;
 
-    int current_skeleton_id;
+    VertexFormat vertex_format;
+    GLenum index_type;
     int num_tris;
-    int num_joints;
     int num_meshes;
-    int num_frames;
+    bool is_loaded;
 };
 
 } // namespace sp
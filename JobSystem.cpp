@@ -0,0 +1,216 @@
+#include <algorithm>
+
+#include "JobSystem.hpp"
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+
+// Index of the deque owned by the calling thread, 0 is the main thread.
+static thread_local int tls_queue_index = 0;
+
+//------------------------------------------------------------------------------
+
+JobSystem::~JobSystem() { Shutdown(); }
+
+//------------------------------------------------------------------------------
+
+void JobSystem::Init(int num_workers)
+{
+    if (is_running) {
+        return;
+    }
+
+    num_workers = std::max(num_workers, 0);
+
+    queues.clear();
+    for (int i = 0; i < num_workers + 1; i++) {
+        queues.emplace_back(new WorkQueue);
+    }
+
+    is_running = true;
+    tls_queue_index = 0;
+
+    for (int i = 0; i < num_workers; i++) {
+        workers.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+    }
+
+    log::InfoLog("JobSystem: started %d worker threads\n", num_workers);
+}
+
+//------------------------------------------------------------------------------
+
+void JobSystem::Shutdown()
+{
+    if (!is_running) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        is_running = false;
+    }
+    wake_condition.notify_all();
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+
+    // Anything left over still gets to run so no counter is left hanging.
+    Job job;
+    while (PopJob(0, job)) {
+        RunJob(job);
+    }
+    queues.clear();
+}
+
+//------------------------------------------------------------------------------
+
+void JobSystem::Submit(JobFunction job, JobCounter *counter)
+{
+    if (counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (queues.empty()) {
+        Job inline_job = {std::move(job), counter};
+        RunJob(inline_job);
+        return;
+    }
+
+    WorkQueue &queue = *queues[tls_queue_index];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back({std::move(job), counter});
+    }
+    num_queued.fetch_add(1, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake_condition.notify_one();
+}
+
+//------------------------------------------------------------------------------
+
+void JobSystem::Wait(JobCounter *counter)
+{
+    Job job;
+    while (!counter->IsDone()) {
+        if (!queues.empty() && FindJob(tls_queue_index, job)) {
+            RunJob(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool JobSystem::TryRunJob()
+{
+    Job job;
+    if (queues.empty() || !FindJob(tls_queue_index, job)) {
+        return false;
+    }
+
+    RunJob(job);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void JobSystem::WorkerLoop(int queue_index)
+{
+    tls_queue_index = queue_index;
+
+#ifdef SP_PROFILE
+    std::string thread_name = "Worker " + std::to_string(queue_index);
+    SP_PROFILE_THREAD(thread_name.c_str());
+#endif
+
+    Job job;
+    while (true) {
+        if (FindJob(queue_index, job)) {
+            RunJob(job);
+            continue;
+        }
+
+        SP_PROFILE_ZONE("Sleep");
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake_condition.wait(lock, [this]() {
+            return !is_running || num_queued.load() > 0;
+        });
+
+        if (!is_running) {
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool JobSystem::PopJob(int queue_index, Job &job)
+{
+    WorkQueue &queue = *queues[queue_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if (queue.jobs.empty()) {
+        return false;
+    }
+
+    job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    num_queued.fetch_sub(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool JobSystem::StealJob(int queue_index, Job &job)
+{
+    int num_queues = static_cast<int>(queues.size());
+
+    for (int i = 1; i < num_queues; i++) {
+        WorkQueue &victim = *queues[(queue_index + i) % num_queues];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+
+        if (!lock.owns_lock() || victim.jobs.empty()) {
+            continue;
+        }
+
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        num_queued.fetch_sub(1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+bool JobSystem::FindJob(int queue_index, Job &job)
+{
+    return PopJob(queue_index, job) || StealJob(queue_index, job);
+}
+
+//------------------------------------------------------------------------------
+
+void JobSystem::RunJob(Job &job)
+{
+    SP_PROFILE_ZONE("Job");
+
+    job.function();
+    job.function = nullptr;
+
+    if (job.counter) {
+        job.counter->pending.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+} // namespace sp
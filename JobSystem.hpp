@@ -0,0 +1,82 @@
+#ifndef _SP_JOB_SYSTEM_H_
+#define _SP_JOB_SYSTEM_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sp {
+
+typedef std::function<void()> JobFunction;
+
+// Tracks a group of submitted jobs. The counter reaches zero once every job
+// submitted against it has finished running.
+struct JobCounter {
+    JobCounter() : pending(0) {}
+    JobCounter(const JobCounter &) = delete;
+    JobCounter &operator=(const JobCounter &) = delete;
+
+    bool IsDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+    std::atomic<int> pending;
+};
+
+// Work-stealing thread pool. Every thread (including the main thread, which
+// owns queue 0) pushes and pops at the back of its own deque, idle workers
+// steal from the front of the other deques.
+class JobSystem {
+public:
+    JobSystem() : is_running(false), num_queued(0) {}
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+    ~JobSystem();
+
+    void Init(int num_workers);
+    void Shutdown();
+
+    void Submit(JobFunction job, JobCounter *counter = nullptr);
+
+    // Runs queued jobs on the calling thread until the counter is done.
+    void Wait(JobCounter *counter);
+
+    // Runs at most one queued job on the calling thread.
+    bool TryRunJob();
+
+    int GetNumWorkers() const { return static_cast<int>(workers.size()); }
+    bool IsRunning() const { return is_running; }
+
+private:
+    struct Job {
+        JobFunction function;
+        JobCounter *counter;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void WorkerLoop(int queue_index);
+    bool PopJob(int queue_index, Job &job);
+    bool StealJob(int queue_index, Job &job);
+    bool FindJob(int queue_index, Job &job);
+    void RunJob(Job &job);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_condition;
+
+    std::atomic<bool> is_running;
+    std::atomic<int> num_queued;
+};
+
+} // namespace sp
+
+#endif
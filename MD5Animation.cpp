@@ -1,5 +1,4 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
 #include <cmath>
@@ -9,7 +8,10 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <boost/filesystem.hpp>
 
+#include "FileSystem.hpp"
+#include "Logger.hpp"
 #include "MD5Animation.hpp"
+#include "Tokenizer.hpp"
 
 namespace fs = boost::filesystem;
 
@@ -23,12 +25,19 @@ static void ComputeQuatW(glm::quat &quat)
     }
 }
 
-static void RemoveQuotes(std::string &str)
+// Reads "( x y z )".
+static bool ReadTuple(sp::Tokenizer &tokens, float &x, float &y, float &z)
 {
-    size_t n;
-    while ((n = str.find('\"')) != std::string::npos) {
-        str.erase(n, 1);
-    }
+    return tokens.Expect("(") && tokens.Next(&x) && tokens.Next(&y) &&
+           tokens.Next(&z) && tokens.Expect(")");
+}
+
+static bool ParseError(const std::string &filename,
+                       const sp::Tokenizer &tokens)
+{
+    sp::log::ErrorLog("MD5Animation::LoadAnimation: %s:%d: Parse error\n",
+                      filename.c_str(), tokens.GetLine());
+    return false;
 }
 
 static glm::vec3 lerp(const glm::vec3 &a, const glm::vec3 &b, float dt)
@@ -47,104 +56,106 @@ MD5Animation::~MD5Animation() {}
 
 bool MD5Animation::LoadAnimation(const std::string &filename)
 {
-    if (!fs::exists(filename)) {
+    sp::vfs::File contents;
+    if (!sp::vfs::OpenMapped(filename, &contents)) {
         std::cerr << "MD5Animation::LoadAnimation: Failed to find file: "
                   << filename << std::endl;
+        return false;
     }
 
-    std::string param, junk;
-
-    std::ifstream file(filename);
-    int file_length = fs::file_size(filename);
-    assert(file_length > 0);
+    sp::Tokenizer tokens(contents);
+    assert(contents.GetSize() > 0);
 
     joint_infos.clear();
     bounds.clear();
     base_frames.clear();
     frames.clear();
+    skeletons.clear();
     animated_skeleton.joints.clear();
     num_frames = 0;
 
-    file >> param;
-
-    while (!file.eof()) {
+    for (std::string_view param = tokens.Next(); !param.empty();
+         param = tokens.Next()) {
         if (param == "MD5Version") {
-            file >> md5_version;
+            tokens.Next(&md5_version);
             assert(md5_version == 10);
         } else if (param == "commandline") {
-            file.ignore(file_length, '\n');
+            tokens.SkipLine();
         } else if (param == "numFrames") {
-            file >> num_frames;
-            file.ignore(file_length, '\n');
+            if (!tokens.Next(&num_frames) || num_frames < 0) {
+                return ParseError(filename, tokens);
+            }
+            bounds.reserve(num_frames);
+            frames.reserve(num_frames);
+            skeletons.reserve(num_frames);
         } else if (param == "numJoints") {
-            file >> num_joints;
-            file.ignore(file_length, '\n');
+            if (!tokens.Next(&num_joints) || num_joints < 0) {
+                return ParseError(filename, tokens);
+            }
+            joint_infos.reserve(num_joints);
+            base_frames.reserve(num_joints);
         } else if (param == "frameRate") {
-            file >> frame_rate;
-            file.ignore(file_length, '\n');
+            tokens.Next(&frame_rate);
         } else if (param == "numAnimatedComponents") {
-            file >> num_animated_components;
-            file.ignore(file_length, '\n');
+            if (!tokens.Next(&num_animated_components) ||
+                num_animated_components < 0) {
+                return ParseError(filename, tokens);
+            }
         } else if (param == "hierarchy") {
-            file >> junk;
-            for (int i = 0; i < num_joints; i++) {
+            tokens.Expect("{");
+            for (int i = 0; i < num_joints && !tokens.HasError(); i++) {
                 JointInfo joint;
-                file >> joint.name >> joint.parent_id >> joint.flags >>
-                    joint.start_index;
-                RemoveQuotes(joint.name);
+                joint.name = tokens.Next();
+                tokens.Next(&joint.parent_id);
+                tokens.Next(&joint.flags);
+                tokens.Next(&joint.start_index);
                 joint_infos.push_back(joint);
-                file.ignore(file_length, '\n');
             }
-            file >> junk;
+            tokens.Expect("}");
         } else if (param == "bounds") {
-            file >> junk;
-            file.ignore(file_length, '\n');
-            for (int i = 0; i < num_frames; i++) {
+            tokens.Expect("{");
+            for (int i = 0; i < num_frames && !tokens.HasError(); i++) {
                 Bound bound;
-                file >> junk;
-                file >> bound.min.x >> bound.min.y >> bound.min.z;
-                file >> junk >> junk;
-                file >> bound.max.x >> bound.max.y >> bound.max.z;
+                ReadTuple(tokens, bound.min.x, bound.min.y, bound.min.z);
+                ReadTuple(tokens, bound.max.x, bound.max.y, bound.max.z);
                 // bound.min.z = -bound.min.z;
                 // bound.max.z = -bound.max.z;
                 bounds.push_back(bound);
-                file.ignore(file_length, '\n');
             }
-            file >> junk;
-            file.ignore(file_length, '\n');
+            tokens.Expect("}");
         } else if (param == "baseframe") {
-            file >> junk;
-            file.ignore(file_length, '\n');
-            for (int i = 0; i < num_joints; i++) {
+            tokens.Expect("{");
+            for (int i = 0; i < num_joints && !tokens.HasError(); i++) {
                 BaseFrame base_frame;
-                file >> junk;
-                file >> base_frame.pos.x >> base_frame.pos.y >>
-                    base_frame.pos.z;
-                file >> junk >> junk;
-                file >> base_frame.orient.x >> base_frame.orient.y >>
-                    base_frame.orient.z;
-                file.ignore(file_length, '\n');
+                ReadTuple(tokens, base_frame.pos.x, base_frame.pos.y,
+                          base_frame.pos.z);
+                ReadTuple(tokens, base_frame.orient.x, base_frame.orient.y,
+                          base_frame.orient.z);
                 // base_frame.pos.z = -base_frame.pos.z;
                 // base_frame.orient.z = -base_frame.orient.z;
                 base_frames.push_back(base_frame);
             }
-            file >> junk;
-            file.ignore(file_length, '\n');
+            tokens.Expect("}");
         } else if (param == "frame") {
             FrameData frame;
-            file >> frame.id >> junk;
-            file.ignore(file_length, '\n');
-            for (int i = 0; i < num_animated_components; i++) {
-                float frame_data;
-                file >> frame_data;
-                frame.data.push_back(frame_data);
+            tokens.Next(&frame.id);
+            tokens.Expect("{");
+            frame.data.resize(num_animated_components);
+            for (float &frame_data : frame.data) {
+                tokens.Next(&frame_data);
+            }
+            tokens.Expect("}");
+            if (tokens.HasError()) {
+                return ParseError(filename, tokens);
             }
-            frames.push_back(frame);
+
             BuildFrameSkeleton(skeletons, joint_infos, base_frames, frame);
-            file >> junk;
-            file.ignore(file_length, '\n');
+            frames.push_back(std::move(frame));
+        }
+
+        if (tokens.HasError()) {
+            return ParseError(filename, tokens);
         }
-        file >> param;
     }
 
     animated_skeleton.joints.assign(num_joints, SkeletonJoint());
@@ -214,7 +225,7 @@ void MD5Animation::BuildFrameSkeleton(FrameSkeletonList &skeletons,
         skeleton.joints.push_back(animated_joint);
     }
 
-    skeletons.push_back(skeleton);
+    skeletons.push_back(std::move(skeleton));
 }
 
 void MD5Animation::Update(float dt)
@@ -1,6 +1,4 @@
 #include <iostream>
-#include <fstream>
-#include <limits>
 #include <vector>
 #include <string>
 #include <cmath>
@@ -14,9 +12,19 @@
 #include "MD5Model.hpp"
 
 #include "Asset.hpp"
+#include "CookCache.hpp"
+#include "FileSystem.hpp"
+#include "Logger.hpp"
+#include "MeshOptimize.hpp"
+#include "MeshSimplify.hpp"
+#include "Tokenizer.hpp"
+#include "VertexFormat.hpp"
 
 namespace fs = boost::filesystem;
 
+// Bump whenever OptimizeMesh's output changes, see CookCache.hpp.
+static const Uint32 kMD5CookVersion = 1;
+
 static void ComputeQuatW(glm::quat &quat)
 {
     float t = 1.0f - (quat.x * quat.x) - (quat.y * quat.y) - (quat.z * quat.z);
@@ -27,12 +35,19 @@ static void ComputeQuatW(glm::quat &quat)
     }
 }
 
-static void RemoveQuotes(std::string &str)
+// Reads "( x y z )".
+static bool ReadTuple(sp::Tokenizer &tokens, float &x, float &y, float &z)
 {
-    size_t n;
-    while ((n = str.find('\"')) != std::string::npos) {
-        str.erase(n, 1);
-    }
+    return tokens.Expect("(") && tokens.Next(&x) && tokens.Next(&y) &&
+           tokens.Next(&z) && tokens.Expect(")");
+}
+
+static bool ParseError(const std::string &filename,
+                       const sp::Tokenizer &tokens)
+{
+    sp::log::ErrorLog("MD5Model::LoadModel: %s:%d: Parse error\n",
+                      filename.c_str(), tokens.GetLine());
+    return false;
 }
 
 MD5Model::MD5Model()
@@ -44,6 +59,9 @@ MD5Model::MD5Model()
 MD5Model::~MD5Model()
 {
     for (Mesh &mesh : meshes) {
+        if (mesh.tex_id) {
+            sp::ReleaseTexture(mesh.tex_id);
+        }
         glDeleteVertexArrays(1, &mesh.vao);
         glDeleteBuffers(1, &mesh.attr_buffer_id);
         glDeleteBuffers(1, &mesh.index_buffer_id);
@@ -52,7 +70,8 @@ MD5Model::~MD5Model()
 
 bool MD5Model::LoadModel(const std::string &filename)
 {
-    if (!fs::exists(filename)) {
+    sp::vfs::File contents;
+    if (!sp::vfs::OpenMapped(filename, &contents)) {
         std::cerr << "MD5Model::LoadModel: Failed to load file " << filename
                   << std::endl;
         return false;
@@ -60,52 +79,64 @@ bool MD5Model::LoadModel(const std::string &filename)
 
     fs::path file_path = filename;
     fs::path parent_path = file_path.parent_path();
-    std::string param, junk;
 
-    std::ifstream file(filename);
-    uintmax_t file_length = fs::file_size(filename);
-    assert(file_length > 0);
+    sp::Tokenizer tokens(contents);
+    assert(contents.GetSize() > 0);
+
+    // Optimizing and simplifying the meshes is the slow part of a load, so
+    // its output is cooked, one entry per mesh in file order.
+    Uint64 cook_key = sp::cook::MakeKey(contents, "md5mesh", kMD5CookVersion);
+    sp::vfs::File cooked;
+    bool use_cooked = sp::cook::Load(cook_key, &cooked);
+    sp::cook::Reader cooked_meshes(cooked);
+    sp::cook::Writer writer;
+    bool store_cooked = false;
 
     joints.clear();
     meshes.clear();
 
-    file >> param;
-    while (!file.eof()) {
+    for (std::string_view param = tokens.Next(); !param.empty();
+         param = tokens.Next()) {
         if (param == "MD5Version") {
-            file >> md5_version;
+            tokens.Next(&md5_version);
             assert(md5_version == 10);
         } else if (param == "commandline") {
-            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            tokens.SkipLine();
         } else if (param == "numJoints") {
-            file >> num_joints;
+            if (!tokens.Next(&num_joints) || num_joints < 0) {
+                return ParseError(filename, tokens);
+            }
             joints.reserve(num_joints);
         } else if (param == "numMeshes") {
-            file >> num_meshes;
+            if (!tokens.Next(&num_meshes) || num_meshes < 0) {
+                return ParseError(filename, tokens);
+            }
             meshes.reserve(num_meshes);
         } else if (param == "joints") {
             Joint joint;
-            file >> junk;
-            for (int i = 0; i < num_joints; ++i) {
-                file >> joint.name >> joint.parent_id >> junk >> joint.pos.x >>
-                    joint.pos.y >> joint.pos.z >> junk >> junk >>
-                    joint.orient.x >> joint.orient.y >> joint.orient.z >> junk;
+            tokens.Expect("{");
+            for (int i = 0; i < num_joints && !tokens.HasError(); ++i) {
+                joint.name = tokens.Next();
+                tokens.Next(&joint.parent_id);
+                ReadTuple(tokens, joint.pos.x, joint.pos.y, joint.pos.z);
+                ReadTuple(tokens, joint.orient.x, joint.orient.y,
+                          joint.orient.z);
 
-                RemoveQuotes(joint.name);
                 ComputeQuatW(joint.orient);
-                file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
                 joints.push_back(joint);
             }
-            file >> junk;
+            tokens.Expect("}");
         } else if (param == "mesh") {
             Mesh mesh;
             int num_verts, num_tris, num_weights;
-            file >> junk;
-            file >> param;
-            while (param != "}") {
+            tokens.Expect("{");
+            for (param = tokens.Next(); param != "}"; param = tokens.Next()) {
+                if (tokens.HasError() || param.empty()) {
+                    return ParseError(filename, tokens);
+                }
+
                 if (param == "shader") {
-                    file >> mesh.shader;
-                    RemoveQuotes(mesh.shader);
+                    mesh.shader = tokens.Next();
 
                     fs::path shader_path(mesh.shader);
                     fs::path texture_path;
@@ -120,40 +151,44 @@ bool MD5Model::LoadModel(const std::string &filename)
                         texture_path.replace_extension(".tga");
                     }
 
-                    mesh.tex_id =
-                        sp::MakeTexture(texture_path.string(), GL_TEXTURE_2D);
-
-                    file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                '\n');
-
+                    mesh.tex_id = sp::RequestTexture(texture_path.string(),
+                                                     GL_TEXTURE_2D);
                 } else if (param == "numverts") {
-                    file >> num_verts;
-                    file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                '\n');
-                    for (int i = 0; i < num_verts; i++) {
+                    if (!tokens.Next(&num_verts) || num_verts < 0) {
+                        return ParseError(filename, tokens);
+                    }
+                    mesh.verts.reserve(num_verts);
+                    mesh.tex2d_buffer.reserve(num_verts);
+                    for (int i = 0; i < num_verts && !tokens.HasError(); i++) {
                         Vertex vert;
-                        file >> junk >> junk >> junk >> vert.texture0.x >>
-                            vert.texture0.y >> junk >> vert.start_weight >>
-                            vert.weight_count;
-
-                        file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                    '\n');
+                        int index;
+                        tokens.Expect("vert");
+                        tokens.Next(&index);
+                        tokens.Expect("(");
+                        tokens.Next(&vert.texture0.x);
+                        tokens.Next(&vert.texture0.y);
+                        tokens.Expect(")");
+                        tokens.Next(&vert.start_weight);
+                        tokens.Next(&vert.weight_count);
 
                         mesh.verts.push_back(vert);
                         mesh.tex2d_buffer.push_back(vert.texture0);
                     }
                 } else if (param == "numtris") {
-                    file >> num_tris;
-                    file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                '\n');
-                    for (int i = 0; i < num_tris; i++) {
+                    if (!tokens.Next(&num_tris) || num_tris < 0) {
+                        return ParseError(filename, tokens);
+                    }
+                    mesh.tris.reserve(num_tris);
+                    mesh.index_buffer.reserve(num_tris * 3);
+                    for (int i = 0; i < num_tris && !tokens.HasError(); i++) {
                         Triangle tri;
+                        int index;
+                        tokens.Expect("tri");
+                        tokens.Next(&index);
                         // Turn counter-clockwise for BACK_FACE culling
-                        file >> junk >> junk >> tri.indices[2] >>
-                            tri.indices[1] >> tri.indices[0];
-
-                        file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                    '\n');
+                        tokens.Next(&tri.indices[2]);
+                        tokens.Next(&tri.indices[1]);
+                        tokens.Next(&tri.indices[0]);
 
                         mesh.tris.push_back(tri);
                         mesh.index_buffer.push_back((GLuint)tri.indices[0]);
@@ -161,41 +196,66 @@ bool MD5Model::LoadModel(const std::string &filename)
                         mesh.index_buffer.push_back((GLuint)tri.indices[2]);
                     }
                 } else if (param == "numweights") {
-                    file >> num_weights;
-                    file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                '\n');
-
-                    for (int i = 0; i < num_weights; i++) {
+                    if (!tokens.Next(&num_weights) || num_weights < 0) {
+                        return ParseError(filename, tokens);
+                    }
+                    mesh.weights.reserve(num_weights);
+                    for (int i = 0; i < num_weights && !tokens.HasError();
+                         i++) {
                         Weight weight;
-                        file >> junk >> junk >> weight.joint_id >>
-                            weight.bias >> junk >> weight.pos.x >>
-                            weight.pos.y >> weight.pos.z >> junk;
-                        file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                    '\n');
+                        int index;
+                        tokens.Expect("weight");
+                        tokens.Next(&index);
+                        tokens.Next(&weight.joint_id);
+                        tokens.Next(&weight.bias);
+                        ReadTuple(tokens, weight.pos.x, weight.pos.y,
+                                  weight.pos.z);
                         // weight.pos.z = -weight.pos.z;
                         mesh.weights.push_back(weight);
                     }
                 } else {
-                    file.ignore(std::numeric_limits<std::streamsize>::max(),
-                                '\n');
+                    tokens.SkipLine();
                 }
-                file >> param;
             }
 
             PrepareMesh(mesh);
+
+            std::vector<Uint32> order;
+            if (use_cooked && !ReadCookedMesh(cooked_meshes, mesh, &order)) {
+                sp::log::ErrorLog("Ignoring cooked MD5 meshes with a bad "
+                                  "layout\n");
+                use_cooked = false;
+            }
+            if (!use_cooked) {
+                OptimizeMesh(mesh, &order);
+                store_cooked = true;
+            }
+            ReorderVertices(mesh, order);
+
+            writer.Write(mesh.lod_chain);
+            writer.WriteArray(order.data(), order.size());
+            writer.WriteArray(mesh.index_buffer.data(),
+                              mesh.index_buffer.size());
+
             PrepareNormals(mesh);
             PrepareBuffers(mesh);
             PrepareVAO(mesh);
 
-            meshes.push_back(mesh);
+            meshes.push_back(std::move(mesh));
         }
 
-        file >> param;
+        if (tokens.HasError()) {
+            return ParseError(filename, tokens);
+        }
     }
 
     assert((int)joints.size() == num_joints);
     assert((int)meshes.size() == num_meshes);
 
+    if (store_cooked) {
+        sp::cook::Store(cook_key, writer);
+    }
+
     return true;
 }
 
@@ -276,6 +336,130 @@ bool MD5Model::PrepareMesh(Mesh &mesh,
     return true;
 }
 
+// Orders the triangles for the post-transform cache and then for overdraw,
+// and builds the LODs. order gets the vertices in the order the triangles
+// first use them, for ReorderVertices. Needs the bind pose positions from
+// PrepareMesh.
+void MD5Model::OptimizeMesh(Mesh &mesh, std::vector<Uint32> *order)
+{
+    order->clear();
+    mesh.lod_chain.num_lods = 1;
+    mesh.lod_chain.lods[0] = {0, Uint32(mesh.index_buffer.size()), 0.0f};
+    if (mesh.index_buffer.empty()) {
+        return;
+    }
+
+    size_t num_vertices = mesh.verts.size();
+    std::vector<Uint32> indices(mesh.index_buffer.begin(),
+                                mesh.index_buffer.end());
+    std::vector<Uint32> optimized(indices.size());
+
+    sp::VertexCacheStats before =
+        sp::AnalyzeVertexCache(&indices[0], indices.size(), num_vertices);
+
+    sp::OptimizeVertexCache(&optimized[0], &indices[0], indices.size(),
+                            num_vertices);
+    sp::OptimizeOverdraw(&indices[0], &optimized[0], indices.size(),
+                         &mesh.position_buffer[0].x, 3, num_vertices, false);
+
+    sp::VertexCacheStats after =
+        sp::AnalyzeVertexCache(&indices[0], indices.size(), num_vertices);
+
+    // LODs keep each vertex with the joint that moves it most.
+    std::vector<Uint32> joints(num_vertices);
+    for (size_t i = 0; i < num_vertices; i++) {
+        const Vertex &vert = mesh.verts[i];
+        float strongest = -1.0f;
+        for (int j = 0; j < vert.weight_count; j++) {
+            const Weight &weight = mesh.weights[vert.start_weight + j];
+            if (weight.bias > strongest) {
+                strongest = weight.bias;
+                joints[i] = weight.joint_id;
+            }
+        }
+    }
+    sp::BuildLodChain(0, Uint32(indices.size()), &mesh.position_buffer[0].x, 3,
+                      num_vertices, &joints[0], &indices, &mesh.lod_chain);
+
+    const sp::MeshLodChain &chain = mesh.lod_chain;
+    sp::log::InfoLog("Mesh %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, "
+                     "%d LODs down to %u triangles\n",
+                     mesh.shader.c_str(), before.acmr, after.acmr,
+                     before.atvr, after.atvr, chain.num_lods,
+                     chain.lods[chain.num_lods - 1].num_indices / 3);
+
+    // The fetch pass renumbers the indices in place.
+    sp::OptimizeVertexFetch(&indices[0], indices.size(), num_vertices, order);
+    mesh.index_buffer.assign(indices.begin(), indices.end());
+}
+
+// Reads what OptimizeMesh made of mesh from a cooked model, checking it
+// against the mesh parsed from the file. Leaves mesh alone on failure.
+bool MD5Model::ReadCookedMesh(sp::cook::Reader &reader, Mesh &mesh,
+                              std::vector<Uint32> *order)
+{
+    sp::MeshLodChain chain;
+    const Uint32 *cooked_order;
+    const GLuint *cooked_indices;
+    size_t num_order, num_indices;
+    if (!reader.Read(&chain) || !reader.ReadArray(&cooked_order, &num_order) ||
+        !reader.ReadArray(&cooked_indices, &num_indices)) {
+        return false;
+    }
+
+    size_t num_vertices = mesh.verts.size();
+    if (num_indices < mesh.tris.size() * 3 || chain.num_lods < 1 ||
+        chain.num_lods > sp::kMaxMeshLods ||
+        num_order != (num_indices > 0 ? num_vertices : 0)) {
+        return false;
+    }
+    for (size_t i = 0; i < num_order; i++) {
+        if (cooked_order[i] >= num_vertices) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < num_indices; i++) {
+        if (cooked_indices[i] >= num_vertices) {
+            return false;
+        }
+    }
+    for (int i = 0; i < chain.num_lods; i++) {
+        if (Uint64(chain.lods[i].first_index) + chain.lods[i].num_indices >
+            num_indices) {
+            return false;
+        }
+    }
+
+    mesh.lod_chain = chain;
+    mesh.index_buffer.assign(cooked_indices, cooked_indices + num_indices);
+    order->assign(cooked_order, cooked_order + num_order);
+    return true;
+}
+
+// Moves the vertices into order, which the index buffer already uses, and
+// renumbers the triangles to match. An empty order leaves the mesh as is.
+void MD5Model::ReorderVertices(Mesh &mesh, const std::vector<Uint32> &order)
+{
+    if (order.empty()) {
+        return;
+    }
+
+    size_t num_vertices = mesh.verts.size();
+    VertexList verts(num_vertices);
+    for (size_t i = 0; i < num_vertices; i++) {
+        verts[i] = mesh.verts[order[i]];
+        mesh.position_buffer[i] = verts[i].pos;
+        mesh.tex2d_buffer[i] = verts[i].texture0;
+    }
+    mesh.verts.swap(verts);
+
+    for (size_t i = 0; i < mesh.tris.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            mesh.tris[i].indices[j] = int(mesh.index_buffer[i * 3 + j]);
+        }
+    }
+}
+
 bool MD5Model::PrepareNormals(Mesh &mesh)
 {
     mesh.normal_buffer.clear();
@@ -378,24 +562,37 @@ void MD5Model::PrepareVAO(Mesh &mesh)
     glGenBuffers(1, &mesh.index_buffer_id);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.index_buffer_id);
 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 sizeof(GLuint) * mesh.index_buffer.size(),
-                 &mesh.index_buffer[0], GL_STATIC_DRAW);
+    // Half the index bandwidth whenever the mesh allows it.
+    mesh.index_type = sp::GetIndexType(mesh.verts.size());
+    if (mesh.index_type == GL_UNSIGNED_SHORT) {
+        std::vector<GLushort> indices(mesh.index_buffer.begin(),
+                                      mesh.index_buffer.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                     sizeof(GLushort) * indices.size(), &indices[0],
+                     GL_STATIC_DRAW);
+    } else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                     sizeof(GLuint) * mesh.index_buffer.size(),
+                     &mesh.index_buffer[0], GL_STATIC_DRAW);
+    }
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 }
 
-void MD5Model::Render()
+void MD5Model::Render(float pixels_per_unit)
 {
     for (Mesh &mesh : meshes) {
-        RenderMesh(mesh);
+        RenderMesh(mesh, pixels_per_unit);
     }
 }
 
-void MD5Model::RenderMesh(const Mesh &mesh)
+void MD5Model::RenderMesh(const Mesh &mesh, float pixels_per_unit)
 {
+    const sp::MeshLod &lod = sp::SelectLod(mesh.lod_chain, pixels_per_unit);
+    size_t index_size = sp::GetIndexSize(mesh.index_type);
+
     glBindVertexArray(mesh.vao);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.index_buffer_id);
@@ -404,8 +601,8 @@ void MD5Model::RenderMesh(const Mesh &mesh)
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, mesh.tex_id);
 
-    glDrawElements(GL_TRIANGLES, mesh.index_buffer.size(), GL_UNSIGNED_INT,
-                   NULL);
+    glDrawElements(GL_TRIANGLES, lod.num_indices, mesh.index_type,
+                   (const GLvoid *)(lod.first_index * index_size));
 
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
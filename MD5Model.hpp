@@ -1,7 +1,9 @@
 #ifndef SP_MD5_MODEL_H_
 #define SP_MD5_MODEL_H_
 
+#include "CookCache.hpp"
 #include "MD5Animation.hpp"
+#include "MeshSimplify.hpp"
 
 class MD5Model {
 
@@ -12,7 +14,8 @@ public:
 	bool LoadModel(const std::string &filename);
 	bool LoadAnim(const std::string &filename);
 	void Update(float dt);
-	void Render();
+	// See IQMModel::Render for pixels_per_unit.
+	void Render(float pixels_per_unit = FLT_MAX);
 	void RenderNormals();
 
 protected:
@@ -59,12 +62,15 @@ protected:
 		GLuint		   vao;
 		GLuint		   attr_buffer_id;
 		GLuint		   index_buffer_id;
-		GLuint         tex_id;
+		GLuint         tex_id = 0;
+		GLenum         index_type = GL_UNSIGNED_INT;
 
 		PositionBuffer position_buffer;
 		NormalBuffer   normal_buffer;
 		Tex2DBuffer    tex2d_buffer;
 		IndexBuffer    index_buffer;
+		// LOD 0 is the first tris.size() * 3 indices.
+		sp::MeshLodChain lod_chain = {};
 	};
 
 	typedef std::vector<Mesh> MeshList;
@@ -72,10 +78,14 @@ protected:
 	bool PrepareMesh(Mesh &mesh);
 	bool PrepareMesh(Mesh &mesh, const MD5Animation::FrameSkeleton& skel);
 	bool PrepareNormals(Mesh &mesh);
+	void OptimizeMesh(Mesh &mesh, std::vector<Uint32> *order);
+	bool ReadCookedMesh(sp::cook::Reader &reader, Mesh &mesh,
+	                    std::vector<Uint32> *order);
+	void ReorderVertices(Mesh &mesh, const std::vector<Uint32> &order);
 	void PrepareBuffers(Mesh &mesh);
 	void PrepareVAO(Mesh &mesh);
 
-	void RenderMesh(const Mesh &mesh);
+	void RenderMesh(const Mesh &mesh, float pixels_per_unit);
 
 	void RenderSkeleton(const JointList &joints);
 
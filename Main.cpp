@@ -15,10 +15,85 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+#include <string>
+#include <vector>
+#include <SDL2/SDL_image.h>
+
+#include "CookCache.hpp"
+#include "FileSystem.hpp"
+#include "Logger.hpp"
 #include "Simple.hpp"
+#include "TextureCompress.hpp"
+
+// Cooked assets kept between runs, least recently used go first.
+static const Uint64 kCookCacheBytes = 512ull * 1024 * 1024;
+
+// sp --compress-texture <image> <out.dds> [bc1|bc3|bc5]
+static int CompressTexture(int argc, char **argv)
+{
+    if (argc < 4) {
+        sp::log::ErrorLog("usage: %s --compress-texture <image> <out.dds> "
+                          "[bc1|bc3|bc5]\n",
+                          argv[0]);
+        return 1;
+    }
+
+    sp::BlockFormat format = sp::kBC1;
+    if (argc > 4 && strcmp(argv[4], "bc3") == 0) {
+        format = sp::kBC3;
+    } else if (argc > 4 && strcmp(argv[4], "bc5") == 0) {
+        format = sp::kBC5;
+    }
+
+    SDL_Surface *loaded = IMG_Load(argv[2]);
+    if (!loaded) {
+        sp::log::ErrorLog("Can't load %s: %s\n", argv[2], IMG_GetError());
+        return 1;
+    }
+
+    SDL_Surface *surface =
+        SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    if (!surface) {
+        sp::log::ErrorLog("Can't convert %s: %s\n", argv[2], SDL_GetError());
+        return 1;
+    }
+
+    sp::TextureImage image;
+    sp::CompressImage(static_cast<const Uint8 *>(surface->pixels), surface->w,
+                      surface->h, surface->pitch, format, &image);
+    SDL_FreeSurface(surface);
+
+    return sp::WriteDDS(argv[3], image) ? 0 : 1;
+}
+
+// sp --build-pak <out.pak> <dir>...
+static int BuildPak(int argc, char **argv)
+{
+    if (argc < 4) {
+        sp::log::ErrorLog("usage: %s --build-pak <out.pak> <dir>...\n",
+                          argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> roots(argv + 3, argv + argc);
+    return sp::vfs::BuildPak(argv[2], roots) ? 0 : 1;
+}
 
 int main(int argc, char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "--compress-texture") == 0) {
+        return CompressTexture(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--build-pak") == 0) {
+        return BuildPak(argc, argv);
+    }
+
+    // Before the job system starts, loose files are used when it's missing.
+    sp::vfs::Mount("assets.pak");
+    sp::cook::Prune(kCookCacheBytes);
+
     SimpleGame game;
     game.Initialize();
     game.Run();
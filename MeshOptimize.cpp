@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "MeshOptimize.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+
+// Forsyth's scoring constants. The scoring cache is larger than the one
+// AnalyzeVertexCache simulates, which keeps triangles that share vertices
+// with recently emitted ones attractive a little longer.
+static const int kScoreCacheSize = 32;
+static const int kMaxScoredValence = 32;
+static const float kCacheDecayPower = 1.5f;
+static const float kLastTriangleScore = 0.75f;
+static const float kValenceBoostScale = 2.0f;
+static const float kValenceBoostPower = 0.5f;
+
+struct ForsythScores {
+    float cache[kScoreCacheSize];
+    float valence[kMaxScoredValence];
+};
+
+//------------------------------------------------------------------------------
+
+static const ForsythScores &GetForsythScores()
+{
+    static const ForsythScores scores = []() {
+        ForsythScores table;
+        for (int i = 0; i < kScoreCacheSize; i++) {
+            // The last triangle's vertices score a fixed amount so that the
+            // next one doesn't just reuse the same edge.
+            table.cache[i] =
+                i < 3 ? kLastTriangleScore
+                      : std::pow(1.0f - float(i - 3) / (kScoreCacheSize - 3),
+                                 kCacheDecayPower);
+        }
+        table.valence[0] = 0.0f;
+        for (int i = 1; i < kMaxScoredValence; i++) {
+            table.valence[i] =
+                kValenceBoostScale * std::pow(float(i), -kValenceBoostPower);
+        }
+        return table;
+    }();
+
+    return scores;
+}
+
+//------------------------------------------------------------------------------
+
+// Vertices with few triangles left score higher, so lone triangles get
+// picked up before they are stranded.
+static inline float ScoreVertex(const ForsythScores &scores,
+                                int cache_position, Uint32 num_live)
+{
+    if (num_live == 0) {
+        return -1.0f;
+    }
+
+    float score = cache_position >= 0 ? scores.cache[cache_position] : 0.0f;
+    return score +
+           scores.valence[std::min(num_live, Uint32(kMaxScoredValence - 1))];
+}
+
+//------------------------------------------------------------------------------
+
+VertexCacheStats AnalyzeVertexCache(const Uint32 *indices, size_t num_indices,
+                                    size_t num_vertices, int cache_size)
+{
+    // A vertex is still cached if fewer than cache_size misses happened
+    // since it was last loaded.
+    std::vector<Uint32> loaded(num_vertices, 0);
+    Uint32 time = Uint32(cache_size) + 1;
+    size_t num_misses = 0;
+    size_t num_unique = 0;
+
+    for (size_t i = 0; i < num_indices; i++) {
+        Uint32 vertex = indices[i];
+        if (time - loaded[vertex] > Uint32(cache_size)) {
+            num_unique += loaded[vertex] == 0;
+            loaded[vertex] = time++;
+            num_misses++;
+        }
+    }
+
+    VertexCacheStats stats = {0.0f, 0.0f};
+    if (num_indices >= 3) {
+        stats.acmr = float(num_misses) / float(num_indices / 3);
+        stats.atvr = float(num_misses) / float(num_unique);
+    }
+
+    return stats;
+}
+
+//------------------------------------------------------------------------------
+
+void OptimizeVertexCache(Uint32 *destination, const Uint32 *indices,
+                         size_t num_indices, size_t num_vertices)
+{
+    SP_PROFILE_ZONE("OptimizeVertexCache");
+
+    const ForsythScores &scores = GetForsythScores();
+    size_t num_triangles = num_indices / 3;
+    if (num_triangles == 0) {
+        return;
+    }
+
+    // Triangles using each vertex. The first num_live[v] entries of a
+    // vertex's list are the ones not emitted yet.
+    std::vector<Uint32> num_live(num_vertices, 0);
+    for (size_t i = 0; i < num_triangles * 3; i++) {
+        num_live[indices[i]]++;
+    }
+
+    std::vector<Uint32> first_adjacent(num_vertices + 1, 0);
+    for (size_t v = 0; v < num_vertices; v++) {
+        first_adjacent[v + 1] = first_adjacent[v] + num_live[v];
+    }
+
+    std::vector<Uint32> adjacent(num_triangles * 3);
+    std::vector<Uint32> filled(first_adjacent.begin(),
+                               first_adjacent.end() - 1);
+    for (size_t i = 0; i < num_triangles * 3; i++) {
+        adjacent[filled[indices[i]]++] = Uint32(i / 3);
+    }
+
+    std::vector<int> cache_position(num_vertices, -1);
+    std::vector<float> vertex_score(num_vertices);
+    for (size_t v = 0; v < num_vertices; v++) {
+        vertex_score[v] = ScoreVertex(scores, -1, num_live[v]);
+    }
+
+    std::vector<bool> emitted(num_triangles, false);
+    size_t best = 0;
+    float best_score = -1.0f;
+    for (size_t t = 0; t < num_triangles; t++) {
+        const Uint32 *triangle = &indices[t * 3];
+        float score = vertex_score[triangle[0]] + vertex_score[triangle[1]] +
+                      vertex_score[triangle[2]];
+        if (score > best_score) {
+            best = t;
+            best_score = score;
+        }
+    }
+
+    const size_t kNone = ~size_t(0);
+    Uint32 cache[kScoreCacheSize + 3];
+    int cache_size = 0;
+    size_t next_unemitted = 0;
+
+    for (size_t output = 0; output < num_triangles; output++) {
+        // Nothing in the cache has triangles left, start over anywhere.
+        if (best == kNone) {
+            while (emitted[next_unemitted]) {
+                next_unemitted++;
+            }
+            best = next_unemitted;
+        }
+
+        const Uint32 *triangle = &indices[best * 3];
+        memcpy(&destination[output * 3], triangle, 3 * sizeof(Uint32));
+        emitted[best] = true;
+
+        for (int k = 0; k < 3; k++) {
+            Uint32 *list = &adjacent[first_adjacent[triangle[k]]];
+            Uint32 &count = num_live[triangle[k]];
+            Uint32 *found = std::find(list, list + count, Uint32(best));
+            std::swap(*found, list[count - 1]);
+            count--;
+        }
+
+        // The triangle's vertices move to the front, the rest shift back
+        // and the last three may fall out.
+        Uint32 new_cache[kScoreCacheSize + 3];
+        int new_size = 0;
+        for (int k = 0; k < 3; k++) {
+            if (std::find(new_cache, new_cache + new_size, triangle[k]) ==
+                new_cache + new_size) {
+                new_cache[new_size++] = triangle[k];
+            }
+        }
+        for (int i = 0; i < cache_size; i++) {
+            if (std::find(triangle, triangle + 3, cache[i]) == triangle + 3) {
+                new_cache[new_size++] = cache[i];
+            }
+        }
+
+        for (int i = 0; i < new_size; i++) {
+            Uint32 vertex = new_cache[i];
+            cache_position[vertex] = i < kScoreCacheSize ? i : -1;
+            vertex_score[vertex] =
+                ScoreVertex(scores, cache_position[vertex], num_live[vertex]);
+        }
+
+        // Only triangles touching the cache changed score, and the best
+        // one is nearly always among them.
+        best = kNone;
+        for (int i = 0; i < new_size; i++) {
+            Uint32 vertex = new_cache[i];
+            const Uint32 *list = &adjacent[first_adjacent[vertex]];
+
+            for (Uint32 j = 0; j < num_live[vertex]; j++) {
+                const Uint32 *other = &indices[list[j] * 3];
+                float score = vertex_score[other[0]] +
+                              vertex_score[other[1]] +
+                              vertex_score[other[2]];
+                if (best == kNone || score > best_score) {
+                    best = list[j];
+                    best_score = score;
+                }
+            }
+        }
+
+        cache_size = std::min(new_size, kScoreCacheSize);
+        std::copy(new_cache, new_cache + cache_size, cache);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void OptimizeOverdraw(Uint32 *destination, const Uint32 *indices,
+                      size_t num_indices, const float *positions,
+                      size_t stride, size_t num_vertices, bool clockwise,
+                      float threshold)
+{
+    SP_PROFILE_ZONE("OptimizeOverdraw");
+
+    size_t num_triangles = num_indices / 3;
+    if (num_triangles == 0) {
+        return;
+    }
+
+    // Simulates the cache over the list, or from cold at each cluster start
+    // when splitting; fills misses with the misses of each triangle.
+    std::vector<Uint32> loaded(num_vertices, 0);
+    Uint32 time = kVertexCacheSize + 1;
+    auto count_misses = [&](size_t t) {
+        int count = 0;
+        for (int k = 0; k < 3; k++) {
+            Uint32 vertex = indices[t * 3 + k];
+            if (time - loaded[vertex] > Uint32(kVertexCacheSize)) {
+                loaded[vertex] = time++;
+                count++;
+            }
+        }
+        return count;
+    };
+
+    std::vector<bool> is_hard_start(num_triangles);
+    size_t total_misses = 0;
+    for (size_t t = 0; t < num_triangles; t++) {
+        int misses = count_misses(t);
+        is_hard_start[t] = t == 0 || misses == 3;
+        total_misses += misses;
+    }
+
+    // Clusters start where the cache starts over anyway, three misses in
+    // one triangle, or once the triangles so far, drawn from a cold cache,
+    // do as well as the threshold asks of the whole list. Reordering whole
+    // clusters then can't cost more than that.
+    float target = threshold * float(total_misses) / float(num_triangles);
+    std::vector<size_t> cluster_start;
+    size_t cluster_misses = 0;
+
+    for (size_t t = 0; t < num_triangles; t++) {
+        if (is_hard_start[t]) {
+            cluster_start.push_back(t);
+            time += kVertexCacheSize + 1;
+            cluster_misses = 0;
+        }
+        cluster_misses += count_misses(t);
+
+        size_t cluster_size = t + 1 - cluster_start.back();
+        if (t + 1 < num_triangles && !is_hard_start[t + 1] &&
+            float(cluster_misses) <= target * float(cluster_size)) {
+            cluster_start.push_back(t + 1);
+            time += kVertexCacheSize + 1;
+            cluster_misses = 0;
+        }
+    }
+    cluster_start.push_back(num_triangles);
+
+    size_t num_clusters = cluster_start.size() - 1;
+    std::vector<glm::vec3> centroids(num_clusters);
+    std::vector<glm::vec3> normals(num_clusters);
+    glm::vec3 mesh_centroid(0.0f);
+    float mesh_area = 0.0f;
+
+    for (size_t c = 0; c < num_clusters; c++) {
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+
+        for (size_t t = cluster_start[c]; t < cluster_start[c + 1]; t++) {
+            const float *p0 = &positions[indices[t * 3] * stride];
+            const float *p1 = &positions[indices[t * 3 + 1] * stride];
+            const float *p2 = &positions[indices[t * 3 + 2] * stride];
+            glm::vec3 v0(p0[0], p0[1], p0[2]);
+            glm::vec3 v1(p1[0], p1[1], p1[2]);
+            glm::vec3 v2(p2[0], p2[1], p2[2]);
+
+            glm::vec3 cross = glm::cross(v1 - v0, v2 - v0);
+            float triangle_area = glm::length(cross);
+            centroid += (v0 + v1 + v2) * (triangle_area / 3.0f);
+            normal += cross;
+            area += triangle_area;
+        }
+
+        mesh_centroid += centroid;
+        mesh_area += area;
+        centroids[c] = area > 0.0f ? centroid / area : centroid;
+        float length = glm::length(normal);
+        normals[c] = length > 0.0f ? normal / length : normal;
+        if (clockwise) {
+            normals[c] = -normals[c];
+        }
+    }
+    if (mesh_area > 0.0f) {
+        mesh_centroid /= mesh_area;
+    }
+
+    // Clusters facing away from the centre are the mesh's outside, drawing
+    // them first lets early depth testing reject what they cover.
+    std::vector<float> facing(num_clusters);
+    std::vector<size_t> order(num_clusters);
+    for (size_t c = 0; c < num_clusters; c++) {
+        facing[c] = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&facing](size_t a, size_t b) {
+        return facing[a] > facing[b];
+    });
+
+    Uint32 *output = destination;
+    for (size_t c : order) {
+        size_t count = (cluster_start[c + 1] - cluster_start[c]) * 3;
+        memcpy(output, &indices[cluster_start[c] * 3], count * sizeof(Uint32));
+        output += count;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void OptimizeVertexFetch(Uint32 *indices, size_t num_indices,
+                         size_t num_vertices, std::vector<Uint32> *order)
+{
+    const Uint32 kUnused = ~Uint32(0);
+    std::vector<Uint32> remap(num_vertices, kUnused);
+
+    order->clear();
+    order->reserve(num_vertices);
+
+    for (size_t i = 0; i < num_indices; i++) {
+        Uint32 &vertex = remap[indices[i]];
+        if (vertex == kUnused) {
+            vertex = Uint32(order->size());
+            order->push_back(indices[i]);
+        }
+        indices[i] = vertex;
+    }
+
+    for (size_t v = 0; v < num_vertices; v++) {
+        if (remap[v] == kUnused) {
+            order->push_back(Uint32(v));
+        }
+    }
+}
+
+} // namespace sp
@@ -0,0 +1,51 @@
+#ifndef _SP_MESH_OPTIMIZE_H_
+#define _SP_MESH_OPTIMIZE_H_
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+namespace sp {
+
+// Size of the FIFO post-transform cache AnalyzeVertexCache simulates, about
+// what current GPUs reuse between neighbouring triangles.
+const int kVertexCacheSize = 16;
+
+struct VertexCacheStats {
+    // Vertices transformed per triangle, 0.5 at best for a large regular
+    // grid and 3 at worst.
+    float acmr;
+    // Vertices transformed per vertex referenced, 1 at best.
+    float atvr;
+};
+
+// Counts the vertex shader invocations of an indexed triangle list in a FIFO
+// cache of cache_size vertices.
+VertexCacheStats AnalyzeVertexCache(const Uint32 *indices, size_t num_indices,
+                                    size_t num_vertices,
+                                    int cache_size = kVertexCacheSize);
+
+// Reorders triangles for the post-transform cache with Tom Forsyth's linear
+// speed algorithm. Vertices keep their order within each triangle.
+// destination must not alias indices.
+void OptimizeVertexCache(Uint32 *destination, const Uint32 *indices,
+                         size_t num_indices, size_t num_vertices);
+
+// Reorders a cache optimized list in clusters so that outward facing parts
+// of the mesh draw first and hide the rest, giving up at most threshold
+// times the list's ACMR. positions holds three floats per vertex, stride
+// floats apart. Front faces wind counter-clockwise unless clockwise is set.
+// destination must not alias indices.
+void OptimizeOverdraw(Uint32 *destination, const Uint32 *indices,
+                      size_t num_indices, const float *positions,
+                      size_t stride, size_t num_vertices, bool clockwise,
+                      float threshold = 1.05f);
+
+// Renumbers vertices in the order the indices first use them, so the vertex
+// buffer is read front to back. Rewrites indices in place and fills order
+// with the old index of each new vertex; vertices no index uses go last.
+void OptimizeVertexFetch(Uint32 *indices, size_t num_indices,
+                         size_t num_vertices, std::vector<Uint32> *order);
+
+} // namespace sp
+
+#endif
@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+#include "MeshOptimize.hpp"
+#include "MeshSimplify.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+
+// Largest error a LOD may have, relative to the mesh's extent. Beyond it
+// the silhouette visibly changes even when the LOD covers a few pixels.
+static const float kMaxLodError = 0.05f;
+// Meshes below this many triangles aren't worth another LOD.
+static const size_t kMinLodTriangles = 64;
+// A LOD that keeps more than this fraction of the previous one's indices
+// isn't worth the memory.
+static const float kMinLodReduction = 0.8f;
+// Projected error, in pixels, that SelectLod accepts.
+static const float kLodPixelError = 1.0f;
+
+// Sum of squared distances to a set of planes, weighted by triangle area:
+// p.A.p + 2 b.p + c.
+struct Quadric {
+    float a00, a01, a02, a11, a12, a22;
+    float b0, b1, b2;
+    float c;
+    float weight;
+};
+
+//------------------------------------------------------------------------------
+
+static void AddPlane(const glm::vec3 &normal, float distance, float area,
+                     Quadric *q)
+{
+    q->a00 += area * normal.x * normal.x;
+    q->a01 += area * normal.x * normal.y;
+    q->a02 += area * normal.x * normal.z;
+    q->a11 += area * normal.y * normal.y;
+    q->a12 += area * normal.y * normal.z;
+    q->a22 += area * normal.z * normal.z;
+    q->b0 += area * distance * normal.x;
+    q->b1 += area * distance * normal.y;
+    q->b2 += area * distance * normal.z;
+    q->c += area * distance * distance;
+    q->weight += area;
+}
+
+//------------------------------------------------------------------------------
+
+static void AddQuadric(const Quadric &from, Quadric *to)
+{
+    to->a00 += from.a00;
+    to->a01 += from.a01;
+    to->a02 += from.a02;
+    to->a11 += from.a11;
+    to->a12 += from.a12;
+    to->a22 += from.a22;
+    to->b0 += from.b0;
+    to->b1 += from.b1;
+    to->b2 += from.b2;
+    to->c += from.c;
+    to->weight += from.weight;
+}
+
+//------------------------------------------------------------------------------
+
+// Mean squared distance of p to the quadric's planes.
+static float EvaluateQuadric(const Quadric &q, const glm::vec3 &p)
+{
+    float rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z;
+    float ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z;
+    float rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z;
+    float error = p.x * rx + p.y * ry + p.z * rz +
+                  2.0f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+
+    return q.weight > 0.0f ? std::fabs(error) / q.weight : 0.0f;
+}
+
+//------------------------------------------------------------------------------
+
+struct PositionKey {
+    Uint32 bits[3];
+
+    bool operator==(const PositionKey &other) const
+    {
+        return memcmp(bits, other.bits, sizeof(bits)) == 0;
+    }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey &key) const
+    {
+        return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^
+               (key.bits[2] * 83492791u);
+    }
+};
+
+//------------------------------------------------------------------------------
+
+// Locks the vertices a collapse would tear: those sharing their position
+// with another vertex, which are UV or normal seams, and those on edges
+// only one triangle uses.
+static void FindLockedVertices(const Uint32 *indices, size_t num_indices,
+                               const float *positions, size_t stride,
+                               size_t num_vertices, std::vector<bool> *locked)
+{
+    std::vector<Uint32> welded(num_vertices);
+    std::vector<Uint32> num_wedges(num_vertices, 0);
+    std::unordered_map<PositionKey, Uint32, PositionKeyHash> first_at;
+
+    for (size_t v = 0; v < num_vertices; v++) {
+        PositionKey key;
+        memcpy(key.bits, &positions[v * stride], sizeof(key.bits));
+        welded[v] = first_at.emplace(key, Uint32(v)).first->second;
+    }
+
+    std::vector<bool> is_used(num_vertices, false);
+    for (size_t i = 0; i < num_indices; i++) {
+        if (!is_used[indices[i]]) {
+            is_used[indices[i]] = true;
+            num_wedges[welded[indices[i]]]++;
+        }
+    }
+
+    // Seams show up as twice used edges once vertices are welded, borders
+    // as edges used once.
+    std::unordered_map<Uint64, int> edge_uses;
+    for (size_t i = 0; i < num_indices; i += 3) {
+        for (int k = 0; k < 3; k++) {
+            Uint64 a = welded[indices[i + k]];
+            Uint64 b = welded[indices[i + (k + 1) % 3]];
+            edge_uses[std::min(a, b) << 32 | std::max(a, b)]++;
+        }
+    }
+
+    locked->assign(num_vertices, false);
+    for (size_t v = 0; v < num_vertices; v++) {
+        (*locked)[v] = num_wedges[welded[v]] > 1;
+    }
+    for (size_t i = 0; i < num_indices; i += 3) {
+        for (int k = 0; k < 3; k++) {
+            Uint32 a = indices[i + k];
+            Uint32 b = indices[i + (k + 1) % 3];
+            Uint64 wa = welded[a], wb = welded[b];
+            if (edge_uses[std::min(wa, wb) << 32 | std::max(wa, wb)] == 1) {
+                (*locked)[a] = true;
+                (*locked)[b] = true;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+size_t SimplifyMesh(Uint32 *destination, const Uint32 *indices,
+                    size_t num_indices, const float *positions, size_t stride,
+                    size_t num_vertices, const Uint32 *groups,
+                    size_t target_indices, float max_error, float *error)
+{
+    SP_PROFILE_ZONE("SimplifyMesh");
+
+    *error = 0.0f;
+    if (destination != indices) {
+        memcpy(destination, indices, num_indices * sizeof(Uint32));
+    }
+    if (num_indices <= target_indices) {
+        return num_indices;
+    }
+
+    // Work in a unit box so that float quadrics keep their precision.
+    glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+    for (size_t i = 0; i < num_indices; i++) {
+        const float *p = &positions[indices[i] * stride];
+        low = glm::min(low, glm::vec3(p[0], p[1], p[2]));
+        high = glm::max(high, glm::vec3(p[0], p[1], p[2]));
+    }
+    glm::vec3 extent = high - low;
+    float scale = std::max(extent.x, std::max(extent.y, extent.z));
+    if (scale <= 0.0f) {
+        return num_indices;
+    }
+
+    std::vector<glm::vec3> points(num_vertices);
+    for (size_t v = 0; v < num_vertices; v++) {
+        const float *p = &positions[v * stride];
+        points[v] = (glm::vec3(p[0], p[1], p[2]) - low) / scale;
+    }
+
+    std::vector<bool> locked;
+    FindLockedVertices(indices, num_indices, positions, stride, num_vertices,
+                       &locked);
+
+    std::vector<Quadric> quadrics(num_vertices, Quadric());
+    for (size_t i = 0; i < num_indices; i += 3) {
+        const glm::vec3 &p0 = points[indices[i]];
+        glm::vec3 cross = glm::cross(points[indices[i + 1]] - p0,
+                                     points[indices[i + 2]] - p0);
+        float length = glm::length(cross);
+        if (length <= 0.0f) {
+            continue;
+        }
+
+        glm::vec3 normal = cross / length;
+        float distance = -glm::dot(normal, p0);
+        for (int k = 0; k < 3; k++) {
+            AddPlane(normal, distance, length * 0.5f,
+                     &quadrics[indices[i + k]]);
+        }
+    }
+
+    struct Collapse {
+        Uint32 from;
+        Uint32 to;
+        float error;
+    };
+
+    float error_limit = (max_error / scale) * (max_error / scale);
+    float largest_error = 0.0f;
+    size_t count = num_indices;
+
+    std::vector<Uint32> first_adjacent(num_vertices + 1);
+    std::vector<Uint32> adjacent;
+    std::vector<Collapse> collapses;
+    std::vector<Uint32> collapse_to(num_vertices);
+    std::vector<bool> touched(num_vertices);
+
+    // Each pass collapses the cheapest edges that don't share triangles,
+    // then rebuilds the list.
+    while (count > target_indices) {
+        std::fill(first_adjacent.begin(), first_adjacent.end(), 0);
+        for (size_t i = 0; i < count; i++) {
+            first_adjacent[destination[i] + 1]++;
+        }
+        for (size_t v = 0; v < num_vertices; v++) {
+            first_adjacent[v + 1] += first_adjacent[v];
+        }
+        adjacent.resize(count);
+        std::vector<Uint32> filled(first_adjacent.begin(),
+                                   first_adjacent.end() - 1);
+        for (size_t i = 0; i < count; i++) {
+            adjacent[filled[destination[i]]++] = Uint32(i / 3);
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < count; i++) {
+            Uint32 from = destination[i];
+            Uint32 to = destination[i - i % 3 + (i % 3 + 1) % 3];
+            for (int direction = 0; direction < 2; direction++) {
+                if (!locked[from] && (!groups || groups[from] == groups[to])) {
+                    float cost = EvaluateQuadric(quadrics[from], points[to]);
+                    collapses.push_back({from, to, cost});
+                }
+                std::swap(from, to);
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse &a, const Collapse &b) {
+                      return a.error < b.error;
+                  });
+
+        for (size_t v = 0; v < num_vertices; v++) {
+            collapse_to[v] = Uint32(v);
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        // A collapse removes the two triangles on its edge.
+        size_t triangles_wanted = (count - target_indices + 5) / 6;
+        size_t num_collapsed = 0;
+
+        for (const Collapse &collapse : collapses) {
+            if (collapse.error > error_limit ||
+                num_collapsed >= triangles_wanted) {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to]) {
+                continue;
+            }
+
+            // Skip collapses that would turn a triangle around.
+            bool flips = false;
+            Uint32 begin = first_adjacent[collapse.from];
+            Uint32 end = first_adjacent[collapse.from + 1];
+            for (Uint32 a = begin; a < end && !flips; a++) {
+                const Uint32 *triangle = &destination[adjacent[a] * 3];
+                if (std::find(triangle, triangle + 3, collapse.to) !=
+                    triangle + 3) {
+                    continue;
+                }
+
+                glm::vec3 p[3], moved[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = moved[k] = points[triangle[k]];
+                    if (triangle[k] == collapse.from) {
+                        moved[k] = points[collapse.to];
+                    }
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after =
+                    glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                flips = glm::dot(before, after) <= 0.0f;
+            }
+            if (flips) {
+                continue;
+            }
+
+            // Neighbouring collapses would invalidate the flip test.
+            for (Uint32 a = begin; a < end; a++) {
+                const Uint32 *triangle = &destination[adjacent[a] * 3];
+                for (int k = 0; k < 3; k++) {
+                    touched[triangle[k]] = true;
+                }
+            }
+
+            collapse_to[collapse.from] = collapse.to;
+            AddQuadric(quadrics[collapse.from], &quadrics[collapse.to]);
+            largest_error = std::max(largest_error, collapse.error);
+            num_collapsed++;
+        }
+
+        if (num_collapsed == 0) {
+            break;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i += 3) {
+            Uint32 a = collapse_to[destination[i]];
+            Uint32 b = collapse_to[destination[i + 1]];
+            Uint32 c = collapse_to[destination[i + 2]];
+            if (a != b && b != c && c != a) {
+                destination[kept++] = a;
+                destination[kept++] = b;
+                destination[kept++] = c;
+            }
+        }
+        count = kept;
+    }
+
+    *error = std::sqrt(largest_error) * scale;
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+void BuildLodChain(Uint32 first_index, Uint32 num_indices,
+                   const float *positions, size_t stride, size_t num_vertices,
+                   const Uint32 *groups, std::vector<Uint32> *indices,
+                   MeshLodChain *chain)
+{
+    SP_PROFILE_ZONE("BuildLodChain");
+
+    chain->num_lods = 1;
+    chain->lods[0] = {first_index, num_indices, 0.0f};
+
+    glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+    for (Uint32 i = first_index; i < first_index + num_indices; i++) {
+        const float *p = &positions[(*indices)[i] * stride];
+        low = glm::min(low, glm::vec3(p[0], p[1], p[2]));
+        high = glm::max(high, glm::vec3(p[0], p[1], p[2]));
+    }
+    glm::vec3 extent = high - low;
+    float max_error =
+        kMaxLodError * std::max(extent.x, std::max(extent.y, extent.z));
+
+    std::vector<Uint32> previous(indices->begin() + first_index,
+                                 indices->begin() + first_index + num_indices);
+    std::vector<Uint32> simplified(previous.size());
+    float total_error = 0.0f;
+
+    while (chain->num_lods < kMaxMeshLods &&
+           previous.size() / 3 >= kMinLodTriangles) {
+        float error;
+        size_t target = previous.size() / 6 * 3;
+        size_t count = SimplifyMesh(simplified.data(), previous.data(),
+                                    previous.size(), positions, stride,
+                                    num_vertices, groups, target,
+                                    max_error - total_error, &error);
+        if (count == 0 || count > previous.size() * kMinLodReduction) {
+            break;
+        }
+
+        // Errors of successive LODs add up in the worst case.
+        total_error += error;
+
+        MeshLod &lod = chain->lods[chain->num_lods++];
+        lod.first_index = Uint32(indices->size());
+        lod.num_indices = Uint32(count);
+        lod.error = total_error;
+
+        indices->resize(indices->size() + count);
+        OptimizeVertexCache(&(*indices)[lod.first_index], simplified.data(),
+                            count, num_vertices);
+        previous.assign(simplified.begin(), simplified.begin() + count);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+const MeshLod &SelectLod(const MeshLodChain &chain, float pixels_per_unit)
+{
+    int selected = 0;
+    if (pixels_per_unit < FLT_MAX) {
+        while (selected + 1 < chain.num_lods &&
+               chain.lods[selected + 1].error * pixels_per_unit <=
+                   kLodPixelError) {
+            selected++;
+        }
+    }
+
+    return chain.lods[selected];
+}
+
+} // namespace sp
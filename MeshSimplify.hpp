@@ -0,0 +1,56 @@
+#ifndef _SP_MESH_SIMPLIFY_H_
+#define _SP_MESH_SIMPLIFY_H_
+
+#include <SDL2/SDL.h>
+#include <cfloat>
+#include <vector>
+
+namespace sp {
+
+const int kMaxMeshLods = 4;
+
+// A LOD drawn from an index buffer shared by all of a mesh's LODs. They
+// all use the full mesh's vertices, so only the index range changes.
+struct MeshLod {
+    Uint32 first_index;
+    Uint32 num_indices;
+    // How far the LOD's surface may lie from the full mesh's, in model
+    // units.
+    float error;
+};
+
+struct MeshLodChain {
+    int num_lods;
+    MeshLod lods[kMaxMeshLods];
+};
+
+// Collapses edges of an indexed triangle list in order of quadric error
+// until at most target_indices remain or the next collapse would move the
+// surface more than max_error model units. Collapses only move a vertex
+// onto a neighbour, so the result indexes the same vertices. Vertices on
+// open borders and UV seams, where several vertices share a position, stay
+// put; with groups, a vertex only collapses into one of the same group,
+// such as the joint that moves it most. positions holds three floats per
+// vertex, stride floats apart. Returns the index count and sets error to
+// the largest error taken. destination may alias indices.
+size_t SimplifyMesh(Uint32 *destination, const Uint32 *indices,
+                    size_t num_indices, const float *positions, size_t stride,
+                    size_t num_vertices, const Uint32 *groups,
+                    size_t target_indices, float max_error, float *error);
+
+// Appends LODs of about half the triangles of the previous one, each cache
+// optimized, to indices, which already holds the full mesh's num_indices
+// at first_index. Stops early once simplifying stops paying off. The full
+// mesh is the chain's first LOD.
+void BuildLodChain(Uint32 first_index, Uint32 num_indices,
+                   const float *positions, size_t stride, size_t num_vertices,
+                   const Uint32 *groups, std::vector<Uint32> *indices,
+                   MeshLodChain *chain);
+
+// The coarsest LOD whose error covers at most a pixel when one model unit
+// covers pixels_per_unit pixels. FLT_MAX picks the full mesh.
+const MeshLod &SelectLod(const MeshLodChain &chain, float pixels_per_unit);
+
+} // namespace sp
+
+#endif
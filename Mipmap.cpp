@@ -0,0 +1,120 @@
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SP_MIPMAP_SSE2
+#endif
+
+#include "Mipmap.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+
+//------------------------------------------------------------------------------
+
+static inline Uint8 Average(Uint8 a, Uint8 b)
+{
+    // Same rounding as _mm_avg_epu8.
+    return static_cast<Uint8>((a + b + 1) >> 1);
+}
+
+//------------------------------------------------------------------------------
+
+static void DownsampleRowScalar(const Uint8 *row0, const Uint8 *row1,
+                                int src_width, Uint8 *dst, int first,
+                                int last)
+{
+    for (int x = first; x < last; x++) {
+        int x0 = std::min(2 * x, src_width - 1) * 4;
+        int x1 = std::min(2 * x + 1, src_width - 1) * 4;
+
+        for (int c = 0; c < 4; c++) {
+            dst[x * 4 + c] = Average(Average(row0[x0 + c], row1[x0 + c]),
+                                     Average(row0[x1 + c], row1[x1 + c]));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void DownsampleBox(const Uint8 *src, int src_width, int src_height,
+                   int src_pitch, Uint8 *dst, int dst_width, int dst_height)
+{
+    for (int y = 0; y < dst_height; y++) {
+        const Uint8 *row0 = src + std::min(2 * y, src_height - 1) * src_pitch;
+        const Uint8 *row1 =
+            src + std::min(2 * y + 1, src_height - 1) * src_pitch;
+        Uint8 *dst_row = dst + y * dst_width * 4;
+        int x = 0;
+
+#ifdef SP_MIPMAP_SSE2
+        // Four destination pixels from eight source pixels of both rows.
+        // Averaging the rows first and then the even and odd columns
+        // matches the scalar rounding.
+        if (src_width >= 2) {
+            for (; x + 4 <= dst_width; x += 4) {
+                const __m128i *src0 =
+                    reinterpret_cast<const __m128i *>(row0 + x * 8);
+                const __m128i *src1 =
+                    reinterpret_cast<const __m128i *>(row1 + x * 8);
+
+                __m128i low = _mm_avg_epu8(_mm_loadu_si128(src0),
+                                           _mm_loadu_si128(src1));
+                __m128i high = _mm_avg_epu8(_mm_loadu_si128(src0 + 1),
+                                            _mm_loadu_si128(src1 + 1));
+
+                __m128 low_ps = _mm_castsi128_ps(low);
+                __m128 high_ps = _mm_castsi128_ps(high);
+                __m128i even = _mm_castps_si128(
+                    _mm_shuffle_ps(low_ps, high_ps, _MM_SHUFFLE(2, 0, 2, 0)));
+                __m128i odd = _mm_castps_si128(
+                    _mm_shuffle_ps(low_ps, high_ps, _MM_SHUFFLE(3, 1, 3, 1)));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst_row + x * 4),
+                                 _mm_avg_epu8(even, odd));
+            }
+        }
+#endif
+
+        DownsampleRowScalar(row0, row1, src_width, dst_row, x, dst_width);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void GenerateMipChain(const Uint8 *pixels, int width, int height, int pitch,
+                      int max_levels, std::vector<MipLevel> *levels)
+{
+    SP_PROFILE_ZONE("GenerateMipChain");
+
+    levels->clear();
+
+    const Uint8 *src = pixels;
+    int src_width = width;
+    int src_height = height;
+    int src_pitch = pitch;
+
+    for (int level = 1; level < max_levels; level++) {
+        if (src_width == 1 && src_height == 1) {
+            break;
+        }
+
+        MipLevel mip;
+        mip.width = std::max(src_width / 2, 1);
+        mip.height = std::max(src_height / 2, 1);
+        mip.pixels.resize(mip.width * mip.height * 4);
+
+        DownsampleBox(src, src_width, src_height, src_pitch, mip.pixels.data(),
+                      mip.width, mip.height);
+        levels->push_back(std::move(mip));
+
+        const MipLevel &last = levels->back();
+        src = last.pixels.data();
+        src_width = last.width;
+        src_height = last.height;
+        src_pitch = last.width * 4;
+    }
+}
+
+} // namespace sp
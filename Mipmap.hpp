@@ -0,0 +1,29 @@
+#ifndef _SP_MIPMAP_H_
+#define _SP_MIPMAP_H_
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+namespace sp {
+
+// Tightly packed RGBA8 image.
+struct MipLevel {
+    int width;
+    int height;
+    std::vector<Uint8> pixels;
+};
+
+// Halves an RGBA8 image with a 2x2 box filter. Odd sizes round down, the
+// last row or column is dropped. Uses SSE2 where available, the scalar path
+// rounds the same way so both give identical results.
+void DownsampleBox(const Uint8 *src, int src_width, int src_height,
+                   int src_pitch, Uint8 *dst, int dst_width, int dst_height);
+
+// Fills levels with the mips below a width x height RGBA8 image down to
+// 1x1, so that the chain including the base image has at most max_levels.
+void GenerateMipChain(const Uint8 *pixels, int width, int height, int pitch,
+                      int max_levels, std::vector<MipLevel> *levels);
+
+} // namespace sp
+
+#endif
@@ -0,0 +1,341 @@
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SP_POSE_SSE2
+#endif
+
+#include "Pose.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+
+//------------------------------------------------------------------------------
+
+void JointPose::Resize(int joints)
+{
+    num_joints = joints;
+    stride = (joints + 3) & ~3;
+    channels.assign(kNumChannels * stride, 0.0f);
+
+    for (Channel channel : {kRotateW, kScaleX, kScaleY, kScaleZ}) {
+        float *values = Get(channel);
+        for (int i = 0; i < stride; i++) {
+            values[i] = 1.0f;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void JointPose::Set(int joint, const glm::vec3 &translate,
+                    const glm::quat &rotate, const glm::vec3 &scale)
+{
+    Get(kTranslateX)[joint] = translate.x;
+    Get(kTranslateY)[joint] = translate.y;
+    Get(kTranslateZ)[joint] = translate.z;
+    Get(kRotateX)[joint] = rotate.x;
+    Get(kRotateY)[joint] = rotate.y;
+    Get(kRotateZ)[joint] = rotate.z;
+    Get(kRotateW)[joint] = rotate.w;
+    Get(kScaleX)[joint] = scale.x;
+    Get(kScaleY)[joint] = scale.y;
+    Get(kScaleZ)[joint] = scale.z;
+}
+
+//------------------------------------------------------------------------------
+
+struct PoseChannels {
+    const float *channel[JointPose::kNumChannels];
+
+    explicit PoseChannels(const JointPose &pose)
+    {
+        for (int i = 0; i < JointPose::kNumChannels; i++) {
+            channel[i] = pose.Get(JointPose::Channel(i));
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+
+static void BlendScalar(const PoseChannels &from, const PoseChannels &to,
+                        float t, float *const *out, int first, int last)
+{
+    for (int i = first; i < last; i++) {
+        for (int c : {JointPose::kTranslateX, JointPose::kTranslateY,
+                      JointPose::kTranslateZ, JointPose::kScaleX,
+                      JointPose::kScaleY, JointPose::kScaleZ}) {
+            out[c][i] = from.channel[c][i] +
+                        (to.channel[c][i] - from.channel[c][i]) * t;
+        }
+
+        float dot = 0.0f;
+        for (int c = JointPose::kRotateX; c <= JointPose::kRotateW; c++) {
+            dot += from.channel[c][i] * to.channel[c][i];
+        }
+        float sign = dot < 0.0f ? -1.0f : 1.0f;
+
+        float rotate[4];
+        float length = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            float a = from.channel[JointPose::kRotateX + c][i];
+            float b = to.channel[JointPose::kRotateX + c][i] * sign;
+            rotate[c] = a + (b - a) * t;
+            length += rotate[c] * rotate[c];
+        }
+
+        float scale = length > 0.0f ? 1.0f / std::sqrt(length) : 0.0f;
+        for (int c = 0; c < 4; c++) {
+            out[JointPose::kRotateX + c][i] = rotate[c] * scale;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void BlendPoses(const JointPose &from, const JointPose &to, float t,
+                JointPose *out)
+{
+    SP_PROFILE_ZONE("BlendPoses");
+
+    if (out->GetNumJoints() != from.GetNumJoints()) {
+        out->Resize(from.GetNumJoints());
+    }
+
+    PoseChannels a(from);
+    PoseChannels b(to);
+    float *result[JointPose::kNumChannels];
+    for (int c = 0; c < JointPose::kNumChannels; c++) {
+        result[c] = out->Get(JointPose::Channel(c));
+    }
+
+    int i = 0;
+    int stride = from.GetStride();
+
+#ifdef SP_POSE_SSE2
+    const __m128 weight = _mm_set1_ps(t);
+    const __m128 sign_bit = _mm_set1_ps(-0.0f);
+
+    for (; i < stride; i += 4) {
+        for (int c : {JointPose::kTranslateX, JointPose::kTranslateY,
+                      JointPose::kTranslateZ, JointPose::kScaleX,
+                      JointPose::kScaleY, JointPose::kScaleZ}) {
+            __m128 x = _mm_loadu_ps(a.channel[c] + i);
+            __m128 y = _mm_loadu_ps(b.channel[c] + i);
+            _mm_storeu_ps(result[c] + i,
+                          _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(y, x), weight)));
+        }
+
+        __m128 qa[4], qb[4];
+        __m128 dot = _mm_setzero_ps();
+        for (int c = 0; c < 4; c++) {
+            qa[c] = _mm_loadu_ps(a.channel[JointPose::kRotateX + c] + i);
+            qb[c] = _mm_loadu_ps(b.channel[JointPose::kRotateX + c] + i);
+            dot = _mm_add_ps(dot, _mm_mul_ps(qa[c], qb[c]));
+        }
+
+        // Flip the target of joints whose rotations are more than half a
+        // turn apart, so the blend takes the shorter way round.
+        __m128 flip = _mm_and_ps(dot, sign_bit);
+        __m128 length = _mm_setzero_ps();
+        for (int c = 0; c < 4; c++) {
+            __m128 y = _mm_xor_ps(qb[c], flip);
+            qa[c] = _mm_add_ps(qa[c], _mm_mul_ps(_mm_sub_ps(y, qa[c]), weight));
+            length = _mm_add_ps(length, _mm_mul_ps(qa[c], qa[c]));
+        }
+
+        __m128 valid = _mm_cmpgt_ps(length, _mm_setzero_ps());
+        __m128 scale = _mm_and_ps(
+            valid, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(length)));
+        for (int c = 0; c < 4; c++) {
+            _mm_storeu_ps(result[JointPose::kRotateX + c] + i,
+                          _mm_mul_ps(qa[c], scale));
+        }
+    }
+#endif
+
+    BlendScalar(a, b, t, result, i, stride);
+}
+
+//------------------------------------------------------------------------------
+
+// Plain loops over the channel arrays, which the compiler vectorizes well
+// enough for the few layers a character has.
+void AddPose(const JointPose &base, const JointPose &additive,
+             const JointPose &reference, float weight, JointPose *out)
+{
+    SP_PROFILE_ZONE("AddPose");
+
+    if (out->GetNumJoints() != base.GetNumJoints()) {
+        out->Resize(base.GetNumJoints());
+    }
+
+    PoseChannels b(base);
+    PoseChannels a(additive);
+    PoseChannels r(reference);
+    float *result[JointPose::kNumChannels];
+    for (int c = 0; c < JointPose::kNumChannels; c++) {
+        result[c] = out->Get(JointPose::Channel(c));
+    }
+
+    int stride = base.GetStride();
+
+    for (int c = JointPose::kTranslateX; c <= JointPose::kTranslateZ; c++) {
+        for (int i = 0; i < stride; i++) {
+            result[c][i] =
+                b.channel[c][i] + (a.channel[c][i] - r.channel[c][i]) * weight;
+        }
+    }
+
+    for (int c = JointPose::kScaleX; c <= JointPose::kScaleZ; c++) {
+        for (int i = 0; i < stride; i++) {
+            float ratio = r.channel[c][i] != 0.0f
+                              ? a.channel[c][i] / r.channel[c][i]
+                              : 1.0f;
+            result[c][i] = b.channel[c][i] * (1.0f + (ratio - 1.0f) * weight);
+        }
+    }
+
+    for (int i = 0; i < stride; i++) {
+        glm::quat base_rotate(b.channel[JointPose::kRotateW][i],
+                              b.channel[JointPose::kRotateX][i],
+                              b.channel[JointPose::kRotateY][i],
+                              b.channel[JointPose::kRotateZ][i]);
+        glm::quat add_rotate(a.channel[JointPose::kRotateW][i],
+                             a.channel[JointPose::kRotateX][i],
+                             a.channel[JointPose::kRotateY][i],
+                             a.channel[JointPose::kRotateZ][i]);
+        glm::quat ref_rotate(r.channel[JointPose::kRotateW][i],
+                             r.channel[JointPose::kRotateX][i],
+                             r.channel[JointPose::kRotateY][i],
+                             r.channel[JointPose::kRotateZ][i]);
+
+        // Delta from the reference, nlerped from identity by the weight.
+        glm::quat delta = glm::conjugate(ref_rotate) * add_rotate;
+        if (delta.w < 0.0f) {
+            delta = -delta;
+        }
+        delta = glm::quat(1.0f + (delta.w - 1.0f) * weight, delta.x * weight,
+                          delta.y * weight, delta.z * weight);
+
+        glm::quat rotate = base_rotate * delta;
+        float length = glm::dot(rotate, rotate);
+        if (length > 0.0f) {
+            rotate = rotate * (1.0f / std::sqrt(length));
+        }
+
+        result[JointPose::kRotateX][i] = rotate.x;
+        result[JointPose::kRotateY][i] = rotate.y;
+        result[JointPose::kRotateZ][i] = rotate.z;
+        result[JointPose::kRotateW][i] = rotate.w;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Same as glm::translate(t) * glm::mat4_cast(r) * glm::scale(s).
+static void LocalMatrixScalar(const PoseChannels &pose, glm::mat4 *matrices,
+                              int first, int last)
+{
+    for (int i = first; i < last; i++) {
+        float x = pose.channel[JointPose::kRotateX][i];
+        float y = pose.channel[JointPose::kRotateY][i];
+        float z = pose.channel[JointPose::kRotateZ][i];
+        float w = pose.channel[JointPose::kRotateW][i];
+        float sx = pose.channel[JointPose::kScaleX][i];
+        float sy = pose.channel[JointPose::kScaleY][i];
+        float sz = pose.channel[JointPose::kScaleZ][i];
+
+        glm::mat4 &m = matrices[i];
+        m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z),
+                         2.0f * (x * z - w * y), 0.0f) * sx;
+        m[1] = glm::vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z),
+                         2.0f * (y * z + w * x), 0.0f) * sy;
+        m[2] = glm::vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x),
+                         1.0f - 2.0f * (x * x + y * y), 0.0f) * sz;
+        m[3] = glm::vec4(pose.channel[JointPose::kTranslateX][i],
+                         pose.channel[JointPose::kTranslateY][i],
+                         pose.channel[JointPose::kTranslateZ][i], 1.0f);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void BuildSkinningPalette(const JointPose &pose, const int *parents,
+                          const glm::mat4 *inverse_bind, glm::mat4 *world,
+                          glm::mat4 *palette)
+{
+    SP_PROFILE_ZONE("BuildSkinningPalette");
+
+    PoseChannels p(pose);
+    int num_joints = pose.GetNumJoints();
+    int i = 0;
+
+#ifdef SP_POSE_SSE2
+    // Four joints' matrices computed side by side, then transposed so each
+    // register holds one column of one joint.
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    for (; i + 4 <= num_joints; i += 4) {
+        __m128 x = _mm_loadu_ps(p.channel[JointPose::kRotateX] + i);
+        __m128 y = _mm_loadu_ps(p.channel[JointPose::kRotateY] + i);
+        __m128 z = _mm_loadu_ps(p.channel[JointPose::kRotateZ] + i);
+        __m128 w = _mm_loadu_ps(p.channel[JointPose::kRotateW] + i);
+        __m128 sx = _mm_loadu_ps(p.channel[JointPose::kScaleX] + i);
+        __m128 sy = _mm_loadu_ps(p.channel[JointPose::kScaleY] + i);
+        __m128 sz = _mm_loadu_ps(p.channel[JointPose::kScaleZ] + i);
+
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y);
+        __m128 zz = _mm_mul_ps(z, z), xy = _mm_mul_ps(x, y);
+        __m128 xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y);
+        __m128 wz = _mm_mul_ps(w, z);
+
+        __m128 columns[4][4];
+        columns[0][0] = _mm_mul_ps(
+            _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+        columns[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+        columns[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+        columns[0][3] = _mm_setzero_ps();
+
+        columns[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+        columns[1][1] = _mm_mul_ps(
+            _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+        columns[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+        columns[1][3] = _mm_setzero_ps();
+
+        columns[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+        columns[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+        columns[2][2] = _mm_mul_ps(
+            _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+        columns[2][3] = _mm_setzero_ps();
+
+        columns[3][0] = _mm_loadu_ps(p.channel[JointPose::kTranslateX] + i);
+        columns[3][1] = _mm_loadu_ps(p.channel[JointPose::kTranslateY] + i);
+        columns[3][2] = _mm_loadu_ps(p.channel[JointPose::kTranslateZ] + i);
+        columns[3][3] = one;
+
+        for (int c = 0; c < 4; c++) {
+            _MM_TRANSPOSE4_PS(columns[c][0], columns[c][1], columns[c][2],
+                              columns[c][3]);
+            for (int j = 0; j < 4; j++) {
+                _mm_storeu_ps(&world[i + j][c][0], columns[c][j]);
+            }
+        }
+    }
+#endif
+
+    LocalMatrixScalar(p, world, i, num_joints);
+
+    // Parents come first, so theirs are already in model space.
+    for (i = 0; i < num_joints; i++) {
+        if (parents[i] >= 0) {
+            world[i] = world[parents[i]] * world[i];
+        }
+        palette[i] = world[i] * inverse_bind[i];
+    }
+}
+
+} // namespace sp
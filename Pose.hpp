@@ -0,0 +1,76 @@
+#ifndef _SP_POSE_H_
+#define _SP_POSE_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace sp {
+
+// Local transforms of a skeleton's joints, relative to their parents, as
+// one array per channel so the functions below work on four joints at a
+// time. Arrays are padded to a multiple of four joints with identity
+// transforms.
+class JointPose
+{
+public:
+    enum Channel {
+        kTranslateX,
+        kTranslateY,
+        kTranslateZ,
+        kRotateX,
+        kRotateY,
+        kRotateZ,
+        kRotateW,
+        kScaleX,
+        kScaleY,
+        kScaleZ,
+        kNumChannels
+    };
+
+    JointPose() : num_joints(0), stride(0) {}
+
+    // Resets every joint to identity.
+    void Resize(int num_joints);
+
+    void Set(int joint, const glm::vec3 &translate, const glm::quat &rotate,
+             const glm::vec3 &scale);
+
+    int GetNumJoints() const { return num_joints; }
+    int GetStride() const { return stride; }
+    float *Get(Channel channel) { return &channels[channel * stride]; }
+    const float *Get(Channel channel) const
+    {
+        return &channels[channel * stride];
+    }
+
+private:
+    int num_joints;
+    int stride;
+    std::vector<float> channels;
+};
+
+// Lerps translation and scale and nlerps rotation along the shorter arc.
+// Rotations come out normalized. All three poses have the same joints; out
+// may alias from or to.
+void BlendPoses(const JointPose &from, const JointPose &to, float t,
+                JointPose *out);
+
+// Adds the difference between additive and reference, scaled by weight, on
+// top of base: translations are offset, rotations and scales composed with
+// the weighted delta. out may alias base.
+void AddPose(const JointPose &base, const JointPose &additive,
+             const JointPose &reference, float weight, JointPose *out);
+
+// Turns a pose with unit rotations into the skinning palette: world is
+// filled with each joint's model space transform, palette with world times
+// the joint's inverse bind matrix. Parents must come before their children,
+// parents[i] is -1 for roots.
+void BuildSkinningPalette(const JointPose &pose, const int *parents,
+                          const glm::mat4 *inverse_bind, glm::mat4 *world,
+                          glm::mat4 *palette);
+
+} // namespace sp
+
+#endif
@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+namespace profiler
+{
+
+namespace
+{
+
+struct ZoneHistory {
+    ZoneHistory() : frame_ms{}, frame_calls{} {}
+
+    float frame_ms[kStatFrames];
+    int frame_calls[kStatFrames];
+};
+
+std::mutex registry_mutex;
+std::deque<std::string> zone_names;
+std::vector<std::unique_ptr<ThreadBuffer>> thread_buffers;
+
+thread_local ThreadBuffer *tls_buffer = nullptr;
+
+// Only touched by EndFrame and the stat queries on the main thread.
+std::vector<ZoneHistory> zone_history;
+std::vector<float> current_ms;
+std::vector<int> current_calls;
+std::vector<ThreadBuffer *> drain_buffers;
+int frame_index = 0;
+int frames_recorded = 0;
+
+// Trace capture, also main thread only.
+struct CapturedEvent {
+    unsigned long long start;
+    unsigned long long end;
+    ZoneId zone;
+    int thread_id;
+};
+
+std::vector<CapturedEvent> captured_events;
+std::vector<unsigned long long> captured_frames;
+std::string capture_path;
+int capture_frames = 0;
+int capture_frames_left = 0;
+bool capture_pending = false;
+
+unsigned long long base_ticks = 0;
+std::chrono::steady_clock::time_point base_time;
+double ms_per_tick = 0.0;
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+ZoneId RegisterZone(const char *name)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    for (size_t i = 0; i < zone_names.size(); i++) {
+        if (zone_names[i] == name) {
+            return static_cast<ZoneId>(i);
+        }
+    }
+
+    zone_names.push_back(name);
+    return static_cast<ZoneId>(zone_names.size() - 1);
+}
+
+//------------------------------------------------------------------------------
+
+ThreadBuffer *GetThreadBuffer()
+{
+    if (!tls_buffer) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        thread_buffers.emplace_back(new ThreadBuffer);
+        tls_buffer = thread_buffers.back().get();
+        tls_buffer->thread_id = static_cast<int>(thread_buffers.size() - 1);
+    }
+
+    return tls_buffer;
+}
+
+//------------------------------------------------------------------------------
+
+void SetThreadName(const char *name)
+{
+    ThreadBuffer *buffer = GetThreadBuffer();
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+}
+
+//------------------------------------------------------------------------------
+
+static void Calibrate()
+{
+    unsigned long long ticks = Now();
+    auto time = std::chrono::steady_clock::now();
+
+    if (base_ticks == 0) {
+        base_ticks = ticks;
+        base_time = time;
+        return;
+    }
+
+    double elapsed_ms =
+        std::chrono::duration<double, std::milli>(time - base_time).count();
+    if (ticks > base_ticks && elapsed_ms > 0.0) {
+        ms_per_tick = elapsed_ms / (ticks - base_ticks);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void WriteJSONString(FILE *file, const std::string &text)
+{
+    fputc('"', file);
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+//------------------------------------------------------------------------------
+
+static void WriteCapture()
+{
+    FILE *file = fopen(capture_path.c_str(), "w");
+    if (!file) {
+        log::ErrorLog("Profiler: can't open %s for writing\n",
+                      capture_path.c_str());
+        return;
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::string> thread_names;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        names.assign(zone_names.begin(), zone_names.end());
+        for (auto &buffer : thread_buffers) {
+            thread_names.push_back(buffer->name[0]
+                                       ? buffer->name
+                                       : "Thread " + std::to_string(
+                                                         buffer->thread_id));
+        }
+    }
+
+    // Timestamps are in microseconds from the start of the capture.
+    unsigned long long origin = captured_frames.front();
+    double us_per_tick = ms_per_tick * 1000.0;
+    auto to_us = [origin, us_per_tick](unsigned long long ticks) {
+        return ticks > origin ? (ticks - origin) * us_per_tick : 0.0;
+    };
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for (size_t i = 0; i < thread_names.size(); i++) {
+        fprintf(file,
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%zu,\"args\":{\"name\":",
+                i);
+        WriteJSONString(file, thread_names[i]);
+        fprintf(file, "}},\n");
+    }
+
+    for (size_t i = 0; i < captured_frames.size(); i++) {
+        fprintf(file,
+                "{\"name\":\"Frame %zu\",\"ph\":\"i\",\"s\":\"g\","
+                "\"pid\":1,\"tid\":0,\"ts\":%.3f},\n",
+                i, to_us(captured_frames[i]));
+    }
+
+    for (size_t i = 0; i < captured_events.size(); i++) {
+        const CapturedEvent &event = captured_events[i];
+        double start = to_us(event.start);
+
+        fprintf(file, "{\"name\":");
+        WriteJSONString(file, names[event.zone]);
+        fprintf(file,
+                ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                "\"dur\":%.3f}%s\n",
+                event.thread_id, start, to_us(event.end) - start,
+                i + 1 < captured_events.size() ? "," : "");
+    }
+
+    fprintf(file, "]}\n");
+    fclose(file);
+
+    log::InfoLog("Profiler: wrote %zu events over %zu frames to %s\n",
+                 captured_events.size(), captured_frames.size() - 1,
+                 capture_path.c_str());
+}
+
+//------------------------------------------------------------------------------
+
+void EndFrame()
+{
+    unsigned long long frame_end = Now();
+    Calibrate();
+
+    // GetThreadBuffer may grow thread_buffers from a worker at any time, so
+    // drain a copy of the pointers; the buffers themselves never move.
+    size_t num_zones;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        num_zones = zone_names.size();
+        drain_buffers.clear();
+        for (auto &buffer : thread_buffers) {
+            drain_buffers.push_back(buffer.get());
+        }
+    }
+
+    zone_history.resize(num_zones);
+    current_ms.assign(num_zones, 0.0f);
+    current_calls.assign(num_zones, 0);
+
+    for (ThreadBuffer *buffer : drain_buffers) {
+        unsigned int write =
+            buffer->write_index.load(std::memory_order_acquire);
+        unsigned int read = buffer->read_index;
+
+        // The writer lapped us, the oldest events are gone.
+        if (write - read > ThreadBuffer::kSize) {
+            read = write - ThreadBuffer::kSize;
+        }
+
+        for (; read != write; read++) {
+            const ZoneEvent &event =
+                buffer->events[read & (ThreadBuffer::kSize - 1)];
+            if (event.zone >= num_zones) {
+                continue;
+            }
+
+            current_ms[event.zone] +=
+                static_cast<float>((event.end - event.start) * ms_per_tick);
+            current_calls[event.zone]++;
+
+            if (capture_frames_left > 0) {
+                captured_events.push_back({event.start, event.end, event.zone,
+                                           buffer->thread_id});
+            }
+        }
+
+        buffer->read_index = write;
+    }
+
+    // Events drained here belong to the frame that just ended, so a capture
+    // requested during a frame starts with the next one.
+    if (capture_frames_left > 0) {
+        captured_frames.push_back(frame_end);
+        if (--capture_frames_left == 0) {
+            WriteCapture();
+            captured_events.clear();
+            captured_events.shrink_to_fit();
+            captured_frames.clear();
+        }
+    }
+
+    if (capture_pending) {
+        capture_pending = false;
+        capture_frames_left = capture_frames;
+        captured_frames.assign(1, frame_end);
+    }
+
+    // The first frame only establishes the tick rate.
+    if (ms_per_tick == 0.0) {
+        return;
+    }
+
+    for (size_t i = 0; i < num_zones; i++) {
+        zone_history[i].frame_ms[frame_index] = current_ms[i];
+        zone_history[i].frame_calls[frame_index] = current_calls[i];
+    }
+
+    frame_index = (frame_index + 1) % kStatFrames;
+    frames_recorded = std::min(frames_recorded + 1, kStatFrames);
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<ZoneStats> GetStats()
+{
+    std::vector<ZoneStats> stats;
+
+    for (size_t i = 0; i < zone_history.size(); i++) {
+        const ZoneHistory &history = zone_history[i];
+        ZoneStats zone = {"", 1e9f, 0.0f, 0.0f, 0.0f};
+        int total_calls = 0;
+
+        for (int f = 0; f < frames_recorded; f++) {
+            float ms = history.frame_ms[f];
+            zone.min_ms = std::min(zone.min_ms, ms);
+            zone.max_ms = std::max(zone.max_ms, ms);
+            zone.avg_ms += ms;
+            total_calls += history.frame_calls[f];
+        }
+
+        if (total_calls == 0) {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            zone.name = zone_names[i];
+        }
+        zone.avg_ms /= frames_recorded;
+        zone.calls = static_cast<float>(total_calls) / frames_recorded;
+        stats.push_back(zone);
+    }
+
+    std::sort(stats.begin(), stats.end(),
+              [](const ZoneStats &a, const ZoneStats &b) {
+                  return a.avg_ms > b.avg_ms;
+              });
+
+    return stats;
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<std::string> FormatStats()
+{
+    std::vector<std::string> lines;
+
+#ifndef SP_PROFILE
+    lines.push_back("profiler disabled, build with SP_PROFILE");
+#else
+    char line[128];
+    snprintf(line, sizeof(line), "%-24s %8s %8s %8s %6s", "zone", "min ms",
+             "avg ms", "max ms", "calls");
+    lines.push_back(line);
+
+    for (const ZoneStats &zone : GetStats()) {
+        snprintf(line, sizeof(line), "%-24.24s %8.3f %8.3f %8.3f %6.1f",
+                 zone.name.c_str(), zone.min_ms, zone.avg_ms, zone.max_ms,
+                 zone.calls);
+        lines.push_back(line);
+    }
+#endif
+
+    return lines;
+}
+
+//------------------------------------------------------------------------------
+
+bool StartCapture(int num_frames, const std::string &path)
+{
+#ifndef SP_PROFILE
+    log::ErrorLog("Profiler: disabled, build with SP_PROFILE to capture\n");
+    return false;
+#endif
+
+    if (IsCapturing()) {
+        log::ErrorLog("Profiler: a capture is already running\n");
+        return false;
+    }
+
+    if (num_frames <= 0) {
+        return false;
+    }
+
+    capture_frames = num_frames;
+    capture_path = path;
+    capture_pending = true;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool IsCapturing() { return capture_pending || capture_frames_left > 0; }
+
+} // namespace profiler
+} // namespace sp
@@ -0,0 +1,157 @@
+#ifndef _SP_PROFILER_H_
+#define _SP_PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Instrumentation zones. Build with SP_PROFILE defined to enable them, in
+// release builds the macros expand to nothing.
+//
+//   void Draw()
+//   {
+//       SP_PROFILE_ZONE("Draw");
+//       ...
+//   }
+
+#define SP_PROFILE_CONCAT_(a, b) a##b
+#define SP_PROFILE_CONCAT(a, b) SP_PROFILE_CONCAT_(a, b)
+
+#ifdef SP_PROFILE
+#define SP_PROFILE_ZONE(name)                                                  \
+    static const sp::profiler::ZoneId SP_PROFILE_CONCAT(                       \
+        sp_zone_id_, __LINE__) = sp::profiler::RegisterZone(name);             \
+    sp::profiler::ScopedZone SP_PROFILE_CONCAT(sp_zone_, __LINE__)(            \
+        SP_PROFILE_CONCAT(sp_zone_id_, __LINE__))
+#define SP_PROFILE_ZONE_ID(id)                                                 \
+    sp::profiler::ScopedZone SP_PROFILE_CONCAT(sp_zone_, __LINE__)(id)
+#define SP_PROFILE_END_FRAME() sp::profiler::EndFrame()
+#define SP_PROFILE_THREAD(name) sp::profiler::SetThreadName(name)
+#else
+#define SP_PROFILE_ZONE(name)
+#define SP_PROFILE_ZONE_ID(id)
+#define SP_PROFILE_END_FRAME()
+#define SP_PROFILE_THREAD(name)
+#endif
+
+namespace sp {
+namespace profiler {
+
+typedef unsigned short ZoneId;
+
+// Never returned by RegisterZone, events recorded against it are dropped.
+const ZoneId kNoZone = 0xffff;
+
+// Number of frames the min/avg/max statistics are computed over.
+const int kStatFrames = 120;
+
+struct ZoneEvent {
+    unsigned long long start;
+    unsigned long long end;
+    ZoneId zone;
+    unsigned short depth;
+};
+
+// Single producer, single consumer ring of finished zones. Each thread
+// writes its own, EndFrame drains them all on the main thread.
+struct ThreadBuffer {
+    static const unsigned int kSize = 1 << 16;
+
+    ThreadBuffer()
+        : write_index(0), read_index(0), depth(0), thread_id(0), name{}
+    {
+    }
+
+    ZoneEvent events[kSize];
+    std::atomic<unsigned int> write_index;
+    unsigned int read_index;
+    unsigned short depth;
+    int thread_id;
+    char name[32];
+};
+
+struct ZoneStats {
+    std::string name;
+    float min_ms;
+    float avg_ms;
+    float max_ms;
+    float calls; // average calls per frame
+};
+
+inline unsigned long long Now()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+// Zone names are deduplicated, registering the same name twice returns the
+// same id. Safe to call from any thread.
+ZoneId RegisterZone(const char *name);
+ThreadBuffer *GetThreadBuffer();
+
+// Label the calling thread gets in captured traces.
+void SetThreadName(const char *name);
+
+// Drains the thread buffers and folds them into the rolling statistics.
+// Call once per frame from the main thread.
+void EndFrame();
+
+// Rolling per-zone statistics, sorted by average time.
+std::vector<ZoneStats> GetStats();
+std::vector<std::string> FormatStats();
+
+// Records every zone of the next num_frames frames and writes them to path
+// as Chrome trace event JSON, viewable in chrome://tracing or Perfetto.
+// Returns false if a capture is already running.
+bool StartCapture(int num_frames, const std::string &path);
+bool IsCapturing();
+
+class ScopedZone
+{
+public:
+    explicit ScopedZone(ZoneId zone_id)
+        : buffer(GetThreadBuffer()), zone(zone_id), start(Now())
+    {
+        buffer->depth++;
+    }
+
+    ~ScopedZone()
+    {
+        unsigned long long end = Now();
+        unsigned int index =
+            buffer->write_index.load(std::memory_order_relaxed);
+        ZoneEvent &event = buffer->events[index & (ThreadBuffer::kSize - 1)];
+
+        event.start = start;
+        event.end = end;
+        event.zone = zone;
+        event.depth = --buffer->depth;
+
+        buffer->write_index.store(index + 1, std::memory_order_release);
+    }
+
+    ScopedZone(const ScopedZone &) = delete;
+    ScopedZone &operator=(const ScopedZone &) = delete;
+
+private:
+    ThreadBuffer *buffer;
+    ZoneId zone;
+    unsigned long long start;
+};
+
+} // namespace profiler
+} // namespace sp
+
+#endif
@@ -18,6 +18,7 @@
 #include "Renderer.hpp"
 #include "Shader.hpp"
 #include "Error.hpp"
+#include "Profiler.hpp"
 #include "Logger.hpp"
 
 namespace sp
@@ -87,6 +88,8 @@ void Renderer::Init()
 
 void Renderer::BeginFrame()
 {
+    SP_PROFILE_ZONE("BeginFrame");
+
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
@@ -100,7 +103,11 @@ void Renderer::BeginFrame()
 
 //------------------------------------------------------------------------------
 
-void Renderer::EndFrame() { SDL_GL_SwapWindow(window); }
+void Renderer::EndFrame()
+{
+    SP_PROFILE_ZONE("SwapWindow");
+    SDL_GL_SwapWindow(window);
+}
 
 //------------------------------------------------------------------------------
 
@@ -124,8 +131,11 @@ void Renderer::SetView(const glm::mat4 &view) { this->view = view; }
 
 void Renderer::LoadGlobalUniforms(GLuint shader_index)
 {
-    GLint uni_block_index =
-        glGetUniformBlockIndex(shader_index, "globalMatrices");
+    GLuint uni_block_index =
+        backend::GetUniformBlockIndex({shader_index}, "globalMatrices");
+    if (uni_block_index == GL_INVALID_INDEX) {
+        return;
+    }
     glUniformBlockBinding(shader_index, uni_block_index,
                           global_uniform_binding);
 }
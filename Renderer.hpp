@@ -34,6 +34,13 @@ public:
 
     glm::mat4 GetView() const { return view; }
 
+    // Pixels one world unit covers at distance in front of the camera, for
+    // picking mesh LODs.
+    float GetPixelsPerUnit(float distance) const
+    {
+        return projection[1][1] * screen_height * 0.5f / distance;
+    }
+
 private:
     SDL_Window *window;
     SDL_GLContext context;
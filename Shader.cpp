@@ -3,15 +3,15 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <fstream>
-#include <streambuf>
 #include <algorithm>
 #include <memory>
 #include <cassert>
+#include <cstddef>
+#include <unordered_map>
 
+#include "FileSystem.hpp"
 #include "Shader.hpp"
 #include "Logger.hpp"
-#include "Error.hpp"
 
 namespace sp
 {
@@ -19,27 +19,47 @@ namespace sp
 static std::string ReadFileToString(const char *file_name);
 static GLuint CreateShader(const char *shader_file_name, GLenum target);
 
+typedef std::vector<std::pair<std::string, GLenum>> ShaderFiles;
+
+// Source files of every program CreateProgram built, for ReloadPrograms.
+static std::unordered_map<GLuint, ShaderFiles> program_files;
+
+struct ReflectedUniform {
+    GLuint hash;
+    GLint location;
+    GLenum type;
+    GLint size;
+    std::string name;
+};
+
+struct ReflectedBlock {
+    GLuint hash;
+    GLuint index;
+    std::string name;
+};
+
+// Both sorted by hash. Names looked up but missing are added with location
+// -1 or GL_INVALID_INDEX, so they are only reported once.
+struct ProgramReflection {
+    std::vector<ReflectedUniform> uniforms;
+    std::vector<ReflectedBlock> blocks;
+};
+
+// Rebuilt whenever a program is linked, SetUniform reads only this.
+static std::unordered_map<GLuint, ProgramReflection> program_reflections;
+
 //------------------------------------------------------------------------------
 
 std::string ReadFileToString(const char *file_name)
 {
-    std::ifstream file(file_name);
+    vfs::File file;
 
-    if (!file.good()) {
+    if (!vfs::ReadFile(file_name, &file)) {
         log::ErrorLog("Error opening file %s\n", file_name);
         assert(false);
     }
 
-    std::string contents;
-    file.seekg(0, std::ios::end);
-    contents.reserve(file.tellg());
-    file.seekg(0, std::ios::beg);
-
-    // Extra parenthesis necessary for vexing parse
-    contents.assign((std::istreambuf_iterator<char>(file)),
-                    std::istreambuf_iterator<char>());
-
-    return contents;
+    return file.ToString();
 }
 
 //------------------------------------------------------------------------------
@@ -111,35 +131,127 @@ static GLuint LocalCreateProgram(const std::vector<GLuint> &kShaderList)
 
 //------------------------------------------------------------------------------
 
+template <typename T> static bool HashLess(const T &entry, GLuint hash)
+{
+    return entry.hash < hash;
+}
+
+//------------------------------------------------------------------------------
+
+static void ReflectProgram(GLuint program)
+{
+    ProgramReflection reflection;
+    GLchar name[256];
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+
+    for (GLint i = 0; i < count; i++) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, i, sizeof(name), nullptr, &size, &type,
+                           name);
+
+        // Uniform block members have no location.
+        GLint location = glGetUniformLocation(program, name);
+        if (location == -1) {
+            continue;
+        }
+
+        // Arrays are reported as "name[0]", either name finds them.
+        std::string base = name;
+        if (base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0) {
+            reflection.uniforms.push_back(
+                {HashUniformName(name), location, type, size, name});
+            base.resize(base.size() - 3);
+        }
+        reflection.uniforms.push_back(
+            {HashUniformName(base.c_str()), location, type, size, base});
+    }
+
+    count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    for (GLint i = 0; i < count; i++) {
+        glGetActiveUniformBlockName(program, i, sizeof(name), nullptr, name);
+        reflection.blocks.push_back({HashUniformName(name), GLuint(i), name});
+    }
+
+    auto by_hash = [](const auto &a, const auto &b) { return a.hash < b.hash; };
+    std::sort(reflection.uniforms.begin(), reflection.uniforms.end(), by_hash);
+    std::sort(reflection.blocks.begin(), reflection.blocks.end(), by_hash);
+
+    for (size_t i = 1; i < reflection.uniforms.size(); i++) {
+        if (reflection.uniforms[i].hash == reflection.uniforms[i - 1].hash) {
+            log::ErrorLog("Uniforms %s and %s of program %u hash the same\n",
+                          reflection.uniforms[i - 1].name.c_str(),
+                          reflection.uniforms[i].name.c_str(), program);
+        }
+    }
+
+    program_reflections[program] = std::move(reflection);
+}
+
+//------------------------------------------------------------------------------
+
 namespace backend
 {
-void SetVertAttribPointers()
-{
-    // Position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
-    // Normal
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (GLvoid *)(3 * sizeof(GLfloat)));
-    // Texcoord
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (GLvoid *)(10 * sizeof(GLfloat)));
-    // Tangent
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (GLvoid *)(6 * sizeof(GLfloat)));
-    // Blend Index
-    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(Vertex),
-                          (GLvoid *)(12 * sizeof(GLfloat)));
-    // Blend Weight
-    glVertexAttribPointer(
-        5, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(Vertex),
-        (GLvoid *)(12 * sizeof(GLfloat) + 4 * sizeof(GLubyte)));
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-    glEnableVertexAttribArray(5);
+// Location, size, type, normalized and offset of each attribute.
+struct VertexAttribLayout {
+    GLuint index;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    size_t offset;
+};
+
+#define SP_ATTRIB(index, size, type, normalized, vertex, member)               \
+    {index, size, type, normalized, offsetof(vertex, member)}
+
+static const VertexAttribLayout kFloatLayout[] = {
+    SP_ATTRIB(0, 3, GL_FLOAT, GL_FALSE, Vertex, position),
+    SP_ATTRIB(1, 3, GL_FLOAT, GL_FALSE, Vertex, normal),
+    SP_ATTRIB(2, 2, GL_FLOAT, GL_FALSE, Vertex, texcoord),
+    SP_ATTRIB(3, 4, GL_FLOAT, GL_FALSE, Vertex, tangent),
+    SP_ATTRIB(4, 4, GL_UNSIGNED_BYTE, GL_FALSE, Vertex, blendindex),
+    SP_ATTRIB(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, Vertex, blendweight),
+};
+
+static const VertexAttribLayout kPackedLayout[] = {
+    SP_ATTRIB(0, 3, GL_FLOAT, GL_FALSE, PackedVertex, position),
+    SP_ATTRIB(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, PackedVertex, normal),
+    SP_ATTRIB(2, 2, GL_HALF_FLOAT, GL_FALSE, PackedVertex, texcoord),
+    SP_ATTRIB(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, PackedVertex, tangent),
+    SP_ATTRIB(4, 4, GL_UNSIGNED_BYTE, GL_FALSE, PackedVertex, blendindex),
+    SP_ATTRIB(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, PackedVertex, blendweight),
+};
+
+static const VertexAttribLayout kQuantizedLayout[] = {
+    SP_ATTRIB(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, QuantizedVertex, position),
+    SP_ATTRIB(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, QuantizedVertex, normal),
+    SP_ATTRIB(2, 2, GL_HALF_FLOAT, GL_FALSE, QuantizedVertex, texcoord),
+    SP_ATTRIB(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, QuantizedVertex, tangent),
+    SP_ATTRIB(4, 4, GL_UNSIGNED_BYTE, GL_FALSE, QuantizedVertex, blendindex),
+    SP_ATTRIB(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, QuantizedVertex, blendweight),
+};
+
+#undef SP_ATTRIB
+
+void SetVertAttribPointers(VertexFormat format)
+{
+    const VertexAttribLayout *layout = kFloatLayout;
+    if (format == kVertexPacked) {
+        layout = kPackedLayout;
+    } else if (format == kVertexQuantized) {
+        layout = kQuantizedLayout;
+    }
+
+    GLsizei stride = GetVertexSize(format);
+    for (int i = 0; i < 6; i++) {
+        const VertexAttribLayout &attrib = layout[i];
+        glVertexAttribPointer(attrib.index, attrib.size, attrib.type,
+                              attrib.normalized, stride,
+                              (GLvoid *)attrib.offset);
+        glEnableVertexAttribArray(attrib.index);
+    }
 }
 
 GLProgram
@@ -147,14 +259,24 @@ CreateProgram(const std::vector<std::pair<const char *, GLenum>> &shader_pair)
 {
     GLProgram program;
     std::vector<GLuint> shaders;
+    ShaderFiles files;
     for (auto p : shader_pair) {
         shaders.push_back(CreateShader(p.first, p.second));
+        files.emplace_back(p.first, p.second);
     }
 
     program.id = LocalCreateProgram(shaders);
 
+    // Attached shaders live as long as the program.
+    for (GLuint shader : shaders) {
+        glDeleteShader(shader);
+    }
+
     if (program.id == 0) {
         std::cerr << "Invalid program\n";
+    } else {
+        program_files[program.id] = std::move(files);
+        ReflectProgram(program.id);
     }
 
     return program;
@@ -162,79 +284,407 @@ CreateProgram(const std::vector<std::pair<const char *, GLenum>> &shader_pair)
 
 void Bind(GLProgram program) { glUseProgram(program.id); }
 
-void SetUniform(GLProgram program, GLUniformType type, const char *name,
-                GLvoid *data)
+void SetUniform(GLProgram program, GLUniformType type, UniformKey name,
+                const GLvoid *data)
 {
     SetUniform(program, type, name, 1, data);
 }
 
-inline GLint GetGLUniformLocation(GLProgram program, const char *name)
+//------------------------------------------------------------------------------
+
+GLint GetUniformLocation(GLProgram program, UniformKey name)
 {
-    glGetError();
-    GLint uniform = glGetUniformLocation(program.id, name);
-    GLenum error = glGetError();
-    if (error) {
-        log::ErrorLog("Error getting uniform %s from program %d\n", name,
-                      program.id);
-        HandleGLError(error);
+    std::vector<ReflectedUniform> &uniforms =
+        program_reflections[program.id].uniforms;
+    auto uniform = std::lower_bound(uniforms.begin(), uniforms.end(),
+                                    name.hash, HashLess<ReflectedUniform>);
+
+    if (uniform == uniforms.end() || uniform->hash != name.hash) {
+        log::ErrorLog("Program %u has no uniform %s\n", program.id,
+                      name.name);
+        uniform = uniforms.insert(uniform,
+                                  {name.hash, -1, GL_NONE, 0, name.name});
     }
 
-    return uniform;
+    return uniform->location;
 }
 
-void SetUniform(GLProgram program, GLUniformType type, const char *name,
+//------------------------------------------------------------------------------
+
+GLuint GetUniformBlockIndex(GLProgram program, UniformKey name)
+{
+    std::vector<ReflectedBlock> &blocks =
+        program_reflections[program.id].blocks;
+    auto block = std::lower_bound(blocks.begin(), blocks.end(), name.hash,
+                                  HashLess<ReflectedBlock>);
+
+    if (block == blocks.end() || block->hash != name.hash) {
+        log::ErrorLog("Program %u has no uniform block %s\n", program.id,
+                      name.name);
+        block = blocks.insert(block, {name.hash, GL_INVALID_INDEX, name.name});
+    }
+
+    return block->index;
+}
+
+//------------------------------------------------------------------------------
+
+void SetUniform(GLProgram program, GLUniformType type, UniformKey name,
                 const GLint data)
 {
-    Bind(program);
-    GLint uniform = GetGLUniformLocation(program, name);
+    GLint uniform = GetUniformLocation(program, name);
+    if (uniform == -1) {
+        return;
+    }
+
+    switch (type) {
+    case k1i:
+        glUniform1i(uniform, data);
+        break;
+    default:
+        std::cerr << "Invalid uniform type (" << name.name
+                  << ") for program id " << program.id << std::endl;
+        break;
+    }
+}
 
+//------------------------------------------------------------------------------
+
+void SetUniform(GLProgram program, GLUniformType type, UniformKey name,
+                GLsizei count, const GLvoid *data)
+{
+    GLint uniform = GetUniformLocation(program, name);
     if (uniform == -1) {
-        std::cerr << "Invalid uniform type (" << name << ") for program id "
-                  << program.id << std::endl;
-    } else {
-        switch (type) {
-        case k1i:
-            glUniform1i(uniform, data);
-            break;
-        default:
-            std::cerr << "Invalid uniform type (" << name << ") for program id "
-                      << program.id << std::endl;
-            break;
+        return;
+    }
+
+    switch (type) {
+    case k4fv:
+        glUniform4fv(uniform, count, (const GLfloat *)data);
+        break;
+    case k3fv:
+        glUniform3fv(uniform, count, (const GLfloat *)data);
+        break;
+    case k2fv:
+        glUniform2fv(uniform, count, (const GLfloat *)data);
+        break;
+    case kMatrix4fv:
+        glUniformMatrix4fv(uniform, count, GL_FALSE, (const GLfloat *)data);
+        break;
+    case kMatrix3x4fv:
+        glUniformMatrix3x4fv(uniform, count, GL_FALSE, (const GLfloat *)data);
+        break;
+    default:
+        std::cerr << "Invalid uniform type\n";
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void FreeGLProgram(GLProgram program)
+{
+    program_files.erase(program.id);
+    program_reflections.erase(program.id);
+    glDeleteProgram(program.id);
+}
+
+//------------------------------------------------------------------------------
+
+struct SavedUniform {
+    std::string name;
+    GLenum type;
+    std::vector<GLfloat> floats;
+    GLint value;
+};
+
+struct SavedBlock {
+    std::string name;
+    GLint binding;
+};
+
+//------------------------------------------------------------------------------
+
+static int GetFloatComponents(GLenum type)
+{
+    switch (type) {
+    case GL_FLOAT:
+        return 1;
+    case GL_FLOAT_VEC2:
+        return 2;
+    case GL_FLOAT_VEC3:
+        return 3;
+    case GL_FLOAT_VEC4:
+    case GL_FLOAT_MAT2:
+        return 4;
+    case GL_FLOAT_MAT2x3:
+    case GL_FLOAT_MAT3x2:
+        return 6;
+    case GL_FLOAT_MAT2x4:
+    case GL_FLOAT_MAT4x2:
+        return 8;
+    case GL_FLOAT_MAT3:
+        return 9;
+    case GL_FLOAT_MAT3x4:
+    case GL_FLOAT_MAT4x3:
+        return 12;
+    case GL_FLOAT_MAT4:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static bool IsIntUniform(GLenum type)
+{
+    switch (type) {
+    case GL_INT:
+    case GL_BOOL:
+    case GL_SAMPLER_1D:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_BUFFER:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Default block uniforms and block bindings are reset by glLinkProgram, and
+// most of them are only set once after creating the program.
+static void SaveUniforms(GLuint program, std::vector<SavedUniform> *uniforms,
+                         std::vector<SavedBlock> *blocks)
+{
+    GLchar name[256];
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+
+    for (GLint i = 0; i < count; i++) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, i, sizeof(name), nullptr, &size, &type,
+                           name);
+
+        int components = GetFloatComponents(type);
+        if (!components && !IsIntUniform(type)) {
+            continue;
+        }
+
+        // Arrays are reported once as "name[0]", each element has its own
+        // location.
+        std::string base = name;
+        if (base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0) {
+            base.resize(base.size() - 3);
+        }
+
+        for (GLint element = 0; element < size; element++) {
+            std::string element_name =
+                size > 1 ? base + "[" + std::to_string(element) + "]" : base;
+            GLint location = glGetUniformLocation(program,
+                                                  element_name.c_str());
+            // Uniform block members have no location.
+            if (location == -1) {
+                continue;
+            }
+
+            SavedUniform uniform = {element_name, type, {}, 0};
+            if (components) {
+                uniform.floats.resize(components);
+                glGetUniformfv(program, location, uniform.floats.data());
+            } else {
+                glGetUniformiv(program, location, &uniform.value);
+            }
+            uniforms->push_back(std::move(uniform));
         }
     }
+
+    count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    for (GLint i = 0; i < count; i++) {
+        SavedBlock block;
+        glGetActiveUniformBlockName(program, i, sizeof(name), nullptr, name);
+        glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_BINDING,
+                                  &block.binding);
+        block.name = name;
+        blocks->push_back(block);
+    }
 }
 
-void SetUniform(GLProgram program, GLUniformType type, const char *name,
-                GLsizei count, GLvoid *data)
+//------------------------------------------------------------------------------
+
+static void SetSavedUniform(GLint location, const SavedUniform &uniform)
 {
-    Bind(program);
-    GLint uniform = GetGLUniformLocation(program, name);
+    const GLfloat *v = uniform.floats.data();
+
+    switch (uniform.type) {
+    case GL_FLOAT:
+        glUniform1fv(location, 1, v);
+        break;
+    case GL_FLOAT_VEC2:
+        glUniform2fv(location, 1, v);
+        break;
+    case GL_FLOAT_VEC3:
+        glUniform3fv(location, 1, v);
+        break;
+    case GL_FLOAT_VEC4:
+        glUniform4fv(location, 1, v);
+        break;
+    case GL_FLOAT_MAT2:
+        glUniformMatrix2fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT2x3:
+        glUniformMatrix2x3fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT3x2:
+        glUniformMatrix3x2fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT2x4:
+        glUniformMatrix2x4fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT4x2:
+        glUniformMatrix4x2fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT3:
+        glUniformMatrix3fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT3x4:
+        glUniformMatrix3x4fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT4x3:
+        glUniformMatrix4x3fv(location, 1, GL_FALSE, v);
+        break;
+    case GL_FLOAT_MAT4:
+        glUniformMatrix4fv(location, 1, GL_FALSE, v);
+        break;
+    default:
+        glUniform1i(location, uniform.value);
+        break;
+    }
+}
 
-    if (uniform == -1) {
-        std::cerr << "Invalid uniform type (" << name << ") for shader id "
-                  << program.id << std::endl;
-    } else {
-        switch (type) {
-        case k4fv:
-            glUniform4fv(uniform, count, (GLfloat *)data);
-            break;
-        case k2fv:
-            glUniform2fv(uniform, count, (GLfloat *)data);
-            break;
-        case kMatrix4fv:
-            glUniformMatrix4fv(uniform, count, GL_FALSE, (GLfloat *)data);
-            break;
-        case kMatrix3x4fv:
-            glUniformMatrix3x4fv(uniform, count, GL_FALSE, (GLfloat *)data);
-            break;
-        default:
-            std::cerr << "Invalid uniform type\n";
-            break;
+//------------------------------------------------------------------------------
+
+static void RestoreUniforms(GLuint program,
+                            const std::vector<SavedUniform> &uniforms,
+                            const std::vector<SavedBlock> &blocks)
+{
+    // Only uniforms that kept their name and type get their value back.
+    std::vector<SavedUniform> current;
+    std::vector<SavedBlock> current_blocks;
+    SaveUniforms(program, &current, &current_blocks);
+
+    std::unordered_map<std::string, GLenum> types;
+    for (const SavedUniform &uniform : current) {
+        types[uniform.name] = uniform.type;
+    }
+
+    glUseProgram(program);
+    for (const SavedUniform &uniform : uniforms) {
+        auto search = types.find(uniform.name);
+        if (search == types.end() || search->second != uniform.type) {
+            continue;
+        }
+        SetSavedUniform(glGetUniformLocation(program, uniform.name.c_str()),
+                        uniform);
+    }
+    glUseProgram(0);
+
+    for (const SavedBlock &block : blocks) {
+        GLuint index = glGetUniformBlockIndex(program, block.name.c_str());
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, block.binding);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static bool RelinkProgram(GLuint program, const ShaderFiles &files)
+{
+    std::vector<GLuint> shaders;
+    bool compiled = true;
+    for (const auto &file : files) {
+        GLuint shader = CreateShader(file.first.c_str(), file.second);
+        GLint status;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        compiled = compiled && status == GL_TRUE;
+        shaders.push_back(shader);
+    }
+
+    // Link a scratch program first, a broken edit keeps the old one running.
+    bool linked = false;
+    if (compiled) {
+        GLuint scratch = LocalCreateProgram(shaders);
+        GLint status;
+        glGetProgramiv(scratch, GL_LINK_STATUS, &status);
+        linked = status == GL_TRUE;
+        glDeleteProgram(scratch);
+    }
+
+    if (linked) {
+        std::vector<SavedUniform> uniforms;
+        std::vector<SavedBlock> blocks;
+        SaveUniforms(program, &uniforms, &blocks);
+
+        // The old shaders were flagged for deletion when they were attached.
+        GLuint attached[8];
+        GLsizei num_attached = 0;
+        glGetAttachedShaders(program, 8, &num_attached, attached);
+        for (GLsizei i = 0; i < num_attached; i++) {
+            glDetachShader(program, attached[i]);
         }
+        for (GLuint shader : shaders) {
+            glAttachShader(program, shader);
+        }
+        glLinkProgram(program);
+        ReflectProgram(program);
+
+        RestoreUniforms(program, uniforms, blocks);
     }
+
+    for (GLuint shader : shaders) {
+        glDeleteShader(shader);
+    }
+
+    return linked;
 }
 
-void FreeGLProgram(GLProgram program) { glDeleteProgram(program.id); }
+//------------------------------------------------------------------------------
+
+int ReloadPrograms(const std::string &shader_file)
+{
+    std::string path = vfs::NormalizePath(shader_file);
+    int num_reloaded = 0;
+
+    for (const auto &program : program_files) {
+        bool uses_file = std::any_of(
+            program.second.begin(), program.second.end(),
+            [&path](const std::pair<std::string, GLenum> &file) {
+                return vfs::NormalizePath(file.first) == path;
+            });
+        if (!uses_file) {
+            continue;
+        }
+
+        if (RelinkProgram(program.first, program.second)) {
+            log::InfoLog("Reloaded program %u\n", program.first);
+            num_reloaded++;
+        } else {
+            log::ErrorLog("Program %u keeps its old shaders, %s doesn't "
+                          "build\n",
+                          program.first, path.c_str());
+        }
+    }
+
+    return num_reloaded;
+}
 
 } // namespace backend
 } // namespace sp
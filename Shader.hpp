@@ -7,37 +7,66 @@
 #include <tuple>
 #include <string>
 
+#include "VertexFormat.hpp"
+
 namespace sp {
 
 enum GLUniformType{
     k1i,
     k4fv,
+    k3fv,
     k2fv,
     kMatrix4fv,
     kMatrix3x4fv,
 };
 
-struct Vertex {
-    GLfloat position[3];
-    GLfloat normal[3];
-    GLfloat tangent[4];
-    GLfloat texcoord[2];
-    GLubyte blendindex[4];
-    GLubyte blendweight[4];
-};
-
 struct GLProgram {
     GLuint id;
 };
 
+// FNV-1a. Usable in constant expressions, so names spelled out at the call
+// site are hashed by the compiler.
+constexpr GLuint HashUniformName(const char *name, GLuint hash = 2166136261u)
+{
+    return *name ? HashUniformName(name + 1,
+                                   (hash ^ GLubyte(*name)) * 16777619u)
+                 : hash;
+}
+
+// A uniform or uniform block name with its hash, looked up in the program's
+// reflection without touching GL. Declare hot ones constexpr.
+struct UniformKey {
+    constexpr UniformKey(const char *name)
+        : name(name), hash(HashUniformName(name))
+    {
+    }
+
+    const char *name;
+    GLuint hash;
+};
+
 namespace backend {
     void Bind(GLProgram);
     GLProgram CreateProgram(const std::vector<std::pair<const char*, GLenum>> &shader_pair);
-    void SetUniform(GLProgram program, GLUniformType type, const char *name, GLvoid *data);
-    void SetUniform(GLProgram program, GLUniformType type, const char *name, GLsizei count, GLvoid *data);
-    void SetUniform(GLProgram program, GLUniformType type, const char *name, const GLint data);
+    // Sets a uniform of the bound program; SetUniform doesn't bind it.
+    void SetUniform(GLProgram program, GLUniformType type, UniformKey name, const GLvoid *data);
+    void SetUniform(GLProgram program, GLUniformType type, UniformKey name, GLsizei count, const GLvoid *data);
+    void SetUniform(GLProgram program, GLUniformType type, UniformKey name, const GLint data);
     void FreeGLProgram(GLProgram program);
-    void SetVertAttribPointers();
+
+    // Looked up in the uniforms and blocks reflected when the program was
+    // linked. Names the program lacks give -1 and GL_INVALID_INDEX, and are
+    // reported once.
+    GLint GetUniformLocation(GLProgram program, UniformKey name);
+    GLuint GetUniformBlockIndex(GLProgram program, UniformKey name);
+
+    // Rebuilds the programs using shader_file in place, keeping their ids,
+    // uniform values and block bindings. A program whose new source doesn't
+    // build keeps the old one. Returns the number of programs rebuilt.
+    int ReloadPrograms(const std::string &shader_file);
+    // Points and enables the attributes of format at offset 0 of the bound
+    // array buffer.
+    void SetVertAttribPointers(VertexFormat format = kVertexFloat);
 }
 
 } // namespace sp
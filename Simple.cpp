@@ -2,10 +2,70 @@
 #include "Simple.hpp"
 #include "Geometry.hpp"
 #include "Asset.hpp"
+#include "CoroutineTask.hpp"
+#include "FileSystem.hpp"
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+static const char *const kIqmModelPath = "assets/models/mrfixit/mrfixit.iqm";
+
+// Uniforms set on every draw, hashed at compile time.
+static constexpr sp::UniformKey kModelMatrix = "model_matrix";
+static constexpr sp::UniformKey kMvMatrix = "mv_matrix";
+static constexpr sp::UniformKey kIsRigged = "is_rigged";
+static constexpr sp::UniformKey kBoneOffset = "bone_offset";
+static constexpr sp::UniformKey kPositionScale = "position_scale";
+static constexpr sp::UniformKey kPositionBias = "position_bias";
+
+// Parses an IQM model on a worker and uploads it over the following frames
+// instead of stalling startup. The finished model is handed over through
+// result, which the main loop swaps in between frames.
+class IQMLoadTask : public sp::CoroutineTask
+{
+public:
+    IQMLoadTask(int type, sp::JobSystem &jobs,
+                std::unique_ptr<sp::IQMModel> &result, const std::string &path)
+        : CoroutineTask(type), jobSystem(jobs), loadedModel(result),
+          iqmModel(new sp::IQMModel), filePath(path)
+    {
+    }
+
+protected:
+    sp::TaskRoutine Run() override
+    {
+        Uint32 start = SDL_GetTicks();
+        bool loaded = false;
+
+        co_await sp::RunOnWorker(jobSystem, [this, &loaded]() {
+            loaded = iqmModel->LoadFile(filePath.c_str());
+        });
+
+        if (!loaded || !iqmModel->Upload()) {
+            sp::log::ErrorLog("Failed to load %s\n", filePath.c_str());
+            co_return;
+        }
+
+        // Don't report the model as loaded before the driver is done with it.
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        co_await sp::WaitForFence(fence);
+        glDeleteSync(fence);
+
+        loadedModel = std::move(iqmModel);
+        sp::log::InfoLog("Loaded %s in %u ms\n", filePath.c_str(),
+                         SDL_GetTicks() - start);
+    }
+
+private:
+    sp::JobSystem &jobSystem;
+    std::unique_ptr<sp::IQMModel> &loadedModel;
+    std::unique_ptr<sp::IQMModel> iqmModel;
+    std::string filePath;
+};
 
 void SimpleGame::Initialize()
 {
     renderer.Init();
+    skinning.Init();
     Init();
 }
 
@@ -30,14 +90,89 @@ void SimpleGame::Run()
     sp::CommandManager::AddCommand("fov", [&](const sp::CommandArg &args) {
         renderer.SetAngleOfView(args.GetAs<float>(1));
     });
+    sp::CommandManager::AddCommand(
+        "task_budget", [&](const sp::CommandArg &args) {
+            taskManager.SetFrameBudget(args.GetAs<float>(1));
+        });
+    sp::CommandManager::AddCommand("prof", [&](const sp::CommandArg &args) {
+        for (const std::string &line : sp::profiler::FormatStats()) {
+            console.Print(line);
+            sp::log::InfoLog("%s\n", line.c_str());
+        }
+    });
+    sp::CommandManager::AddCommand(
+        "tex_stats", [&](const sp::CommandArg &args) {
+            sp::TextureStats stats = sp::GetTextureStats();
+            char line[128];
+            snprintf(line, sizeof(line),
+                     "%d textures (%d unused), %.1f / %.1f MB, hits %llu, "
+                     "misses %llu, evictions %llu",
+                     stats.num_textures, stats.num_unreferenced,
+                     stats.resident_bytes / (1024.0f * 1024.0f),
+                     stats.budget_bytes / (1024.0f * 1024.0f),
+                     (unsigned long long)stats.hits,
+                     (unsigned long long)stats.misses,
+                     (unsigned long long)stats.evictions);
+            console.Print(line);
+        });
+    sp::CommandManager::AddCommand(
+        "tex_budget", [&](const sp::CommandArg &args) {
+            sp::SetTextureBudget(args.GetAs<size_t>(1) * 1024 * 1024);
+        });
+    // anim [clip] [fade seconds], lists the clips without arguments.
+    sp::CommandManager::AddCommand("anim", [&](const sp::CommandArg &args) {
+        if (!iqmModel) {
+            return;
+        }
+        const sp::SkeletalAnimation &animation = iqmModel->GetAnimation();
+        if (args.Argc() < 2) {
+            for (int i = 0; i < animation.GetNumClips(); i++) {
+                console.Print(animation.GetClip(i).name);
+            }
+            return;
+        }
+
+        int clip = animation.FindClip(args.GetArg(1));
+        if (clip < 0) {
+            console.Print("No clip called " + args.GetArg(1));
+            return;
+        }
+        float fade = args.Argc() > 2 ? args.GetAs<float>(2) : 0.2f;
+        iqmModel->GetAnimator().Play(clip, fade);
+    });
+    // anim_layer <layer> <clip> <weight>, a clip of "-" turns it off.
+    sp::CommandManager::AddCommand(
+        "anim_layer", [&](const sp::CommandArg &args) {
+            if (!iqmModel || args.Argc() < 3) {
+                return;
+            }
+            int clip = iqmModel->GetAnimation().FindClip(args.GetArg(2));
+            float weight = args.Argc() > 3 ? args.GetAs<float>(3) : 1.0f;
+            iqmModel->GetAnimator().SetAdditiveLayer(args.GetAs<int>(1), clip,
+                                                      weight);
+        });
+    sp::CommandManager::AddCommand("trace", [&](const sp::CommandArg &args) {
+        int frames = args.Argc() > 1 ? args.GetAs<int>(1) : 120;
+        std::string path = args.Argc() > 2 ? args.GetArg(2) : "trace.json";
+        if (sp::profiler::StartCapture(frames, path)) {
+            console.Print("Capturing " + std::to_string(frames) +
+                          " frames to " + path);
+        } else {
+            console.Print("Can't start capture, see log");
+        }
+    });
 
     float gunRotTime = 0.0f;
     bool leftMouseButtonDown = false;
 
     while (!quit) {
+        // Drains the previous frame, whose Frame zone has closed by now. A
+        // zone still open during EndFrame is counted in the next frame.
+        SP_PROFILE_END_FRAME();
+        SP_PROFILE_ZONE("Frame");
+
         delta = (SDL_GetTicks() - elapsed) / 1000.0f;
         elapsed = SDL_GetTicks();
-        animate += 10.0f * delta;
 
         SDL_StartTextInput();
         while (SDL_PollEvent(&sdl_event)) {
@@ -94,8 +229,6 @@ void SimpleGame::Run()
         }
         SDL_StopTextInput();
 
-        console.Update(delta);
-
         if (leftMouseButtonDown) {
             gunRotTime += delta;
             modelViews[gunModel].rot =
@@ -151,7 +284,16 @@ void SimpleGame::Run()
             gScreenCamera.pos = pModel.origin + glm::vec3(0.0f, 0.8f, 0.0f);
         }
 
+        taskManager.UpdateProcesses(static_cast<Uint32>(delta * 1000.0f));
+
+        // No task touches the model outside of UpdateProcesses.
+        if (loadedIqmModel) {
+            iqmModel = std::move(loadedIqmModel);
+        }
+        ReloadChangedAssets();
+
         md5Model.Update(delta);
+        sp::PumpTextureUploads(2.0f);
         Display(delta);
     }
 }
@@ -205,52 +347,131 @@ void SimpleGame::Init()
 
     sysInfo.QuerySystemInformation();
 
+    SP_PROFILE_THREAD("Main");
+
+    // Leave one core for the main thread, which also helps out while waiting.
+    jobSystem.Init(sysInfo.num_cpus - 1);
+    taskManager.SetJobSystem(&jobSystem);
+    sp::SetTextureJobSystem(&jobSystem);
+    // Half of a 60Hz frame, the rest is left for rendering.
+    taskManager.SetFrameBudget(8.0f);
+
     InitializeProgram();
 
     iqmView.rot = glm::angleAxis(90.0f, glm::vec3(0, 1, 0));
 
     glm::mat4 model;
+    sp::backend::Bind(programs[modelProgram]);
     sp::backend::SetUniform(programs[modelProgram], sp::kMatrix4fv,
-                            "model_matrix", glm::value_ptr(model));
-    iqmModel.LoadModel("assets/models/mrfixit/mrfixit.iqm");
+                            kModelMatrix, glm::value_ptr(model));
 
     sp::MakeTexturedQuad(&plane);
     sp::MakeCube(&cube, false);
 
-    skyboxTexture = sp::MakeTexture("assets/textures/skybox_texture.jpg",
-                                    GL_TEXTURE_CUBE_MAP);
+    skyboxTexture = sp::RequestTexture("assets/textures/skybox_texture.jpg",
+                                       GL_TEXTURE_CUBE_MAP);
     glm::mat4 rotate_matrix = glm::scale(glm::mat4(), glm::vec3(300.0f));
+    sp::backend::Bind(programs[skyboxProgram]);
     sp::backend::SetUniform(programs[skyboxProgram], sp::kMatrix4fv,
                             "rotate_matrix", glm::value_ptr(rotate_matrix));
 
     planeTexture =
-        sp::MakeTexture("assets/textures/checker.tga", GL_TEXTURE_2D);
+        sp::RequestTexture("assets/textures/checker.tga", GL_TEXTURE_2D);
 
     glBindTexture(GL_TEXTURE_2D, planeTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glBindTexture(GL_TEXTURE_2D, 0);
 
     sp::MakeCube(&player, true);
     glm::vec4 player_color(0.0f, 1.0f, 1.0f, 1.0f);
 
+    sp::backend::Bind(programs[modelProgram]);
     sp::backend::SetUniform(programs[modelProgram], sp::k1i, "is_textured",
                             true);
-    sp::backend::SetUniform(programs[modelProgram], sp::k1i, "is_rigged", true);
+    sp::backend::SetUniform(programs[modelProgram], sp::k1i, "bone_palette",
+                            sp::kBonePaletteUnit);
+    sp::backend::Bind(programs[planeProgram]);
     sp::backend::SetUniform(programs[planeProgram], sp::k1i, "is_textured",
                             true);
+    glUseProgram(0);
 
     console.Init((float)renderer.GetWidth(), (float)renderer.GetHeight());
     sp::font::Init((float)renderer.GetWidth(), (float)renderer.GetHeight());
     textDef = sp::font::GetTextDef("SPFont.ttf");
 
     InitEntities();
+    InitTasks();
+
+    // Edits to files in a mounted pak aren't seen, it shadows the loose
+    // files.
+    if (fileWatcher.Init()) {
+        fileWatcher.WatchTree("assets");
+    }
+}
+
+void SimpleGame::InitTasks()
+{
+    auto loadTask = std::make_shared<IQMLoadTask>(
+        kTaskLoadModel, jobSystem, loadedIqmModel, kIqmModelPath);
+
+    // Skeletal animation is pure CPU work and can go to any worker, the
+    // console updates GUI uniforms so it has to stay on the GL thread.
+    auto animationTask =
+        std::make_shared<sp::FunctionTask>(kTaskAnimation,
+                                           [this](Uint32 deltaMs) {
+            if (iqmModel) {
+                iqmModel->Animate(deltaMs / 1000.0f);
+            }
+        });
+
+    taskManager.SetTypeName(kTaskAnimation, "Animate");
+    taskManager.SetTypeName(kTaskConsole, "ConsoleUpdate");
+    taskManager.SetTypeName(kTaskLoadModel, "LoadModel");
+
+    taskManager.Attach(loadTask);
+    taskManager.Attach(animationTask);
+    taskManager.Attach(std::make_shared<sp::FunctionTask>(
+        kTaskConsole,
+        [this](Uint32 deltaMs) { console.Update(deltaMs / 1000.0f); },
+        sp::kTaskMainThread));
+}
+
+void SimpleGame::ReloadChangedAssets()
+{
+    std::vector<std::string> changed;
+    fileWatcher.Poll(&changed);
+
+    for (const std::string &path : changed) {
+        int num_reloaded = 0;
+        const std::string extension = ".glsl";
+
+        if (path.size() > extension.size() &&
+            path.compare(path.size() - extension.size(), extension.size(),
+                         extension) == 0) {
+            num_reloaded = sp::backend::ReloadPrograms(path);
+        } else if (path == sp::vfs::NormalizePath(kIqmModelPath)) {
+            taskManager.Attach(std::make_shared<IQMLoadTask>(
+                kTaskLoadModel, jobSystem, loadedIqmModel, kIqmModelPath));
+            num_reloaded = 1;
+        } else {
+            num_reloaded = sp::ReloadTexture(path);
+        }
+
+        if (num_reloaded > 0) {
+            sp::log::InfoLog("Reloading %s\n", path.c_str());
+        }
+    }
 }
 
 inline void SimpleGame::DrawIQM()
 {
+    SP_PROFILE_ZONE("DrawIQM");
+
+    if (!iqmModel) {
+        return;
+    }
+
     sp::backend::Bind(programs[modelProgram]);
 
     glm::mat4 transform =
@@ -259,19 +480,37 @@ inline void SimpleGame::DrawIQM()
 
     glm::mat4 model = iqmView.GetModel() * transform;
     sp::backend::SetUniform(programs[modelProgram], sp::kMatrix4fv,
-                            "model_matrix", glm::value_ptr(model));
+                            kModelMatrix, glm::value_ptr(model));
 
-    iqmModel.Animate(animate);
-
-    std::vector<glm::mat4> &bones = iqmModel.GetBones();
-    sp::backend::SetUniform(programs[modelProgram], sp::kMatrix4fv,
-                            "bone_matrices", (GLsizei)bones.size(),
-                            glm::value_ptr(bones[0]));
-    iqmModel.Render();
+    sp::backend::SetUniform(programs[modelProgram], sp::k1i, kIsRigged,
+                            iqmBoneOffset >= 0);
+    if (iqmBoneOffset >= 0) {
+        sp::backend::SetUniform(programs[modelProgram], sp::k1i, kBoneOffset,
+                                iqmBoneOffset);
+    }
+    sp::backend::SetUniform(programs[modelProgram], sp::k3fv, kPositionScale,
+                            glm::value_ptr(iqmModel->GetPositionScale()));
+    sp::backend::SetUniform(programs[modelProgram], sp::k3fv, kPositionBias,
+                            glm::value_ptr(iqmModel->GetPositionBias()));
+
+    // Pick LODs by how far the model is from the camera.
+    glm::vec4 center = renderer.GetView() * model * glm::vec4(0, 0, 0, 1);
+    float distance = std::max(glm::length(glm::vec3(center)), 0.1f);
+    float model_scale = glm::length(glm::vec3(model[0]));
+    iqmModel->Render(renderer.GetPixelsPerUnit(distance) * model_scale);
+
+    // The MD5 model shares the program and is never quantized.
+    glm::vec3 scale(1.0f), bias(0.0f);
+    sp::backend::SetUniform(programs[modelProgram], sp::k3fv, kPositionScale,
+                            glm::value_ptr(scale));
+    sp::backend::SetUniform(programs[modelProgram], sp::k3fv, kPositionBias,
+                            glm::value_ptr(bias));
 }
 
 inline void SimpleGame::DrawMD5()
 {
+    SP_PROFILE_ZONE("DrawMD5");
+
     sp::backend::Bind(programs[modelProgram]);
 
     glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(0.029f));
@@ -281,10 +520,18 @@ inline void SimpleGame::DrawMD5()
     model = glm::rotate(model, -55.0f, glm::vec3(0, 1, 0)) * transform;
     model = glm::translate(model, glm::vec3(0.0f, -32.0f, 0.0f));
     sp::backend::SetUniform(programs[modelProgram], sp::kMatrix4fv,
-                            "model_matrix", glm::value_ptr(model));
+                            kModelMatrix, glm::value_ptr(model));
+    // MD5 meshes are skinned on the CPU.
+    sp::backend::SetUniform(programs[modelProgram], sp::k1i, kIsRigged,
+                            false);
+
+    // Pick LODs by distance, the same way DrawIQM does.
+    glm::vec4 center = renderer.GetView() * model * glm::vec4(0, 0, 0, 1);
+    float distance = std::max(glm::length(glm::vec3(center)), 0.1f);
+    float model_scale = glm::length(glm::vec3(model[0]));
 
     glDisable(GL_CULL_FACE);
-    md5Model.Render();
+    md5Model.Render(renderer.GetPixelsPerUnit(distance) * model_scale);
     glEnable(GL_CULL_FACE);
 
     glUseProgram(0);
@@ -292,6 +539,8 @@ inline void SimpleGame::DrawMD5()
 
 inline void SimpleGame::DrawSkyBox()
 {
+    SP_PROFILE_ZONE("DrawSkyBox");
+
     sp::backend::Bind(programs[skyboxProgram]);
 
     glDisable(GL_CULL_FACE);
@@ -319,6 +568,8 @@ inline void SimpleGame::DrawSkyBox()
 
 inline void SimpleGame::DrawFloor()
 {
+    SP_PROFILE_ZONE("DrawFloor");
+
     sp::backend::Bind(programs[planeProgram]);
 
     glm::mat4 plane_model =
@@ -327,7 +578,7 @@ inline void SimpleGame::DrawFloor()
     plane_model = glm::rotate(plane_model, -90.0f, glm::vec3(1, 0, 0));
 
     sp::backend::SetUniform(programs[planeProgram], sp::kMatrix4fv,
-                            "model_matrix", glm::value_ptr(plane_model));
+                            kModelMatrix, glm::value_ptr(plane_model));
 
     glBindVertexArray(plane.vao);
     glBindBuffer(GL_ARRAY_BUFFER, plane.vbo);
@@ -345,6 +596,8 @@ inline void SimpleGame::DrawFloor()
 
 inline void SimpleGame::DrawPlayer()
 {
+    SP_PROFILE_ZONE("DrawPlayer");
+
     /// SCALE
     /// 1.0 - Player Height
     /// 0.5 - Player Width/Depth
@@ -352,7 +605,7 @@ inline void SimpleGame::DrawPlayer()
     sp::backend::Bind(programs[playerProgram]);
     glm::mat4 player_model = pModel.GetModel();
     sp::backend::SetUniform(programs[playerProgram], sp::kMatrix4fv,
-                            "model_matrix", glm::value_ptr(player_model));
+                            kModelMatrix, glm::value_ptr(player_model));
 
     glBindVertexArray(player.vao);
     glBindBuffer(GL_ARRAY_BUFFER, player.vbo);
@@ -371,6 +624,8 @@ inline void SimpleGame::DrawPlayer()
 
 inline void SimpleGame::RenderEntities(glm::mat4 view)
 {
+    SP_PROFILE_ZONE("RenderEntities");
+
     for (auto &renderable : renderables) {
         sp::backend::Bind(programs[renderable.program]);
         glm::mat4 g_model =
@@ -378,9 +633,9 @@ inline void SimpleGame::RenderEntities(glm::mat4 view)
         glm::mat4 gw_model = gScreenCamera.LookAt() * g_model;
 
         sp::backend::SetUniform(programs[renderable.program], sp::kMatrix4fv,
-                                "model_matrix", glm::value_ptr(g_model));
+                                kModelMatrix, glm::value_ptr(g_model));
         sp::backend::SetUniform(programs[renderable.program], sp::kMatrix4fv,
-                                "mv_matrix", glm::value_ptr(gw_model));
+                                kMvMatrix, glm::value_ptr(gw_model));
 
         // Assumptions of render method
         vertexBuffers[renderable.buffer].Bind();
@@ -390,6 +645,8 @@ inline void SimpleGame::RenderEntities(glm::mat4 view)
 
 inline void SimpleGame::DrawBox(float delta)
 {
+    SP_PROFILE_ZONE("DrawBox");
+
     sp::backend::Bind(programs[playerProgram]);
     blockModel.rot =
         blockModel.rot * glm::angleAxis(delta * 180.0f, glm::vec3(0, 1, 0));
@@ -404,9 +661,9 @@ inline void SimpleGame::DrawBox(float delta)
     glm::mat4 bv_model = gScreenCamera.LookAt() * model;
 
     sp::backend::SetUniform(programs[playerProgram], sp::kMatrix4fv,
-                            "model_matrix", glm::value_ptr(b_model));
+                            kModelMatrix, glm::value_ptr(b_model));
     sp::backend::SetUniform(programs[playerProgram], sp::kMatrix4fv,
-                            "mv_matrix", glm::value_ptr(bv_model));
+                            kMvMatrix, glm::value_ptr(bv_model));
 
     glBindVertexArray(player.vao);
     glBindBuffer(GL_ARRAY_BUFFER, player.vbo);
@@ -419,12 +676,23 @@ inline void SimpleGame::DrawBox(float delta)
 
 void SimpleGame::Display(float delta)
 {
+    SP_PROFILE_ZONE("Display");
+
     // static float ang = 0.0f;
     renderer.BeginFrame();
     // ang += 30.0f * delta;
     // gScreenCamera.Rotate(2.0f * sin(ang), glm::vec3(0.0f, 0.0f, 1.0f));
     renderer.SetView(gScreenCamera.LookAt());
 
+    // Every character's palette goes up in one buffer before anything draws.
+    skinning.BeginFrame();
+    iqmBoneOffset = -1;
+    if (iqmModel && !iqmModel->GetBones().empty()) {
+        const std::vector<glm::mat4> &bones = iqmModel->GetBones();
+        iqmBoneOffset = skinning.Add(bones.data(), (int)bones.size());
+    }
+    skinning.Upload();
+
     DrawSkyBox();
     // DrawPlayer();
     DrawBox(delta);
@@ -442,6 +710,14 @@ void SimpleGame::Display(float delta)
     textDef->DrawText(std::string("FPS: ") +
                           std::to_string((int)std::ceil((1 / delta))),
                       8, 35);
+
+    const sp::TaskGraphStats &taskStats = taskManager.GetGraphStats();
+    textDef->DrawText(
+        std::string("Tasks: ") + std::to_string(taskStats.total_task_ms) +
+            " ms, critical path: " +
+            std::to_string(taskStats.critical_path_ms) + " ms, deferred: " +
+            std::to_string(taskStats.num_deferred),
+        8, 50);
     // textDef->DrawText(std::string("Platform: ") + sysInfo.platform, 8, 50);
     // textDef->DrawText(std::string("CPU Count: ") +
     // std::to_string(sysInfo.num_cpus), 8, 65);
@@ -11,12 +11,16 @@
 #include <glm/gtc/matrix_access.hpp> 
 #include "Camera.hpp"                                // for Camera
 #include "Console.hpp"                               // for Console
+#include "FileWatcher.hpp"                           // for FileWatcher
 #include "Game.hpp"                                  // for Game
 #include "IQMModel.hpp"                              // for IQMModel
+#include "JobSystem.hpp"                             // for JobSystem
 #include "MD5Model.hpp"                              // for MD5Model
 #include "ModelView.hpp"                             // for ModelView
 #include "Renderer.hpp"                              // for Renderer
+#include "SkinningBuffer.hpp"                        // for SkinningBuffer
 #include "System.hpp"                                // for SystemInfo
+#include "Task.hpp"                                  // for TaskManager
 #include "VertexBuffer.hpp"                          // for VertexBuffer
 
 class SimpleGame :public Game {
@@ -24,7 +28,8 @@ public:
     SimpleGame()
         :pModel(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.5f, 1.0f, 0.5f)),
         iqmView(glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.2f)),
-        blockModel(glm::vec3(0.0f, 0.0f, 3.5f), glm::vec3(0.5f, 1.0f, 0.5f))
+        blockModel(glm::vec3(0.0f, 0.0f, 3.5f), glm::vec3(0.5f, 1.0f, 0.5f)),
+        iqmBoneOffset(-1)
     {}
     virtual void Initialize();
     virtual void Run();
@@ -33,6 +38,12 @@ private:
 
     typedef unsigned int Handle;
 
+    enum TaskType {
+        kTaskAnimation,
+        kTaskConsole,
+        kTaskLoadModel,
+    };
+
     struct RenderComponent
     {
         Handle program;
@@ -42,6 +53,8 @@ private:
 
     void InitializeProgram();
     void InitEntities();
+    void InitTasks();
+    void ReloadChangedAssets();
 
     void Init();
     void RenderEntities(glm::mat4 view);
@@ -55,8 +68,8 @@ private:
     void Display(float delta);
     void Reshape (int w, int h);
 
-    float animate = 0.0f;
     sp::Renderer renderer;
+    sp::SkinningBuffer skinning;
     sp::Camera gScreenCamera;
 
     Handle modelProgram;
@@ -83,9 +96,19 @@ private:
     sp::TextDefinition *textDef;
     sp::Console console;
     sp::SystemInfo sysInfo;
+    sp::JobSystem jobSystem;
+    sp::TaskManager taskManager;
+
+    sp::FileWatcher fileWatcher;
 
     MD5Model md5Model;
-    sp::IQMModel iqmModel;
+    // Load tasks leave finished models in loadedIqmModel, the main loop
+    // swaps them in when no task is running.
+    std::unique_ptr<sp::IQMModel> iqmModel;
+    std::unique_ptr<sp::IQMModel> loadedIqmModel;
+    // Where this frame's palette of iqmModel starts in skinning, -1 when it
+    // has none.
+    int iqmBoneOffset;
 
     std::vector<sp::GLProgram> programs;
     std::vector<sp::ModelView> modelViews;
@@ -0,0 +1,70 @@
+#include "SkinningBuffer.hpp"
+#include "Profiler.hpp"
+
+namespace sp
+{
+
+SkinningBuffer::~SkinningBuffer()
+{
+    if (texture) {
+        glDeleteTextures(1, &texture);
+        glDeleteBuffers(1, &buffer);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void SkinningBuffer::Init()
+{
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &texture);
+
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+//------------------------------------------------------------------------------
+
+int SkinningBuffer::Add(const glm::mat4 *palette, int num_bones)
+{
+    int offset = static_cast<int>(rows.size() / 3);
+
+    for (int i = 0; i < num_bones; i++) {
+        const glm::mat4 &m = palette[i];
+        for (int row = 0; row < 3; row++) {
+            rows.push_back(glm::vec4(m[0][row], m[1][row], m[2][row],
+                                     m[3][row]));
+        }
+    }
+
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+void SkinningBuffer::Upload()
+{
+    SP_PROFILE_ZONE("UploadPalettes");
+
+    if (rows.empty()) {
+        return;
+    }
+
+    // Orphaning the old storage keeps the driver from waiting on draws that
+    // still read last frame's palettes.
+    size_t size = rows.size() * sizeof(glm::vec4);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (size > capacity) {
+        capacity = size + size / 2;
+    }
+    glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, rows.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0 + kBonePaletteUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+} // namespace sp
@@ -0,0 +1,46 @@
+#ifndef _SP_SKINNING_BUFFER_H_
+#define _SP_SKINNING_BUFFER_H_
+
+#include <GL/glew.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace sp {
+
+// Texture unit the model program reads bone_palette from.
+const GLint kBonePaletteUnit = 1;
+
+// Skinning palettes of every character drawn in a frame, streamed into one
+// texture buffer as the top three rows of each matrix. A draw reads its
+// palette starting at the bone_offset Add returned, so skeletons have no
+// size limit and the frame uploads once however many characters it draws.
+class SkinningBuffer
+{
+public:
+    SkinningBuffer() : buffer(0), texture(0), capacity(0) {}
+    ~SkinningBuffer();
+
+    void Init();
+
+    // Forgets the previous frame's palettes.
+    void BeginFrame() { rows.clear(); }
+
+    // Returns the palette's bone_offset. The bottom row of every matrix
+    // must be (0, 0, 0, 1).
+    int Add(const glm::mat4 *palette, int num_bones);
+
+    // Uploads the palettes added since BeginFrame and binds them to
+    // kBonePaletteUnit. Call once, before the frame's skinned draws.
+    void Upload();
+
+private:
+    std::vector<glm::vec4> rows;
+    GLuint buffer;
+    GLuint texture;
+    size_t capacity;
+};
+
+} // namespace sp
+
+#endif
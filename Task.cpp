@@ -1,37 +1,621 @@
+#include <algorithm>
+#include <unordered_set>
+
 #include "Task.hpp"
+#include "JobSystem.hpp"
+#include "Logger.hpp"
 
 namespace sp
 {
 
 //=============================================================================
 
+Task::Task(int type, unsigned int order)
+    : task_type(type), is_dead(false), is_active(true), is_paused(false),
+      initial_update(true), task_order(order), task_flags(0), graph_node(-1),
+      deferred_ms(0)
+{
+}
+
+//=============================================================================
+
+Task::~Task() { ClearDependencies(); }
+
+//=============================================================================
+
 void Task::SetNext(TaskPtr task) { next_task = task; }
 
 //=============================================================================
 
-void TaskManager::Attach(TaskPtr task) { task_list.push_back(task); }
+void Task::Kill() { is_dead = true; }
+
+//=============================================================================
+
+// Visits each task once, so graphs that share successors stay linear.
+bool Task::IsReachable(const Task *target) const
+{
+    std::vector<const Task *> stack(1, this);
+    std::unordered_set<const Task *> visited;
+    visited.insert(this);
+
+    while (!stack.empty()) {
+        const Task *task = stack.back();
+        stack.pop_back();
+        if (task == target) {
+            return true;
+        }
+
+        for (const Task *successor : task->successors) {
+            if (visited.insert(successor).second) {
+                stack.push_back(successor);
+            }
+        }
+    }
+
+    return false;
+}
+
+//=============================================================================
+
+bool Task::Precede(Task *successor)
+{
+    if (!successor || successor->IsReachable(this)) {
+        log::ErrorLog("Task::Precede: dependency from task type %d to %d "
+                      "would create a cycle\n",
+                      task_type, successor ? successor->task_type : -1);
+        return false;
+    }
+
+    if (std::find(successors.begin(), successors.end(), successor) ==
+        successors.end()) {
+        successors.push_back(successor);
+        successor->predecessors.push_back(this);
+    }
+
+    return true;
+}
+
+//=============================================================================
+
+void Task::ClearDependencies()
+{
+    for (Task *successor : successors) {
+        auto &preds = successor->predecessors;
+        preds.erase(std::remove(preds.begin(), preds.end(), this), preds.end());
+    }
+
+    for (Task *predecessor : predecessors) {
+        auto &succs = predecessor->successors;
+        succs.erase(std::remove(succs.begin(), succs.end(), this), succs.end());
+    }
+
+    successors.clear();
+    predecessors.clear();
+}
+
+//=============================================================================
+
+TaskManager::~TaskManager()
+{
+    for (auto &slot : slots) {
+        if (slot.task) {
+            slot.task->ClearDependencies();
+        }
+    }
+    slots.clear();
+}
+
+//=============================================================================
+
+TaskHandle TaskManager::Attach(TaskPtr task)
+{
+    std::lock_guard<std::mutex> lock(pending_mutex);
+
+    Uint32 index;
+    if (!free_slots.empty()) {
+        index = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        index = num_reserved_slots++;
+    }
+
+    Uint32 generation = index < slots.size() ? slots[index].generation : 1;
+    pending_attach.push_back({index, std::move(task)});
+
+    return {index, generation};
+}
+
+//=============================================================================
+
+void TaskManager::Detach(TaskHandle handle)
+{
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending_detach.push_back(handle);
+}
+
+//=============================================================================
+
+Task *TaskManager::GetTask(TaskHandle handle) const
+{
+    if (handle.index >= slots.size()) {
+        return nullptr;
+    }
+
+    const TaskSlot &slot = slots[handle.index];
+    if (slot.generation != handle.generation) {
+        return nullptr;
+    }
+
+    return slot.task.get();
+}
+
+//=============================================================================
+
+void TaskManager::FreeSlot(Uint32 index)
+{
+    TaskSlot &slot = slots[index];
+
+    slot.task->ClearDependencies();
+    slot.task.reset();
+
+    // Generation 0 marks an invalid handle, so skip it when wrapping around.
+    if (++slot.generation == 0) {
+        slot.generation = 1;
+    }
+
+    free_slots.push_back(index);
+}
+
+//=============================================================================
+
+void TaskManager::ApplyPending()
+{
+    std::lock_guard<std::mutex> lock(pending_mutex);
+
+    if (slots.size() < num_reserved_slots) {
+        slots.resize(num_reserved_slots, {TaskPtr(), 1});
+    }
+
+    // Attach first, so a task detached in the frame it was attached in is
+    // installed before it is freed.
+    for (PendingAttach &attach : pending_attach) {
+        slots[attach.index].task = std::move(attach.task);
+    }
+    pending_attach.clear();
+
+    for (TaskHandle handle : pending_detach) {
+        if (handle.index < slots.size() &&
+            slots[handle.index].generation == handle.generation &&
+            slots[handle.index].task) {
+            FreeSlot(handle.index);
+        }
+    }
+    pending_detach.clear();
+}
+
+//=============================================================================
+
+bool TaskManager::HasProcesses()
+{
+    for (auto &slot : slots) {
+        if (slot.task) {
+            return true;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    return !pending_attach.empty();
+}
+
+//=============================================================================
+
+bool TaskManager::IsProcessActive(int type)
+{
+    for (auto &slot : slots) {
+        if (slot.task && slot.task->GetType() == type &&
+            !slot.task->IsDead()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//=============================================================================
+
+void TaskManager::SetTypeName(int type, const std::string &name)
+{
+    if (type < 0) {
+        return;
+    }
+
+    if (type >= static_cast<int>(type_names.size())) {
+        type_names.resize(type + 1);
+    }
+    type_names[type] = name;
+
+    // Picked up by the next BuildGraph.
+    if (type < static_cast<int>(type_zones.size())) {
+        type_zones[type] = profiler::kNoZone;
+    }
+}
+
+//=============================================================================
+
+void TaskManager::RegisterTypeZone(int type)
+{
+#ifdef SP_PROFILE
+    if (type < 0) {
+        return;
+    }
+
+    if (type >= static_cast<int>(type_zones.size())) {
+        type_zones.resize(type + 1, profiler::kNoZone);
+    }
+
+    if (type_zones[type] == profiler::kNoZone) {
+        std::string name;
+        if (type < static_cast<int>(type_names.size()) &&
+            !type_names[type].empty()) {
+            name = type_names[type];
+        } else {
+            name = "task " + std::to_string(type);
+        }
+        type_zones[type] = profiler::RegisterZone(name.c_str());
+    }
+#else
+    (void)type;
+#endif
+}
+
+//=============================================================================
+
+void TaskManager::BuildGraph()
+{
+    int num_slots = static_cast<int>(slots.size());
+    if (num_slots > graph_capacity) {
+        graph_capacity = std::max(num_slots, graph_capacity * 2);
+        graph_nodes.reset(new GraphNode[graph_capacity]);
+    }
+
+    graph_size = 0;
+    deferred_tasks.clear();
+    main_deferred_tasks.clear();
+
+    for (auto &slot : slots) {
+        Task *task = slot.task.get();
+        if (!task) {
+            continue;
+        }
+
+        task->graph_node = -1;
+        if (!task->IsActive() || task->IsPaused()) {
+            continue;
+        }
+
+        RegisterTypeZone(task->GetType());
+
+        if (task->IsDeferrable()) {
+            if (task->HasFlag(kTaskMainThread) || !job_system ||
+                job_system->GetNumWorkers() == 0) {
+                main_deferred_tasks.push_back(task);
+            } else {
+                deferred_tasks.push_back(task);
+            }
+            continue;
+        }
+
+        GraphNode &node = graph_nodes[graph_size];
+        node.task = task;
+        node.start_time = node.end_time = 0;
+        task->graph_node = graph_size++;
+    }
+
+    // Only predecessors that actually run this frame hold a task back.
+    for (int i = 0; i < graph_size; i++) {
+        int pending = 0;
+        for (Task *predecessor : graph_nodes[i].task->predecessors) {
+            if (predecessor->graph_node >= 0) {
+                pending++;
+            }
+        }
+        graph_nodes[i].pending.store(pending, std::memory_order_relaxed);
+    }
+
+    completed_nodes.resize(graph_size);
+    next_completed_slot.store(0);
+    num_completed.store(0);
+}
+
+//=============================================================================
+
+void TaskManager::RunNode(int node)
+{
+    GraphNode &graph_node = graph_nodes[node];
+
+    graph_node.start_time = SDL_GetPerformanceCounter();
+    {
+        SP_PROFILE_ZONE_ID(TypeZone(graph_node.task->GetType()));
+        graph_node.task->OnUpdate(frame_delta);
+    }
+    graph_node.end_time = SDL_GetPerformanceCounter();
+
+    // Claiming the slot before any successor is released makes completion
+    // order a valid topological order of this frame's graph.
+    int slot = next_completed_slot.fetch_add(1, std::memory_order_relaxed);
+    completed_nodes[slot] = node;
+
+    for (Task *successor : graph_node.task->successors) {
+        int successor_node = successor->graph_node;
+        if (successor_node < 0) {
+            continue;
+        }
+
+        if (graph_nodes[successor_node].pending.fetch_sub(
+                1, std::memory_order_acq_rel) == 1) {
+            ReleaseNode(successor_node);
+        }
+    }
+
+    num_completed.fetch_add(1, std::memory_order_release);
+}
+
+//=============================================================================
+
+void TaskManager::ReleaseNode(int node)
+{
+    bool use_workers = job_system && job_system->GetNumWorkers() > 0;
+
+    if (use_workers && !graph_nodes[node].task->HasFlag(kTaskMainThread)) {
+        job_system->Submit([this, node]() { RunNode(node); }, &frame_counter);
+    } else {
+        std::lock_guard<std::mutex> lock(main_ready_mutex);
+        main_ready_nodes.push_back(node);
+    }
+}
+
+//=============================================================================
+
+void TaskManager::ComputeCriticalPath()
+{
+    double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+
+    finish_times.assign(graph_size, 0.0);
+    critical_preds.assign(graph_size, -1);
+
+    graph_stats.total_task_ms = 0.0f;
+    graph_stats.critical_path_ms = 0.0f;
+    graph_stats.critical_path.clear();
+
+    int last_node = -1;
+    double longest = 0.0;
+
+    for (int i = 0; i < graph_size; i++) {
+        int node = completed_nodes[i];
+        const GraphNode &graph_node = graph_nodes[node];
+        double duration =
+            (graph_node.end_time - graph_node.start_time) * ms_per_tick;
+
+        double start = 0.0;
+        for (Task *predecessor : graph_node.task->predecessors) {
+            int pred_node = predecessor->graph_node;
+            if (pred_node >= 0 && finish_times[pred_node] > start) {
+                start = finish_times[pred_node];
+                critical_preds[node] = pred_node;
+            }
+        }
+
+        finish_times[node] = start + duration;
+        graph_stats.total_task_ms += static_cast<float>(duration);
+
+        if (finish_times[node] >= longest) {
+            longest = finish_times[node];
+            last_node = node;
+        }
+    }
+
+    graph_stats.critical_path_ms = static_cast<float>(longest);
+    for (int node = last_node; node >= 0; node = critical_preds[node]) {
+        graph_stats.critical_path.push_back(graph_nodes[node].task->GetType());
+    }
+    std::reverse(graph_stats.critical_path.begin(),
+                 graph_stats.critical_path.end());
+}
+
+//=============================================================================
+
+void TaskManager::RunDeferredRange(const std::vector<Task *> &tasks,
+                                   Uint32 cursor, Uint64 deadline)
+{
+    int num_tasks = static_cast<int>(tasks.size());
+    int i;
+
+    while ((i = next_deferred.fetch_add(1)) < num_tasks) {
+        Task *task = tasks[(cursor + i) % num_tasks];
+
+        // The first task of the list always runs so nothing starves when
+        // the non-deferrable tasks alone use up the budget.
+        if (i > 0 && deadline && SDL_GetPerformanceCounter() >= deadline) {
+            task->deferred_ms += frame_delta;
+            num_skipped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // A postponed task catches up on the time it missed.
+        SP_PROFILE_ZONE_ID(TypeZone(task->GetType()));
+        task->OnUpdate(frame_delta + task->deferred_ms);
+        task->deferred_ms = 0;
+    }
+}
 
 //=============================================================================
 
-void TaskManager::Detach(TaskPtr task) { task_list.remove(task); }
+void TaskManager::RunDeferred(Uint64 deadline)
+{
+    SP_PROFILE_ZONE("RunDeferred");
+
+    graph_stats.num_deferred = 0;
+
+    // Each list restarts after the tasks that got to run last time so the
+    // skipped ones go first.
+    auto advance_cursor = [this](Uint32 &cursor, int num_tasks) {
+        int num_run = num_tasks - num_skipped.load();
+        cursor = (cursor + num_run) % num_tasks;
+        graph_stats.num_deferred += num_skipped.load();
+    };
+
+    if (!deferred_tasks.empty()) {
+        next_deferred.store(0);
+        num_skipped.store(0);
+
+        int num_tasks = static_cast<int>(deferred_tasks.size());
+        int num_runners = std::min(job_system->GetNumWorkers(), num_tasks);
+        for (int i = 0; i < num_runners; i++) {
+            job_system->Submit(
+                [this, deadline]() {
+                    RunDeferredRange(deferred_tasks, deferred_cursor,
+                                     deadline);
+                },
+                &frame_counter);
+        }
+        job_system->Wait(&frame_counter);
+
+        advance_cursor(deferred_cursor, num_tasks);
+    }
+
+    if (!main_deferred_tasks.empty()) {
+        next_deferred.store(0);
+        num_skipped.store(0);
+
+        RunDeferredRange(main_deferred_tasks, main_deferred_cursor, deadline);
+
+        advance_cursor(main_deferred_cursor,
+                       static_cast<int>(main_deferred_tasks.size()));
+    }
+}
 
 //=============================================================================
 
 void TaskManager::UpdateProcesses(Uint32 deltaMs)
 {
-    TaskPtr next;
-    for (auto current : task_list) {
-        if (current->IsDead()) {
-            next = current->GetNext();
-            if (next) {
-                current->SetNext(TaskPtr(nullptr));
-                Attach(next);
+    SP_PROFILE_ZONE("UpdateProcesses");
+
+    Uint64 frame_start = SDL_GetPerformanceCounter();
+
+    ApplyPending();
+
+    // Dead tasks are reaped at the frame boundary, their successors are
+    // attached in the same pass so they run this frame.
+    for (Uint32 i = 0; i < slots.size(); i++) {
+        Task *task = slots[i].task.get();
+        if (!task || !task->IsDead()) {
+            continue;
+        }
+
+        TaskPtr next = task->GetNext();
+        if (next) {
+            task->SetNext(TaskPtr(nullptr));
+            Attach(next);
+        }
+        Detach({i, slots[i].generation});
+    }
+
+    ApplyPending();
+    {
+        SP_PROFILE_ZONE("BuildGraph");
+        BuildGraph();
+    }
+
+    frame_delta = deltaMs;
+    bool use_workers = job_system && job_system->GetNumWorkers() > 0;
+
+    // Roots are batched so each job amortizes its queue overhead over a few
+    // updates while still leaving enough jobs around for idle workers to
+    // steal. Tasks released later by their predecessors go out one by one.
+    root_nodes.clear();
+    for (int i = 0; i < graph_size; i++) {
+        if (graph_nodes[i].pending.load(std::memory_order_relaxed) == 0 &&
+            use_workers && !graph_nodes[i].task->HasFlag(kTaskMainThread)) {
+            root_nodes.push_back(i);
+        }
+    }
+
+    // Higher priority roots are queued first so idle workers steal them first.
+    std::stable_sort(root_nodes.begin(), root_nodes.end(),
+                     [this](int a, int b) {
+                         return graph_nodes[a].task->GetOrder() <
+                                graph_nodes[b].task->GetOrder();
+                     });
+
+    // Collect the main thread's roots before any worker runs, or a node a
+    // finished root releases could be queued by both the scan and RunNode.
+    {
+        std::lock_guard<std::mutex> lock(main_ready_mutex);
+        main_ready_nodes.clear();
+        for (int i = 0; i < graph_size; i++) {
+            if (graph_nodes[i].pending.load(std::memory_order_relaxed) == 0 &&
+                (!use_workers ||
+                 graph_nodes[i].task->HasFlag(kTaskMainThread))) {
+                main_ready_nodes.push_back(i);
+            }
+        }
+    }
+
+    int num_roots = static_cast<int>(root_nodes.size());
+    int batch_size = use_workers ? std::max(1, num_roots /
+                                   (job_system->GetNumWorkers() * 4 + 1))
+                                 : 1;
+
+    for (int first = 0; first < num_roots; first += batch_size) {
+        int last = std::min(first + batch_size, num_roots);
+        job_system->Submit(
+            [this, first, last]() {
+                for (int i = first; i < last; i++) {
+                    RunNode(root_nodes[i]);
+                }
+            },
+            &frame_counter);
+    }
+
+    // The main thread runs its own ready tasks and otherwise helps the
+    // workers until every node of the graph has completed.
+    while (num_completed.load(std::memory_order_acquire) < graph_size) {
+        int node = -1;
+        {
+            std::lock_guard<std::mutex> lock(main_ready_mutex);
+            if (!main_ready_nodes.empty()) {
+                auto best = std::min_element(
+                    main_ready_nodes.begin(), main_ready_nodes.end(),
+                    [this](int a, int b) {
+                        return graph_nodes[a].task->GetOrder() <
+                               graph_nodes[b].task->GetOrder();
+                    });
+                node = *best;
+                *best = main_ready_nodes.back();
+                main_ready_nodes.pop_back();
             }
-            Detach(current);
-        } else if (current->IsActive() && !current->IsPaused()) {
-            current->OnUpdate(deltaMs);
         }
+
+        if (node >= 0) {
+            RunNode(node);
+        } else if (!use_workers || !job_system->TryRunJob()) {
+            std::this_thread::yield();
+        }
+    }
+
+    if (use_workers) {
+        job_system->Wait(&frame_counter);
+    }
+
+    ComputeCriticalPath();
+
+    Uint64 deadline = 0;
+    if (frame_budget_ms > 0.0f) {
+        deadline = frame_start + static_cast<Uint64>(
+                                     frame_budget_ms / 1000.0f *
+                                     SDL_GetPerformanceFrequency());
     }
+    RunDeferred(deadline);
 }
 
 } // namespace sp
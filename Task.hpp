@@ -2,21 +2,44 @@
 #define _SP_TASK_H_
 
 #include <SDL2/SDL.h>
+#include <atomic>
+#include <functional>
 #include <memory>
-#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "JobSystem.hpp"
+#include "Profiler.hpp"
 
 namespace sp {
 
 class Task;
 typedef std::shared_ptr<Task> TaskPtr;
 
+// A task's order is its priority class, lower values are updated first.
+// Deferrable tasks (streaming, LOD rebuilds, stats) only run while the
+// frame budget set on the TaskManager lasts and are otherwise postponed.
+enum TaskPriority {
+    kPriorityCritical = 0,
+    kPriorityHigh = 1,
+    kPriorityNormal = 2,
+    kPriorityDeferrable = 3,
+};
+
+enum TaskFlags {
+    // The task touches GL or other main thread state and must never be
+    // dispatched to a worker thread.
+    kTaskMainThread = 1 << 0,
+};
+
 class Task {
     friend class TaskManager;    
 
 public:
     // Make this a non-copyable class
     // The weird "= delete" means we're not allowing this function to be used.
-    Task() = default; 
+    Task() : Task(0) {}
     Task(const Task &) = delete;
     Task & operator=(const Task &) = delete;
 
@@ -30,9 +53,26 @@ public:
     bool IsActive() const { return is_active; }
     void SetActive(const bool active) { is_active = active; }
     bool IsPaused() const { return is_paused; }
+    unsigned int GetOrder() const { return task_order; }
+    void SetOrder(const unsigned int order) { task_order = order; }
+    bool IsDeferrable() const { return task_order >= kPriorityDeferrable; }
     bool IsInitialized() const { return !initial_update; }
     TaskPtr const GetNext() const { return next_task; }
     void SetNext(TaskPtr next);
+    unsigned int GetFlags() const { return task_flags; }
+    void SetFlags(const unsigned int flags) { task_flags = flags; }
+    bool HasFlag(const unsigned int flag) const
+    {
+        return (task_flags & flag) != 0;
+    }
+
+    // Orders this task before successor within every frame both are active.
+    // Unlike SetNext, both tasks stay attached. Returns false (and adds
+    // nothing) if the edge would introduce a cycle.
+    bool Precede(Task *successor);
+    void ClearDependencies();
+    const std::vector<Task *> &GetSuccessors() const { return successors; }
+    const std::vector<Task *> &GetPredecessors() const { return predecessors; }
 
     virtual void OnUpdate(const Uint32 deltaMs);
     virtual void OnInitialize() {};
@@ -48,33 +88,185 @@ protected:
     bool initial_update;
     std::shared_ptr<Task> next_task;
 
+    std::vector<Task *> successors;
+    std::vector<Task *> predecessors;
+
 private:
+    bool IsReachable(const Task *target) const;
+
+    unsigned int task_order;
     unsigned int task_flags;
+    int graph_node;
+    Uint32 deferred_ms;
 };
 
 inline void Task::OnUpdate(Uint32 deltaMs)
 {
-    if (!initial_update) {
+    if (initial_update) {
         OnInitialize();
         initial_update = false;
     }
 }
 
-typedef std::list<TaskPtr> TaskList;
+// Wraps a callable so small jobs don't need their own Task subclass.
+class FunctionTask : public Task
+{
+public:
+    typedef std::function<void(Uint32)> UpdateFunction;
+
+    FunctionTask(int type, UpdateFunction function, unsigned int flags = 0)
+        : Task(type), update_function(function)
+    {
+        SetFlags(flags);
+    }
+
+    void OnUpdate(const Uint32 deltaMs) override
+    {
+        Task::OnUpdate(deltaMs);
+        update_function(deltaMs);
+    }
+
+private:
+    UpdateFunction update_function;
+};
+
+// Timing of the last frame's task graph. The critical path is the chain of
+// dependent tasks with the largest summed update time, i.e. the lower bound
+// on the frame's task time no matter how many workers there are.
+struct TaskGraphStats {
+    float total_task_ms;
+    float critical_path_ms;
+    std::vector<int> critical_path; // task types, first to last
+    int num_deferred;               // deferrable tasks pushed to a later frame
+};
+
+// Refers to an attached task. The generation is bumped whenever a slot is
+// freed, so handles to detached tasks go stale instead of dangling.
+struct TaskHandle {
+    Uint32 index;
+    Uint32 generation;
+
+    bool IsValid() const { return generation != 0; }
+};
+
 class TaskManager {
 public:
+    TaskManager()
+        : job_system(nullptr), num_reserved_slots(0), graph_capacity(0),
+          graph_size(0), frame_delta(0), next_completed_slot(0),
+          num_completed(0), frame_budget_ms(0.0f), deferred_cursor(0),
+          main_deferred_cursor(0), next_deferred(0), num_skipped(0),
+          graph_stats{0.0f, 0.0f, {}, 0}
+    {
+    }
     ~TaskManager();
 
-    void Attach(TaskPtr task);
+    // Tasks are released in dependency order; those without kTaskMainThread
+    // are spread over the job system's workers. Without a job system every
+    // task is updated on the calling thread.
+    void SetJobSystem(JobSystem *jobs) { job_system = jobs; }
+
+    // Time UpdateProcesses may spend per frame before deferrable tasks are
+    // postponed, 0 disables the budget. Non-deferrable tasks always run.
+    // Deferrable tasks don't take part in Precede ordering.
+    void SetFrameBudget(const float ms) { frame_budget_ms = ms; }
+    float GetFrameBudget() const { return frame_budget_ms; }
+
+    // Attach and Detach may be called from inside a task update. Both are
+    // queued and take effect at the start of the next UpdateProcesses.
+    TaskHandle Attach(TaskPtr task);
+    void Detach(TaskHandle handle);
+    Task *GetTask(TaskHandle handle) const;
+
     bool HasProcesses();
     bool IsProcessActive(int type);
     void UpdateProcesses(const Uint32 deltaMs);
 
-protected:
-    TaskList task_list;
+    const TaskGraphStats &GetGraphStats() const { return graph_stats; }
+
+    // Name the profiler reports updates of tasks of this type under,
+    // defaults to "task <type>".
+    void SetTypeName(int type, const std::string &name);
 
 private:
-    void Detach(TaskPtr task);
+    struct TaskSlot {
+        TaskPtr task;
+        Uint32 generation;
+    };
+
+    struct PendingAttach {
+        Uint32 index;
+        TaskPtr task;
+    };
+
+    struct GraphNode {
+        Task *task;
+        std::atomic<int> pending;
+        Uint64 start_time;
+        Uint64 end_time;
+    };
+
+    void ApplyPending();
+    void FreeSlot(Uint32 index);
+    void BuildGraph();
+    void ReleaseNode(int node);
+    void RunNode(int node);
+    void ComputeCriticalPath();
+    void RegisterTypeZone(int type);
+    profiler::ZoneId TypeZone(int type) const
+    {
+        return type >= 0 && type < static_cast<int>(type_zones.size())
+                   ? type_zones[type]
+                   : profiler::kNoZone;
+    }
+    void RunDeferred(Uint64 deadline);
+    void RunDeferredRange(const std::vector<Task *> &tasks, Uint32 cursor,
+                          Uint64 deadline);
+
+    JobSystem *job_system;
+    JobCounter frame_counter;
+
+    // Tasks live in a flat slot array, freed slots are recycled through
+    // free_slots. Slots are only resized between frames.
+    std::vector<TaskSlot> slots;
+    std::vector<Uint32> free_slots;
+    Uint32 num_reserved_slots;
+
+    std::mutex pending_mutex;
+    std::vector<PendingAttach> pending_attach;
+    std::vector<TaskHandle> pending_detach;
+
+    std::unique_ptr<GraphNode[]> graph_nodes;
+    int graph_capacity;
+    int graph_size;
+    Uint32 frame_delta;
+
+    std::vector<int> root_nodes;
+    std::vector<int> completed_nodes;
+    std::atomic<int> next_completed_slot;
+    std::atomic<int> num_completed;
+
+    std::mutex main_ready_mutex;
+    std::vector<int> main_ready_nodes;
+
+    // Deferrable tasks are run round robin, starting at the cursor of their
+    // list so that the ones postponed last frame go first.
+    float frame_budget_ms;
+    std::vector<Task *> deferred_tasks;
+    std::vector<Task *> main_deferred_tasks;
+    Uint32 deferred_cursor;
+    Uint32 main_deferred_cursor;
+    std::atomic<int> next_deferred;
+    std::atomic<int> num_skipped;
+
+    std::vector<double> finish_times;
+    std::vector<int> critical_preds;
+    TaskGraphStats graph_stats;
+
+    // Indexed by task type. Only grown in BuildGraph, before any task of the
+    // frame runs.
+    std::vector<std::string> type_names;
+    std::vector<profiler::ZoneId> type_zones;
 };
 
 } // namespace sp
@@ -0,0 +1,722 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Asset.hpp"
+#include "Logger.hpp"
+#include "FileSystem.hpp"
+#include "Mipmap.hpp"
+#include "TextureCompress.hpp"
+
+namespace sp
+{
+
+//------------------------------------------------------------------------------
+// Block encoding
+
+// 4x4 RGBA8 texels, clamped at the image edges.
+static void FetchBlock(const Uint8 *pixels, int width, int height, int pitch,
+                       int block_x, int block_y, Uint8 block[16][4])
+{
+    for (int y = 0; y < 4; y++) {
+        int src_y = std::min(block_y * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++) {
+            int src_x = std::min(block_x * 4 + x, width - 1);
+            memcpy(block[y * 4 + x], pixels + src_y * pitch + src_x * 4, 4);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static Uint16 To565(const int color[3])
+{
+    return static_cast<Uint16>(((color[0] * 31 + 127) / 255) << 11 |
+                               ((color[1] * 63 + 127) / 255) << 5 |
+                               ((color[2] * 31 + 127) / 255));
+}
+
+//------------------------------------------------------------------------------
+
+static void From565(Uint16 value, int color[3])
+{
+    int r = (value >> 11) & 31;
+    int g = (value >> 5) & 63;
+    int b = value & 31;
+
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+//------------------------------------------------------------------------------
+
+static void WriteLE16(Uint8 *out, Uint16 value)
+{
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+//------------------------------------------------------------------------------
+
+// Endpoints from the inset bounding box of the block's colors, always in
+// four color mode so the result is valid for BC1 and BC3 alike.
+static void EncodeColorBlock(const Uint8 block[16][4], Uint8 *out)
+{
+    int min_color[3] = {255, 255, 255};
+    int max_color[3] = {0, 0, 0};
+
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            min_color[c] = std::min(min_color[c], int(block[i][c]));
+            max_color[c] = std::max(max_color[c], int(block[i][c]));
+        }
+    }
+
+    for (int c = 0; c < 3; c++) {
+        int inset = (max_color[c] - min_color[c]) >> 4;
+        min_color[c] += inset;
+        max_color[c] -= inset;
+    }
+
+    Uint16 color0 = To565(max_color);
+    Uint16 color1 = To565(min_color);
+    if (color0 < color1) {
+        std::swap(color0, color1);
+    }
+
+    WriteLE16(out, color0);
+    WriteLE16(out + 2, color1);
+
+    Uint32 indices = 0;
+    if (color0 != color1) {
+        int palette[4][3];
+        From565(color0, palette[0]);
+        From565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            int best_error = 1 << 30;
+            for (int p = 0; p < 4; p++) {
+                int error = 0;
+                for (int c = 0; c < 3; c++) {
+                    int delta = block[i][c] - palette[p][c];
+                    error += delta * delta;
+                }
+                if (error < best_error) {
+                    best_error = error;
+                    best = p;
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = (indices >> (8 * i)) & 0xff;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// One channel in eight value mode, endpoints at the block's extremes.
+static void EncodeChannelBlock(const Uint8 block[16][4], int channel,
+                               Uint8 *out)
+{
+    int min_value = 255;
+    int max_value = 0;
+    for (int i = 0; i < 16; i++) {
+        min_value = std::min(min_value, int(block[i][channel]));
+        max_value = std::max(max_value, int(block[i][channel]));
+    }
+
+    out[0] = static_cast<Uint8>(max_value);
+    out[1] = static_cast<Uint8>(min_value);
+
+    Uint64 indices = 0;
+    int range = max_value - min_value;
+    if (range > 0) {
+        for (int i = 0; i < 16; i++) {
+            // Position between min (0) and max (7), mapped to the index
+            // order of the format: max, min, then the six steps from max.
+            int t = ((block[i][channel] - min_value) * 7 + range / 2) / range;
+            Uint64 index = t == 7 ? 0 : t == 0 ? 1 : 8 - t;
+            indices |= index << (3 * i);
+        }
+    }
+
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (indices >> (8 * i)) & 0xff;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Block decoding
+
+// DXT1 blocks with color0 <= color1 have three colors and black, which is
+// transparent only in the RGBA flavour. DXT5 color blocks always have four.
+static void DecodeColorBlock(const Uint8 *in, bool is_dxt1, bool allow_alpha,
+                             Uint8 block[16][4])
+{
+    Uint16 color0 = in[0] | in[1] << 8;
+    Uint16 color1 = in[2] | in[3] << 8;
+    Uint32 indices = in[4] | in[5] << 8 | in[6] << 16 | Uint32(in[7]) << 24;
+
+    int palette[4][4];
+    From565(color0, palette[0]);
+    From565(color1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+
+    bool three_color = is_dxt1 && color0 <= color1;
+    for (int c = 0; c < 3; c++) {
+        if (!three_color) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    if (three_color && allow_alpha) {
+        palette[3][3] = 0;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        const int *color = palette[(indices >> (2 * i)) & 3];
+        for (int c = 0; c < 4; c++) {
+            block[i][c] = static_cast<Uint8>(color[c]);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void DecodeChannelBlock(const Uint8 *in, int channel,
+                               Uint8 block[16][4])
+{
+    int value0 = in[0];
+    int value1 = in[1];
+
+    int palette[8] = {value0, value1};
+    if (value0 > value1) {
+        for (int i = 1; i < 7; i++) {
+            palette[i + 1] = ((7 - i) * value0 + i * value1) / 7;
+        }
+    } else {
+        for (int i = 1; i < 5; i++) {
+            palette[i + 1] = ((5 - i) * value0 + i * value1) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    Uint64 indices = 0;
+    for (int i = 0; i < 6; i++) {
+        indices |= Uint64(in[2 + i]) << (8 * i);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        int index = (indices >> (3 * i)) & 7;
+        block[i][channel] = static_cast<Uint8>(palette[index]);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+GLenum GetBlockInternalFormat(BlockFormat format)
+{
+    switch (format) {
+    case kBC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case kBC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case kBC5:
+    default:
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+size_t GetBlockSize(GLenum internal_format)
+{
+    switch (internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool IsBlockFormatSupported(GLenum internal_format)
+{
+    switch (internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return GLEW_EXT_texture_compression_s3tc;
+    case GL_COMPRESSED_RG_RGTC2:
+        // Core since GL 3.0.
+        return true;
+    default:
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static size_t GetLevelSize(GLenum internal_format, int width, int height)
+{
+    return (size_t(width) + 3) / 4 * ((size_t(height) + 3) / 4) *
+           GetBlockSize(internal_format);
+}
+
+//------------------------------------------------------------------------------
+
+static void CompressLevel(const Uint8 *pixels, int width, int height,
+                          int pitch, BlockFormat format, Uint8 *out)
+{
+    Uint8 block[16][4];
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            FetchBlock(pixels, width, height, pitch, bx, by, block);
+
+            switch (format) {
+            case kBC1:
+                EncodeColorBlock(block, out);
+                out += 8;
+                break;
+            case kBC3:
+                EncodeChannelBlock(block, 3, out);
+                EncodeColorBlock(block, out + 8);
+                out += 16;
+                break;
+            case kBC5:
+                EncodeChannelBlock(block, 0, out);
+                EncodeChannelBlock(block, 1, out + 8);
+                out += 16;
+                break;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void CompressImage(const Uint8 *pixels, int width, int height, int pitch,
+                   BlockFormat format, TextureImage *image)
+{
+    std::vector<MipLevel> mips;
+    GenerateMipChain(pixels, width, height, pitch, MAX_TEXTURE_MIPS, &mips);
+
+    image->internal_format = GetBlockInternalFormat(format);
+    image->levels.clear();
+    image->file = vfs::File();
+
+    size_t offset = 0;
+    for (size_t i = 0; i <= mips.size(); i++) {
+        int level_width = i == 0 ? width : mips[i - 1].width;
+        int level_height = i == 0 ? height : mips[i - 1].height;
+        size_t size =
+            GetLevelSize(image->internal_format, level_width, level_height);
+
+        image->levels.push_back({level_width, level_height, offset, size});
+        offset += size;
+    }
+    image->data.resize(offset);
+
+    for (size_t i = 0; i < image->levels.size(); i++) {
+        const TextureLevel &level = image->levels[i];
+        const Uint8 *src = i == 0 ? pixels : mips[i - 1].pixels.data();
+        int src_pitch = i == 0 ? pitch : level.width * 4;
+
+        CompressLevel(src, level.width, level.height, src_pitch, format,
+                      &image->data[level.offset]);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void DecompressImage(const TextureImage &compressed, TextureImage *image)
+{
+    GLenum format = compressed.internal_format;
+    size_t block_size = GetBlockSize(format);
+
+    image->internal_format = GL_RGBA8;
+    image->levels.clear();
+    image->file = vfs::File();
+
+    size_t offset = 0;
+    for (const TextureLevel &level : compressed.levels) {
+        size_t size = level.width * level.height * 4;
+        image->levels.push_back({level.width, level.height, offset, size});
+        offset += size;
+    }
+    image->data.resize(offset);
+
+    Uint8 block[16][4];
+    for (size_t i = 0; i < compressed.levels.size(); i++) {
+        const TextureLevel &level = compressed.levels[i];
+        const Uint8 *in = compressed.GetLevel(i);
+        Uint8 *out = &image->data[image->levels[i].offset];
+        int blocks_x = (level.width + 3) / 4;
+        int blocks_y = (level.height + 3) / 4;
+
+        for (int by = 0; by < blocks_y; by++) {
+            for (int bx = 0; bx < blocks_x; bx++, in += block_size) {
+                switch (format) {
+                case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+                    DecodeColorBlock(in, true, false, block);
+                    break;
+                case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+                    DecodeColorBlock(in, true, true, block);
+                    break;
+                case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                    DecodeColorBlock(in + 8, false, false, block);
+                    DecodeChannelBlock(in, 3, block);
+                    break;
+                case GL_COMPRESSED_RG_RGTC2:
+                    DecodeChannelBlock(in, 0, block);
+                    DecodeChannelBlock(in + 8, 1, block);
+                    for (int p = 0; p < 16; p++) {
+                        block[p][2] = 0;
+                        block[p][3] = 255;
+                    }
+                    break;
+                }
+
+                // Partial blocks at the right and bottom edges are cropped.
+                for (int y = 0; y < 4 && by * 4 + y < level.height; y++) {
+                    int columns = std::min(4, level.width - bx * 4);
+                    memcpy(out + ((by * 4 + y) * level.width + bx * 4) * 4,
+                           block[y * 4], columns * 4);
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Containers
+
+static Uint32 ReadLE32(const Uint8 *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | Uint32(in[3]) << 24;
+}
+
+//------------------------------------------------------------------------------
+
+static void WriteLE32(Uint8 *out, Uint32 value)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static Uint32 MakeFourCC(const char *code)
+{
+    return ReadLE32(reinterpret_cast<const Uint8 *>(code));
+}
+
+//------------------------------------------------------------------------------
+
+// Header sizes are checked before any level size is computed from them.
+static bool IsValidSize(int width, int height)
+{
+    return width > 0 && height > 0 && width <= MAX_TEXTURE_SIZE &&
+           height <= MAX_TEXTURE_SIZE;
+}
+
+//------------------------------------------------------------------------------
+
+// Fills in the levels of image from offset on and checks they fit the file.
+static bool LayoutLevels(TextureImage *image, int width, int height,
+                         int num_levels, size_t offset)
+{
+    if (!IsValidSize(width, height) || num_levels <= 0 ||
+        num_levels > MAX_TEXTURE_MIPS) {
+        return false;
+    }
+
+    image->levels.clear();
+    for (int i = 0; i < num_levels; i++) {
+        size_t size = GetLevelSize(image->internal_format, width, height);
+        image->levels.push_back({width, height, offset, size});
+        offset += size;
+
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+
+    return offset <= image->file.GetSize();
+}
+
+//------------------------------------------------------------------------------
+
+static const size_t kDDSHeaderSize = 128;
+static const size_t kDX10HeaderSize = 20;
+
+static bool LoadDDS(const std::string &file_name, TextureImage *image)
+{
+    const Uint8 *data = image->file.GetData();
+    size_t data_size = image->file.GetSize();
+    if (data_size < kDDSHeaderSize ||
+        ReadLE32(&data[0]) != MakeFourCC("DDS ") || ReadLE32(&data[4]) != 124) {
+        log::ErrorLog("%s isn't a DDS file\n", file_name.c_str());
+        return false;
+    }
+
+    int height = ReadLE32(&data[12]);
+    int width = ReadLE32(&data[16]);
+    int num_levels = std::max<int>(ReadLE32(&data[28]), 1);
+    Uint32 four_cc = ReadLE32(&data[84]);
+    Uint32 caps2 = ReadLE32(&data[112]);
+    size_t offset = kDDSHeaderSize;
+
+    if (caps2 & 0x200) {
+        log::ErrorLog("%s: DDS cube maps aren't supported\n",
+                      file_name.c_str());
+        return false;
+    }
+
+    if (!IsValidSize(width, height)) {
+        log::ErrorLog("%s: DDS size %dx%d is out of range\n",
+                      file_name.c_str(), width, height);
+        return false;
+    }
+
+    if (four_cc == MakeFourCC("DXT1")) {
+        image->internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    } else if (four_cc == MakeFourCC("DXT5")) {
+        image->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    } else if (four_cc == MakeFourCC("ATI2") ||
+               four_cc == MakeFourCC("BC5U")) {
+        image->internal_format = GL_COMPRESSED_RG_RGTC2;
+    } else if (four_cc == MakeFourCC("DX10") &&
+               data_size >= kDDSHeaderSize + kDX10HeaderSize) {
+        Uint32 dxgi_format = ReadLE32(&data[kDDSHeaderSize]);
+        Uint32 dimension = ReadLE32(&data[kDDSHeaderSize + 4]);
+        Uint32 misc_flags = ReadLE32(&data[kDDSHeaderSize + 8]);
+        Uint32 array_size = ReadLE32(&data[kDDSHeaderSize + 12]);
+        offset += kDX10HeaderSize;
+
+        // D3D10_RESOURCE_DIMENSION_TEXTURE2D, and not a cube or an array,
+        // which the legacy header flags through caps2.
+        if (dimension != 3 || (misc_flags & 0x4) || array_size != 1) {
+            log::ErrorLog("%s: only single 2D DDS textures are supported\n",
+                          file_name.c_str());
+            return false;
+        }
+
+        switch (dxgi_format) {
+        case 71: // DXGI_FORMAT_BC1_UNORM
+            image->internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            break;
+        case 77: // DXGI_FORMAT_BC3_UNORM
+            image->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            break;
+        case 72: // DXGI_FORMAT_BC1_UNORM_SRGB
+        case 78: // DXGI_FORMAT_BC3_UNORM_SRGB
+            // Every other texture is sampled as linear, there is no sRGB
+            // path to put these on.
+            log::ErrorLog("%s: sRGB DXGI format %u isn't supported\n",
+                          file_name.c_str(), dxgi_format);
+            return false;
+        case 83: // DXGI_FORMAT_BC5_UNORM
+            image->internal_format = GL_COMPRESSED_RG_RGTC2;
+            break;
+        default:
+            log::ErrorLog("%s: unsupported DXGI format %u\n",
+                          file_name.c_str(), dxgi_format);
+            return false;
+        }
+    } else {
+        log::ErrorLog("%s: unsupported DDS pixel format\n", file_name.c_str());
+        return false;
+    }
+
+    if (!LayoutLevels(image, width, height, num_levels, offset)) {
+        log::ErrorLog("%s: DDS file is truncated\n", file_name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static const Uint8 kKTXIdentifier[12] = {0xAB, 'K',  'T',  'X', ' ',  '1',
+                                         '1',  0xBB, '\r', '\n', 0x1A, '\n'};
+static const size_t kKTXHeaderSize = 64;
+
+static bool LoadKTX(const std::string &file_name, TextureImage *image)
+{
+    const Uint8 *data = image->file.GetData();
+    size_t data_size = image->file.GetSize();
+    if (data_size < kKTXHeaderSize ||
+        memcmp(&data[0], kKTXIdentifier, sizeof(kKTXIdentifier)) != 0) {
+        log::ErrorLog("%s isn't a KTX file\n", file_name.c_str());
+        return false;
+    }
+
+    if (ReadLE32(&data[12]) != 0x04030201) {
+        log::ErrorLog("%s: big endian KTX files aren't supported\n",
+                      file_name.c_str());
+        return false;
+    }
+
+    image->internal_format = ReadLE32(&data[28]);
+    int width = ReadLE32(&data[36]);
+    int height = ReadLE32(&data[40]);
+    Uint32 depth = ReadLE32(&data[44]);
+    Uint32 num_elements = ReadLE32(&data[48]);
+    Uint32 num_faces = ReadLE32(&data[52]);
+    int num_levels = std::max<int>(ReadLE32(&data[56]), 1);
+    Uint32 key_value_bytes = ReadLE32(&data[60]);
+
+    if (!GetBlockSize(image->internal_format) || depth > 1 ||
+        num_elements > 0 || num_faces != 1) {
+        log::ErrorLog("%s: only BC1, BC3 and BC5 2D textures are supported\n",
+                      file_name.c_str());
+        return false;
+    }
+
+    if (!IsValidSize(width, height) || num_levels > MAX_TEXTURE_MIPS) {
+        log::ErrorLog("%s: KTX size %dx%d is out of range\n",
+                      file_name.c_str(), width, height);
+        return false;
+    }
+
+    // Every level is preceded by its size; compressed levels are always a
+    // multiple of four bytes so there's no padding.
+    size_t offset = kKTXHeaderSize + key_value_bytes;
+    image->levels.clear();
+    for (int i = 0; i < num_levels; i++) {
+        size_t size = GetLevelSize(image->internal_format, width, height);
+        if (offset + 4 + size > data_size ||
+            ReadLE32(&data[offset]) != size) {
+            log::ErrorLog("%s: KTX level %d is corrupt\n", file_name.c_str(),
+                          i);
+            return false;
+        }
+
+        image->levels.push_back({width, height, offset + 4, size});
+        offset += 4 + size;
+
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static bool HasExtension(const std::string &file_name, const char *extension)
+{
+    size_t length = strlen(extension);
+    if (file_name.size() < length) {
+        return false;
+    }
+
+    std::string suffix = file_name.substr(file_name.size() - length);
+    std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+
+    return suffix == extension;
+}
+
+//------------------------------------------------------------------------------
+
+bool IsCompressedImageFile(const std::string &file_name)
+{
+    return HasExtension(file_name, ".dds") || HasExtension(file_name, ".ktx");
+}
+
+//------------------------------------------------------------------------------
+
+bool LoadCompressedImage(const std::string &file_name, TextureImage *image)
+{
+    // Levels point straight into the file contents, which stay mapped for
+    // stored pak entries.
+    image->data.clear();
+    if (!vfs::ReadFile(file_name, &image->file)) {
+        log::ErrorLog("Can't read %s\n", file_name.c_str());
+        return false;
+    }
+
+    if (HasExtension(file_name, ".ktx")) {
+        return LoadKTX(file_name, image);
+    }
+
+    return LoadDDS(file_name, image);
+}
+
+//------------------------------------------------------------------------------
+
+bool WriteDDS(const std::string &file_name, const TextureImage &image)
+{
+    const char *four_cc;
+    switch (image.internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        four_cc = "DXT1";
+        break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        four_cc = "DXT5";
+        break;
+    case GL_COMPRESSED_RG_RGTC2:
+        four_cc = "ATI2";
+        break;
+    default:
+        log::ErrorLog("WriteDDS: %s isn't block compressed\n",
+                      file_name.c_str());
+        return false;
+    }
+
+    Uint8 header[kDDSHeaderSize] = {};
+    WriteLE32(&header[0], MakeFourCC("DDS "));
+    WriteLE32(&header[4], 124);
+    // CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT | LINEARSIZE
+    WriteLE32(&header[8], 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);
+    WriteLE32(&header[12], image.levels[0].height);
+    WriteLE32(&header[16], image.levels[0].width);
+    WriteLE32(&header[20], static_cast<Uint32>(image.levels[0].size));
+    WriteLE32(&header[28], static_cast<Uint32>(image.levels.size()));
+    WriteLE32(&header[76], 32);
+    WriteLE32(&header[80], 0x4); // DDPF_FOURCC
+    WriteLE32(&header[84], MakeFourCC(four_cc));
+    // TEXTURE | MIPMAP | COMPLEX
+    WriteLE32(&header[108], 0x1000 | 0x400000 | 0x8);
+
+    FILE *file = fopen(file_name.c_str(), "wb");
+    if (!file) {
+        log::ErrorLog("Can't open %s for writing\n", file_name.c_str());
+        return false;
+    }
+
+    bool written = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    for (size_t i = 0; i < image.levels.size() && written; i++) {
+        const TextureLevel &level = image.levels[i];
+        written = fwrite(image.GetLevel(i), 1, level.size, file) == level.size;
+    }
+    fclose(file);
+
+    return written;
+}
+
+} // namespace sp
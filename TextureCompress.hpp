@@ -0,0 +1,65 @@
+#ifndef _SP_TEXTURE_COMPRESS_H_
+#define _SP_TEXTURE_COMPRESS_H_
+
+#include <GL/glew.h>
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+
+#include "FileSystem.hpp"
+
+namespace sp {
+
+enum BlockFormat { kBC1, kBC3, kBC5 };
+
+struct TextureLevel {
+    int width;
+    int height;
+    size_t offset;
+    size_t size;
+};
+
+// A mip chain in one allocation. internal_format is one of the block
+// compressed formats, or GL_RGBA8 for plain RGBA8 levels. Images loaded from
+// a container keep the file open and their levels point into it; encoded
+// and decompressed images own data instead.
+struct TextureImage {
+    GLenum internal_format;
+    std::vector<TextureLevel> levels;
+    std::vector<Uint8> data;
+    vfs::File file;
+
+    bool IsCompressed() const { return internal_format != GL_RGBA8; }
+    const Uint8 *GetLevel(size_t level) const
+    {
+        const Uint8 *base = file.IsOpen() ? file.GetData() : data.data();
+        return base + levels[level].offset;
+    }
+};
+
+GLenum GetBlockInternalFormat(BlockFormat format);
+size_t GetBlockSize(GLenum internal_format);
+
+// Whether the driver takes internal_format through glCompressedTexImage2D.
+// Reads GLEW's extension flags only, so any thread may ask once GLEW is up.
+bool IsBlockFormatSupported(GLenum internal_format);
+
+// Encodes a width x height RGBA8 image (pitch bytes per row) and its mip
+// chain, down to 1x1 or MAX_TEXTURE_MIPS levels. Meant for cook time, the
+// encoder favors speed over quality. BC5 stores red and green only.
+void CompressImage(const Uint8 *pixels, int width, int height, int pitch,
+                   BlockFormat format, TextureImage *image);
+
+// Expands a block compressed image to GL_RGBA8 levels for drivers without
+// the matching extension.
+void DecompressImage(const TextureImage &compressed, TextureImage *image);
+
+// DDS (DXT1, DXT5, ATI2 and their DX10 equivalents) and KTX 1 containers
+// holding BC1, BC3 or BC5 2D textures.
+bool LoadCompressedImage(const std::string &file_name, TextureImage *image);
+bool IsCompressedImageFile(const std::string &file_name);
+bool WriteDDS(const std::string &file_name, const TextureImage &image);
+
+} // namespace sp
+
+#endif
@@ -0,0 +1,229 @@
+#include <climits>
+#include <cstdint>
+
+#include "Tokenizer.hpp"
+
+namespace sp
+{
+
+// Powers of ten a double holds exactly.
+static const double kPowersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+const int kMaxExactPower = 22;
+
+// A uint64_t takes any 19 digit number.
+const int kMaxMantissaDigits = 19;
+
+// Control characters count as whitespace too, one compare per byte.
+static bool IsSpace(char c) { return Uint8(c) <= ' '; }
+
+static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+//------------------------------------------------------------------------------
+
+void Tokenizer::SkipSpace()
+{
+    while (cursor != end) {
+        if (*cursor == '\n') {
+            line++;
+            cursor++;
+        } else if (IsSpace(*cursor)) {
+            cursor++;
+        } else if (*cursor == '/' && end - cursor > 1 && cursor[1] == '/') {
+            SkipLine();
+        } else {
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+std::string_view Tokenizer::Next()
+{
+    if (error) {
+        return {};
+    }
+
+    SkipSpace();
+    if (cursor == end) {
+        return {};
+    }
+
+    const char *begin = cursor;
+    if (*cursor == '"') {
+        begin++;
+        do {
+            cursor++;
+        } while (cursor != end && *cursor != '"' && *cursor != '\n');
+
+        std::string_view token(begin, cursor - begin);
+        if (cursor != end && *cursor == '"') {
+            cursor++;
+        }
+        return token;
+    }
+
+    while (cursor != end && !IsSpace(*cursor)) {
+        cursor++;
+    }
+    return std::string_view(begin, cursor - begin);
+}
+
+//------------------------------------------------------------------------------
+
+bool Tokenizer::Next(float *value)
+{
+    std::string_view token = Next();
+    if (!ParseFloat(token.data(), token.data() + token.size(), value)) {
+        error = true;
+    }
+    return !error;
+}
+
+//------------------------------------------------------------------------------
+
+bool Tokenizer::Next(int *value)
+{
+    std::string_view token = Next();
+    if (!ParseInt(token.data(), token.data() + token.size(), value)) {
+        error = true;
+    }
+    return !error;
+}
+
+//------------------------------------------------------------------------------
+
+bool Tokenizer::Expect(std::string_view token)
+{
+    if (Next() != token) {
+        error = true;
+    }
+    return !error;
+}
+
+//------------------------------------------------------------------------------
+
+void Tokenizer::SkipLine()
+{
+    while (cursor != end && *cursor != '\n') {
+        cursor++;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool ParseFloat(const char *begin, const char *end, float *value)
+{
+    const char *p = begin;
+    bool negative = p != end && *p == '-';
+    if (p != end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+
+    // Digits past the first 19 significant ones only scale the mantissa.
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool has_digits = false;
+
+    for (; p != end && IsDigit(*p); p++) {
+        has_digits = true;
+        if (digits < kMaxMantissaDigits) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
+
+    if (p != end && *p == '.') {
+        for (p++; p != end && IsDigit(*p); p++) {
+            has_digits = true;
+            if (digits < kMaxMantissaDigits) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (!has_digits) {
+        return false;
+    }
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        if (p == end || !IsDigit(*p)) {
+            return false;
+        }
+
+        int written = 0;
+        for (; p != end && IsDigit(*p); p++) {
+            // Anything this large is zero or infinity either way.
+            if (written < 10000) {
+                written = written * 10 + (*p - '0');
+            }
+        }
+        exponent += negative_exponent ? -written : written;
+    }
+
+    if (p != end) {
+        return false;
+    }
+
+    // Dividing by an exact power of ten rounds only once for mantissas
+    // below 2^53, which covers every float the engine writes.
+    double result = double(mantissa);
+    if (mantissa != 0) {
+        for (; exponent > kMaxExactPower; exponent -= kMaxExactPower) {
+            result *= kPowersOf10[kMaxExactPower];
+        }
+        for (; exponent < -kMaxExactPower; exponent += kMaxExactPower) {
+            result /= kPowersOf10[kMaxExactPower];
+        }
+        if (exponent >= 0) {
+            result *= kPowersOf10[exponent];
+        } else {
+            result /= kPowersOf10[-exponent];
+        }
+    }
+
+    *value = float(negative ? -result : result);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool ParseInt(const char *begin, const char *end, int *value)
+{
+    const char *p = begin;
+    bool negative = p != end && *p == '-';
+    if (p != end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p == end) {
+        return false;
+    }
+
+    long long result = 0;
+    for (; p != end; p++) {
+        if (!IsDigit(*p)) {
+            return false;
+        }
+        result = result * 10 + (*p - '0');
+        if (result > INT_MAX) {
+            return false;
+        }
+    }
+
+    *value = int(negative ? -result : result);
+    return true;
+}
+
+} // namespace sp
@@ -0,0 +1,62 @@
+#ifndef _SP_TOKENIZER_H_
+#define _SP_TOKENIZER_H_
+
+#include <string_view>
+
+#include "FileSystem.hpp"
+
+namespace sp {
+
+// Splits the text of id Tech formats like md5mesh and md5anim into tokens
+// without allocating. Tokens are separated by whitespace, "//" comments run
+// to the end of the line and a quoted string is one token, returned without
+// its quotes. Tokens point into the text, which must outlive them.
+class Tokenizer
+{
+public:
+    Tokenizer(const char *text, size_t size)
+        : cursor(text), end(text + size), line(1), error(false)
+    {
+    }
+    explicit Tokenizer(const vfs::File &file)
+        : Tokenizer(reinterpret_cast<const char *>(file.GetData()),
+                    file.GetSize())
+    {
+    }
+
+    // Empty at the end of the text.
+    std::string_view Next();
+
+    // Read the next token as a number, with optional sign, fraction and
+    // exponent for floats. Return false and set the error flag when it
+    // isn't one.
+    bool Next(float *value);
+    bool Next(int *value);
+
+    // Reads the next token, false and the error flag unless it is token.
+    bool Expect(std::string_view token);
+
+    void SkipLine();
+
+    // Once set, every read fails, so a run of reads can be checked once.
+    bool HasError() const { return error; }
+    // The line the last token was read from.
+    int GetLine() const { return line; }
+
+private:
+    void SkipSpace();
+
+    const char *cursor;
+    const char *end;
+    int line;
+    bool error;
+};
+
+// Parses all of [begin, end) as a decimal number, false if it isn't one.
+// Floats come out within an ulp of strtof.
+bool ParseFloat(const char *begin, const char *end, float *value);
+bool ParseInt(const char *begin, const char *end, int *value);
+
+} // namespace sp
+
+#endif
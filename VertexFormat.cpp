@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "VertexFormat.hpp"
+
+namespace sp
+{
+
+//------------------------------------------------------------------------------
+
+GLsizei GetVertexSize(VertexFormat format)
+{
+    switch (format) {
+    case kVertexPacked:
+        return sizeof(PackedVertex);
+    case kVertexQuantized:
+        return sizeof(QuantizedVertex);
+    case kVertexFloat:
+        break;
+    }
+
+    return sizeof(Vertex);
+}
+
+//------------------------------------------------------------------------------
+
+GLhalf PackHalf(float value)
+{
+    GLuint bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    GLuint sign = (bits >> 16) & 0x8000;
+    int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+    GLuint mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff) {
+        // Infinity stays infinity, NaN stays a quiet NaN.
+        return GLhalf(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    if (exponent >= 31) {
+        return GLhalf(sign | 0x7c00);
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return GLhalf(sign);
+        }
+        // Denormal: shift the mantissa, with its implicit bit, into place.
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        GLuint half = mantissa >> shift;
+        GLuint rest = mantissa & ((1u << shift) - 1);
+        GLuint halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return GLhalf(sign | half);
+    }
+
+    GLuint half = (GLuint(exponent) << 10) | (mantissa >> 13);
+    GLuint rest = mantissa & 0x1fff;
+    // A carry out of the mantissa correctly bumps the exponent.
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+
+    return GLhalf(sign | half);
+}
+
+//------------------------------------------------------------------------------
+
+static inline GLuint PackSnorm(float value, int bits)
+{
+    float max = float((1 << (bits - 1)) - 1);
+    int packed = int(std::lround(std::min(std::max(value, -1.0f), 1.0f) * max));
+
+    return GLuint(packed) & ((1u << bits) - 1);
+}
+
+//------------------------------------------------------------------------------
+
+GLuint PackSnorm1010102(float x, float y, float z, float w)
+{
+    return PackSnorm(x, 10) | (PackSnorm(y, 10) << 10) |
+           (PackSnorm(z, 10) << 20) | (PackSnorm(w, 2) << 30);
+}
+
+//------------------------------------------------------------------------------
+
+GLushort PackUnorm16(float value, float scale, float bias)
+{
+    float normalized = scale > 0.0f ? (value - bias) / scale : 0.0f;
+    normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+
+    return GLushort(std::lround(normalized * 65535.0f));
+}
+
+} // namespace sp
@@ -0,0 +1,82 @@
+#ifndef _SP_VERTEX_FORMAT_H_
+#define _SP_VERTEX_FORMAT_H_
+
+#include <GL/glew.h>
+
+namespace sp {
+
+// Vertex layouts a mesh can be packed into, all using the same attribute
+// locations: 0 position, 1 normal, 2 texcoord, 3 tangent, 4 blend indices
+// and 5 blend weights. See backend::SetVertAttribPointers.
+enum VertexFormat {
+    // Vertex, 56 bytes.
+    kVertexFloat,
+    // PackedVertex, 32 bytes. Normals and tangents in signed 10_10_10_2,
+    // texcoords in half floats.
+    kVertexPacked,
+    // QuantizedVertex, 28 bytes. As packed, but positions are 16 bit and
+    // normalized to the mesh bounds; the vertex shader restores them with
+    // the position_scale and position_bias uniforms.
+    kVertexQuantized,
+};
+
+struct Vertex {
+    GLfloat position[3];
+    GLfloat normal[3];
+    GLfloat tangent[4];
+    GLfloat texcoord[2];
+    GLubyte blendindex[4];
+    GLubyte blendweight[4];
+};
+
+struct PackedVertex {
+    GLfloat position[3];
+    GLuint normal;
+    GLuint tangent;
+    GLhalf texcoord[2];
+    GLubyte blendindex[4];
+    GLubyte blendweight[4];
+};
+
+struct QuantizedVertex {
+    // The fourth component only pads to four bytes.
+    GLushort position[4];
+    GLuint normal;
+    GLuint tangent;
+    GLhalf texcoord[2];
+    GLubyte blendindex[4];
+    GLubyte blendweight[4];
+};
+
+static_assert(sizeof(Vertex) == 56, "Vertex must stay tightly packed");
+static_assert(sizeof(PackedVertex) == 32, "PackedVertex must be 32 bytes");
+static_assert(sizeof(QuantizedVertex) == 28,
+              "QuantizedVertex must be 28 bytes");
+
+GLsizei GetVertexSize(VertexFormat format);
+
+// Rounds to nearest even, overflows to infinity.
+GLhalf PackHalf(float value);
+
+// GL_INT_2_10_10_10_REV with x, y and z in [-1, 1] and w, the tangent's
+// handedness, either -1 or 1.
+GLuint PackSnorm1010102(float x, float y, float z, float w = 0.0f);
+
+// Spreads value from [bias, bias + scale] over the 16 bit range.
+GLushort PackUnorm16(float value, float scale, float bias);
+
+// Picks GL_UNSIGNED_SHORT indices whenever every vertex fits them.
+inline GLenum GetIndexType(size_t num_vertices)
+{
+    return num_vertices <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+inline size_t GetIndexSize(GLenum index_type)
+{
+    return index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort)
+                                           : sizeof(GLuint);
+}
+
+} // namespace sp
+
+#endif
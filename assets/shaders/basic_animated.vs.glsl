@@ -19,19 +19,30 @@ layout(std140) uniform globalMatrices {
 
 uniform bool is_rigged = false;
 uniform mat4 model_matrix;
-uniform mat4 bone_matrices[80];
+// Skinning palettes of the whole frame, three rows per bone; this draw's
+// palette starts at bone_offset.
+uniform samplerBuffer bone_palette;
+uniform int bone_offset = 0;
+// Quantized positions arrive in [0, 1] and are scaled back to model space.
+uniform vec3 position_scale = vec3(1.0);
+uniform vec3 position_bias = vec3(0.0);
 
 void main(void)
 {
-    mat4 m;
+    mat4 m = mat4(1.0);
     if (is_rigged) {
-        m =  bone_matrices[int(blend_index.x)] * blend_weight.x;
-        m += bone_matrices[int(blend_index.y)] * blend_weight.y;
-        m += bone_matrices[int(blend_index.z)] * blend_weight.z;
-        m += bone_matrices[int(blend_index.w)] * blend_weight.w;
+        vec4 rows[3] = vec4[3](vec4(0.0), vec4(0.0), vec4(0.0));
+        for (int i = 0; i < 4; i++) {
+            int base = (bone_offset + int(blend_index[i])) * 3;
+            rows[0] += texelFetch(bone_palette, base) * blend_weight[i];
+            rows[1] += texelFetch(bone_palette, base + 1) * blend_weight[i];
+            rows[2] += texelFetch(bone_palette, base + 2) * blend_weight[i];
+        }
+        m = transpose(mat4(rows[0], rows[1], rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
     }
 
-    vec4 pos = model_matrix * m * vec4(position, 1.0);
+    vec3 model_pos = position * position_scale + position_bias;
+    vec4 pos = model_matrix * m * vec4(model_pos, 1.0);
     gl_Position = projection_matrix * view_matrix * pos;
     vs_color = vec4(1.0, 1.0, 1.0, 0.0);
     vs_normal = -mat3(transpose(inverse(model_matrix * m))) * normal;
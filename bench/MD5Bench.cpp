@@ -0,0 +1,359 @@
+// Times parsing the bundled MD5 assets with the old istream loop against
+// sp::Tokenizer. Both sides read the same fields the loaders do, without
+// the GL and skinning work around them, and must agree on every value.
+//
+//   make RELEASE=1 bench && ./md5bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "../FileSystem.hpp"
+#include "../Tokenizer.hpp"
+
+namespace
+{
+
+const char *const kAssets[] = {
+    "assets/models/hellknight/hellknight.md5mesh",
+    "assets/models/hellknight/idle2.md5anim",
+    "assets/models/hellknight/attack2.md5anim",
+    "assets/models/bob_lamp/boblampclean.md5mesh",
+    "assets/models/bob_lamp/boblampclean.md5anim",
+};
+
+// Everything a parser read, in file order.
+struct Parsed {
+    std::vector<std::string> names;
+    std::vector<int> ints;
+    std::vector<float> floats;
+
+    bool operator==(const Parsed &other) const
+    {
+        return names == other.names && ints == other.ints &&
+               floats == other.floats;
+    }
+};
+
+const std::streamsize kLine = std::numeric_limits<std::streamsize>::max();
+
+void RemoveQuotes(std::string &str)
+{
+    size_t n;
+    while ((n = str.find('\"')) != std::string::npos) {
+        str.erase(n, 1);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// The loops MD5Model::LoadModel and MD5Animation::LoadAnimation used before
+// the tokenizer, minus the parts of the grammar the two formats don't share.
+void ParseWithStream(const sp::vfs::File &contents, Parsed *out)
+{
+    sp::vfs::MemoryStream file(contents);
+    std::string param, junk, name;
+    int count = 0, num_joints = 0, num_frames = 0, num_components = 0;
+    int value;
+    float x, y, z;
+
+    file >> param;
+    while (!file.eof()) {
+        if (param == "commandline") {
+            file.ignore(kLine, '\n');
+        } else if (param == "numJoints" || param == "numFrames" ||
+                   param == "numAnimatedComponents" ||
+                   param == "MD5Version" || param == "numMeshes" ||
+                   param == "frameRate") {
+            file >> value;
+            out->ints.push_back(value);
+            num_joints = param == "numJoints" ? value : num_joints;
+            num_frames = param == "numFrames" ? value : num_frames;
+            num_components =
+                param == "numAnimatedComponents" ? value : num_components;
+        } else if (param == "joints") {
+            file >> junk;
+            for (int i = 0; i < num_joints; ++i) {
+                file >> name >> value >> junk >> x >> y >> z >> junk;
+                RemoveQuotes(name);
+                out->names.push_back(name);
+                out->ints.push_back(value);
+                out->floats.insert(out->floats.end(), {x, y, z});
+                file >> junk >> x >> y >> z >> junk;
+                out->floats.insert(out->floats.end(), {x, y, z});
+                file.ignore(kLine, '\n');
+            }
+            file >> junk;
+        } else if (param == "mesh") {
+            file >> junk >> param;
+            while (param != "}") {
+                if (param == "shader") {
+                    file >> name;
+                    RemoveQuotes(name);
+                    out->names.push_back(name);
+                    file.ignore(kLine, '\n');
+                } else if (param == "numverts") {
+                    file >> count;
+                    file.ignore(kLine, '\n');
+                    for (int i = 0; i < count; i++) {
+                        int start, weights;
+                        file >> junk >> junk >> junk >> x >> y >> junk >>
+                            start >> weights;
+                        file.ignore(kLine, '\n');
+                        out->floats.insert(out->floats.end(), {x, y});
+                        out->ints.insert(out->ints.end(), {start, weights});
+                    }
+                } else if (param == "numtris") {
+                    file >> count;
+                    file.ignore(kLine, '\n');
+                    for (int i = 0; i < count; i++) {
+                        int a, b, c;
+                        file >> junk >> junk >> a >> b >> c;
+                        file.ignore(kLine, '\n');
+                        out->ints.insert(out->ints.end(), {a, b, c});
+                    }
+                } else if (param == "numweights") {
+                    file >> count;
+                    file.ignore(kLine, '\n');
+                    for (int i = 0; i < count; i++) {
+                        float bias;
+                        file >> junk >> junk >> value >> bias >> junk >> x >>
+                            y >> z >> junk;
+                        file.ignore(kLine, '\n');
+                        out->ints.push_back(value);
+                        out->floats.insert(out->floats.end(), {bias, x, y, z});
+                    }
+                } else {
+                    file.ignore(kLine, '\n');
+                }
+                file >> param;
+            }
+        } else if (param == "hierarchy") {
+            file >> junk;
+            for (int i = 0; i < num_joints; i++) {
+                int flags, start;
+                file >> name >> value >> flags >> start;
+                RemoveQuotes(name);
+                out->names.push_back(name);
+                out->ints.insert(out->ints.end(), {value, flags, start});
+                file.ignore(kLine, '\n');
+            }
+            file >> junk;
+        } else if (param == "bounds" || param == "baseframe") {
+            file >> junk;
+            file.ignore(kLine, '\n');
+            int rows = param == "bounds" ? num_frames : num_joints;
+            for (int i = 0; i < rows; i++) {
+                file >> junk >> x >> y >> z >> junk;
+                out->floats.insert(out->floats.end(), {x, y, z});
+                file >> junk >> x >> y >> z;
+                out->floats.insert(out->floats.end(), {x, y, z});
+                file.ignore(kLine, '\n');
+            }
+            file >> junk;
+            file.ignore(kLine, '\n');
+        } else if (param == "frame") {
+            file >> value >> junk;
+            out->ints.push_back(value);
+            file.ignore(kLine, '\n');
+            for (int i = 0; i < num_components; i++) {
+                file >> x;
+                out->floats.push_back(x);
+            }
+            file >> junk;
+            file.ignore(kLine, '\n');
+        }
+        file >> param;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void ReadTuple(sp::Tokenizer &tokens, int count, Parsed *out)
+{
+    float value;
+    tokens.Expect("(");
+    for (int i = 0; i < count; i++) {
+        tokens.Next(&value);
+        out->floats.push_back(value);
+    }
+    tokens.Expect(")");
+}
+
+// The same grammar the way the loaders read it now.
+bool ParseWithTokenizer(const sp::vfs::File &contents, Parsed *out)
+{
+    sp::Tokenizer tokens(contents);
+    int count = 0, num_joints = 0, num_frames = 0, num_components = 0;
+    int value;
+    float x;
+
+    for (std::string_view param = tokens.Next(); !param.empty();
+         param = tokens.Next()) {
+        if (param == "commandline") {
+            tokens.SkipLine();
+        } else if (param == "numJoints" || param == "numFrames" ||
+                   param == "numAnimatedComponents" ||
+                   param == "MD5Version" || param == "numMeshes" ||
+                   param == "frameRate") {
+            tokens.Next(&value);
+            out->ints.push_back(value);
+            num_joints = param == "numJoints" ? value : num_joints;
+            num_frames = param == "numFrames" ? value : num_frames;
+            num_components =
+                param == "numAnimatedComponents" ? value : num_components;
+        } else if (param == "joints") {
+            tokens.Expect("{");
+            for (int i = 0; i < num_joints; ++i) {
+                out->names.emplace_back(tokens.Next());
+                tokens.Next(&value);
+                out->ints.push_back(value);
+                ReadTuple(tokens, 3, out);
+                ReadTuple(tokens, 3, out);
+            }
+            tokens.Expect("}");
+        } else if (param == "mesh") {
+            tokens.Expect("{");
+            for (param = tokens.Next(); !param.empty() && param != "}";
+                 param = tokens.Next()) {
+                if (param == "shader") {
+                    out->names.emplace_back(tokens.Next());
+                } else if (param == "numverts") {
+                    tokens.Next(&count);
+                    for (int i = 0; i < count; i++) {
+                        tokens.Expect("vert");
+                        tokens.Next(&value);
+                        ReadTuple(tokens, 2, out);
+                        tokens.Next(&value);
+                        out->ints.push_back(value);
+                        tokens.Next(&value);
+                        out->ints.push_back(value);
+                    }
+                } else if (param == "numtris") {
+                    tokens.Next(&count);
+                    for (int i = 0; i < count; i++) {
+                        tokens.Expect("tri");
+                        tokens.Next(&value);
+                        for (int j = 0; j < 3; j++) {
+                            tokens.Next(&value);
+                            out->ints.push_back(value);
+                        }
+                    }
+                } else if (param == "numweights") {
+                    tokens.Next(&count);
+                    for (int i = 0; i < count; i++) {
+                        tokens.Expect("weight");
+                        tokens.Next(&value);
+                        tokens.Next(&value);
+                        out->ints.push_back(value);
+                        tokens.Next(&x);
+                        out->floats.push_back(x);
+                        ReadTuple(tokens, 3, out);
+                    }
+                } else {
+                    tokens.SkipLine();
+                }
+            }
+        } else if (param == "hierarchy") {
+            tokens.Expect("{");
+            for (int i = 0; i < num_joints; i++) {
+                out->names.emplace_back(tokens.Next());
+                for (int j = 0; j < 3; j++) {
+                    tokens.Next(&value);
+                    out->ints.push_back(value);
+                }
+            }
+            tokens.Expect("}");
+        } else if (param == "bounds" || param == "baseframe") {
+            tokens.Expect("{");
+            int rows = param == "bounds" ? num_frames : num_joints;
+            for (int i = 0; i < rows; i++) {
+                ReadTuple(tokens, 3, out);
+                ReadTuple(tokens, 3, out);
+            }
+            tokens.Expect("}");
+        } else if (param == "frame") {
+            tokens.Next(&value);
+            out->ints.push_back(value);
+            tokens.Expect("{");
+            for (int i = 0; i < num_components; i++) {
+                tokens.Next(&x);
+                out->floats.push_back(x);
+            }
+            tokens.Expect("}");
+        }
+    }
+
+    return !tokens.HasError();
+}
+
+//------------------------------------------------------------------------------
+
+template <typename F> double TimeMs(int iterations, F parse)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        parse();
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    std::printf("%-44s %10s %10s %8s\n", "file", "istream", "tokenizer",
+                "speedup");
+
+    bool agree = true;
+    for (const char *path : kAssets) {
+        sp::vfs::File contents;
+        if (!sp::vfs::OpenMapped(path, &contents)) {
+            std::printf("%-44s missing\n", path);
+            agree = false;
+            continue;
+        }
+
+        Parsed stream, tokenized;
+        ParseWithStream(contents, &stream);
+        if (!ParseWithTokenizer(contents, &tokenized) ||
+            !(stream == tokenized)) {
+            std::printf("%-44s parsers disagree\n", path);
+            agree = false;
+            continue;
+        }
+
+        // Keep the output's capacity so only parsing is timed, like the
+        // loaders, which reserve from the counts in the file.
+        Parsed parsed = stream;
+        double stream_ms = TimeMs(iterations, [&contents, &parsed]() {
+            parsed.names.clear();
+            parsed.ints.clear();
+            parsed.floats.clear();
+            ParseWithStream(contents, &parsed);
+        });
+        double tokenizer_ms = TimeMs(iterations, [&contents, &parsed]() {
+            parsed.names.clear();
+            parsed.ints.clear();
+            parsed.floats.clear();
+            ParseWithTokenizer(contents, &parsed);
+        });
+
+        std::printf("%-44s %8.3fms %8.3fms %7.1fx\n", path, stream_ms,
+                    tokenizer_ms, stream_ms / tokenizer_ms);
+    }
+
+    return agree ? 0 : 1;
+}